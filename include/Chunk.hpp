@@ -0,0 +1,139 @@
+#pragma once
+#ifndef LOX_CHUNK_HPP
+#define LOX_CHUNK_HPP
+#include "SymbolTable.hpp"
+#include "Value.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One byte each, followed by their operands, if any. Multi-byte operands are little endian.
+enum class OpCode : uint8_t
+{
+    Constant,       // u8 constant index
+    ConstantLong,   // u24 constant index, for pools past 256 entries
+    Nil,
+    True,
+    False,
+    Pop,
+    PopN,           // u8 count, for leaving a block
+    GetLocal,       // u8 stack slot
+    SetLocal,       // u8 stack slot, leaves the value on the stack
+    GetGlobal,      // u16 global slot
+    DefineGlobal,   // u16 global slot
+    SetGlobal,      // u16 global slot, leaves the value on the stack
+    Equal,
+    NotEqual,
+    Greater,
+    GreaterEqual,
+    Less,
+    LessEqual,
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Not,
+    Negate,
+    Print,
+    Jump,           // u16 forward offset from the end of the instruction
+    JumpIfFalse,    // u16 forward offset, leaves the condition on the stack
+    Loop,           // u16 backward offset from the end of the instruction
+    Return,
+
+    // Superinstructions. The compiler never emits these, only the peephole pass (Peephole.hpp)
+    // makes them, out of the pairs that came up hottest in an OpcodePairProfile of the benchmark
+    // scripts
+    SetLocalPop,        // u8 stack slot: SetLocal then Pop, an assignment statement
+    SetGlobalPop,       // u16 global slot: SetGlobal then Pop
+    PopJumpIfFalse,     // u16 forward offset: JumpIfFalse that pops the condition either way
+    JumpIfNotLess,      // u16 forward offset: Less then PopJumpIfFalse, the usual loop condition
+    AddLocalConstant,   // u8 stack slot, u8 constant index: local = local + constant, as a statement
+    Count
+};
+
+// operand bytes that follow the opcode
+constexpr size_t OperandBytes(const OpCode op) noexcept
+{
+    switch (op)
+    {
+    case OpCode::Constant:
+    case OpCode::PopN:
+    case OpCode::GetLocal:
+    case OpCode::SetLocal:
+    case OpCode::SetLocalPop:
+        return 1u;
+    case OpCode::GetGlobal:
+    case OpCode::DefineGlobal:
+    case OpCode::SetGlobal:
+    case OpCode::Jump:
+    case OpCode::JumpIfFalse:
+    case OpCode::Loop:
+    case OpCode::SetGlobalPop:
+    case OpCode::PopJumpIfFalse:
+    case OpCode::JumpIfNotLess:
+    case OpCode::AddLocalConstant:
+        return 2u;
+    case OpCode::ConstantLong:
+        return 3u;
+    default:
+        return 0u;
+    }
+}
+
+const char* OpCodeName(OpCode op) noexcept;
+
+// A compiled script: bytecode, the constants it loads, and enough to turn a bytecode offset back
+// into a source line. Lines are run-length encoded, one entry per run of bytes from the same
+// line, since they're only looked at when something goes wrong.
+class Chunk
+{
+public:
+    void Write(uint8_t byte, uint32_t line);
+    void Write(OpCode op, uint32_t line) { Write(static_cast<uint8_t>(op), line); }
+    // for back-patching jumps
+    void Patch(size_t offset, uint8_t byte) noexcept { code[offset] = byte; }
+    // Drops the bytecode and its lines, but keeps the constants, globals and stack depth, for
+    // passes that rewrite the code
+    void ClearCode() noexcept;
+
+    // index in the constant pool. The chunk doesn't dedupe, whoever's compiling can
+    size_t AddConstant(const Value& value);
+    // a string constant owned by this chunk
+    const LoxString* MakeString(std::string_view text) { return strings.Make(text); }
+    // global slots are handed out by the compiler, the chunk keeps their names for error messages
+    size_t AddGlobal(SymbolId name);
+
+    std::span<const uint8_t> Code() const noexcept { return code; }
+    std::span<const Value> Constants() const noexcept { return constants; }
+    std::span<const SymbolId> Globals() const noexcept { return globals; }
+    uint32_t GetLine(size_t offset) const noexcept;
+
+    // deepest the value stack gets running this, worked out by the compiler so the VM can size its
+    // stack once instead of checking every push
+    size_t MaxStackDepth() const noexcept { return maxStackDepth; }
+    void SetMaxStackDepth(size_t depth) noexcept { maxStackDepth = depth; }
+
+    size_t MemoryUsage() const noexcept;
+
+private:
+    struct LineStart
+    {
+        uint32_t offset = 0u;
+        uint32_t line = 0u;
+    };
+
+    std::vector<uint8_t> code;
+    std::vector<Value> constants;
+    std::vector<LineStart> lines;
+    std::vector<SymbolId> globals;
+    StringHeap strings;
+    size_t maxStackDepth = 0u;
+};
+
+// One instruction per line, with its offset, source line and decoded operands
+std::string DisassembleChunk(const Chunk& chunk, std::string_view name);
+
+#endif //!LOX_CHUNK_HPP
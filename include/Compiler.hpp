@@ -0,0 +1,86 @@
+#pragma once
+#ifndef LOX_COMPILER_HPP
+#define LOX_COMPILER_HPP
+#include "Chunk.hpp"
+#include "Diagnostics.hpp"
+#include "Statement.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+// Turns a parsed Program into a Chunk in one pass over its statements. Locals are resolved to
+// stack slots and globals to numbered slots here, so the VM never looks a name up while running.
+class Compiler
+{
+public:
+    // the program has to outlive the compiler
+    explicit Compiler(const Program& program) noexcept;
+    Compiler(const Compiler&) = delete;
+    Compiler& operator=(const Compiler&) = delete;
+
+    // Never throws over the program itself: anything that can't be compiled goes into
+    // diagnostics, and the chunk shouldn't be run if HadError()
+    Chunk Compile(DiagnosticBuffer& diagnostics);
+    bool HadError() const noexcept { return hadError; }
+
+    static constexpr size_t k_maxLocals = 256u;
+    static constexpr size_t k_maxGlobals = 65536u;
+    static constexpr size_t k_maxConstants = 1u << 24u;
+
+private:
+    struct Local
+    {
+        SymbolId name = k_invalidSymbolId;
+        // k_uninitializedDepth while its initializer is compiling
+        uint32_t depth = 0u;
+    };
+    static constexpr uint32_t k_uninitializedDepth = UINT32_MAX;
+
+    void statement(StatementIndex idx);
+    void varDeclaration(const VarStatement& var, uint32_t line, uint32_t column);
+    void block(const BlockStatement& block, uint32_t line);
+    void whileStatement(const WhileStatement& loop, uint32_t line);
+    void expression(ExpressionIndex idx);
+    void variable(SymbolId name, uint32_t line, uint32_t column);
+    void assign(const AssignExpression& assignment, uint32_t line, uint32_t column);
+    void binary(const BinaryExpression& binary, uint32_t line);
+    void logical(const BinaryExpression& binary, uint32_t line);
+
+    void emit(OpCode op, uint32_t line);
+    void emitByte(uint8_t byte, uint32_t line);
+    void emitConstant(size_t constantIdx, uint32_t line);
+    size_t numberConstant(double value, uint32_t line, uint32_t column);
+    size_t stringConstant(std::string_view text, uint32_t line, uint32_t column);
+    // returns where the jump's operand is, for patchJump
+    size_t emitJump(OpCode op, uint32_t line);
+    void patchJump(size_t operandOffset, uint32_t line, uint32_t column);
+    // jumps back to loopStart
+    void emitLoop(size_t loopStart, uint32_t line);
+    void emitPops(size_t count, uint32_t line);
+    // -1 if the name isn't a local
+    int resolveLocal(SymbolId name, uint32_t line, uint32_t column);
+    uint16_t globalSlot(SymbolId name, uint32_t line, uint32_t column);
+    void adjustStack(ptrdiff_t delta) noexcept;
+    void error(LoxCompilerErrorCode errorCode, uint32_t line, uint32_t column, SymbolId name = k_invalidSymbolId) noexcept;
+
+    const Program& program;
+    Chunk* chunk = nullptr;
+    DiagnosticBuffer* diagnostics = nullptr;
+    bool hadError = false;
+
+    std::array<Local, k_maxLocals> locals{};
+    size_t localCount = 0u;
+    uint32_t scopeDepth = 0u;
+    size_t stackDepth = 0u;
+    size_t maxStackDepth = 0u;
+
+    std::unordered_map<SymbolId, uint16_t> globalSlots;
+    // so the same literal used all over a script takes one constant
+    std::unordered_map<uint64_t, uint32_t> numberConstants;
+    // keys point into the program's expression tree, which doesn't change while compiling
+    std::unordered_map<std::string_view, uint32_t> stringConstants;
+};
+
+#endif //!LOX_COMPILER_HPP
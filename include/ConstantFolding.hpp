@@ -0,0 +1,38 @@
+#pragma once
+#ifndef LOX_CONSTANT_FOLDING_HPP
+#define LOX_CONSTANT_FOLDING_HPP
+#include "Expression.hpp"
+#include "Statement.hpp"
+#include <cstddef>
+#include <span>
+#include <string>
+
+struct FoldStats
+{
+    // nodes reachable from the roots, before and after
+    size_t nodesBefore = 0u;
+    size_t nodesAfter = 0u;
+    // nodes that became a literal
+    size_t folded = 0u;
+    // nodes that became one of their operands: identities, !!b, and/or on a literal
+    size_t simplified = 0u;
+    size_t groupingsRemoved = 0u;
+
+    size_t Eliminated() const noexcept { return nodesBefore - nodesAfter; }
+};
+
+// Folds constant unary and binary expressions, string concatenation included, simplifies
+// identities and drops groupings, rewriting the tree in place so statements keep their indices.
+// Only rewrites what gives the same value at runtime, errors included: "a" * 1 still fails,
+// x * 1 only loses the * when x can only be a number, and x + 0 stays, since -0 + 0 is 0.
+// Nodes left behind stay in the tree, just unreachable. One forward pass, since children come
+// before their parents.
+FoldStats FoldConstants(ExpressionTree& tree, std::span<const ExpressionIndex> roots);
+// from the tree's root
+FoldStats FoldConstants(ExpressionTree& tree);
+// from every statement's expressions
+FoldStats FoldConstants(Program& program);
+
+std::string FormatFoldStats(const FoldStats& stats);
+
+#endif //!LOX_CONSTANT_FOLDING_HPP
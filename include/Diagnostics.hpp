@@ -0,0 +1,55 @@
+#pragma once
+#ifndef LOX_DIAGNOSTICS_HPP
+#define LOX_DIAGNOSTICS_HPP
+#include "LoxErrors.hpp"
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string_view>
+
+// One error from any stage of the pipeline. The lexeme points into the DiagnosticBuffer that
+// holds it, not the source, so it stays valid after the source is gone
+struct LoxDiagnostic
+{
+    LoxCompilerErrorCode errorCode = static_cast<LoxCompilerErrorCode>(0);
+    size_t line = 0u;
+    size_t offset = 0u;
+    std::string_view lexeme;
+};
+
+// Where the lexer and parser put their errors instead of throwing. All the storage is allocated
+// up front, so reporting an error is a few stores and a copy of its lexeme: it never allocates
+// and never throws. Once it's full, further errors only get counted. Lexemes share an arena of
+// k_lexemeBytesPerDiagnostic per diagnostic, and get cut short once that runs out.
+class DiagnosticBuffer
+{
+public:
+    static constexpr size_t k_defaultCapacity = 64u;
+    static constexpr size_t k_lexemeBytesPerDiagnostic = 128u;
+
+    explicit DiagnosticBuffer(size_t capacity = k_defaultCapacity);
+    DiagnosticBuffer(DiagnosticBuffer&&) noexcept = default;
+    DiagnosticBuffer& operator=(DiagnosticBuffer&&) noexcept = default;
+
+    // false if there was no room left for it
+    bool Report(LoxCompilerErrorCode errorCode, size_t line, size_t offset, std::string_view lexeme) noexcept;
+
+    std::span<const LoxDiagnostic> Diagnostics() const noexcept { return std::span<const LoxDiagnostic>(storage.get(), size); }
+    size_t Size() const noexcept { return size; }
+    size_t Capacity() const noexcept { return capacity; }
+    // reported after the buffer filled up
+    size_t DroppedCount() const noexcept { return dropped; }
+    bool Empty() const noexcept { return size == 0u && dropped == 0u; }
+    bool Full() const noexcept { return size == capacity; }
+    void Clear() noexcept;
+
+private:
+    std::unique_ptr<LoxDiagnostic[]> storage;
+    std::unique_ptr<char[]> lexemeStorage;
+    size_t lexemeBytesUsed = 0u;
+    size_t capacity = 0u;
+    size_t size = 0u;
+    size_t dropped = 0u;
+};
+
+#endif //!LOX_DIAGNOSTICS_HPP
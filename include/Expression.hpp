@@ -1,23 +1,32 @@
 #pragma once
 #ifndef LOX_EXPRESSION_HPP
 #define LOX_EXPRESSION_HPP
-#include "Utility.hpp"
-#include "Token.hpp" 
+#include "SymbolTable.hpp"
+#include "Token.hpp"
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstddef>
 #include <cstdint>
 #include <limits>
+#include <span>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <variant>
-#include <concepts>
+#include <vector>
 
 /*
 Initial grammar:
 
-expression -> literal | unary | binary | grouping ;
+expression -> assignment | literal | unary | binary | grouping ;
+assignment -> IDENTIFIER "=" expression ;
 literal -> NUMBER | STRING | "true" | "false" | "nil" ;
 grouping -> "(" expression ")" ;
 unary -> ( "-" | "!" ) expression ;
 binary -> expression operator expression
-operator -> "==" | "!=" | "<" | "<=" | ">" | ">=" | "+" | "-" | "*" | "/" ;
+operator -> "==" | "!=" | "<" | "<=" | ">" | ">=" | "+" | "-" | "*" | "/" | "and" | "or" ;
 */
 
 struct SourceLocation
@@ -26,126 +35,233 @@ struct SourceLocation
     size_t column{ 0u };
 };
 
-struct Expression
-{
-    Expression() noexcept = default;
-    ~Expression() noexcept = default;
-    Expression(const Expression&) noexcept = default;
-    Expression(Expression&&) noexcept = default;
-    Expression& operator=(const Expression&) noexcept = default;
-    Expression& operator=(Expression&&) noexcept = default;
-    SourceLocation loc;
-};
-
-// lowest to highest
-enum class PrecedenceLevel
+// lowest to highest. Binding power of each operator in the parser's rule table; Expression
+// is for tokens that don't continue an expression at all
+enum class PrecedenceLevel : uint8_t
 {
     Expression,
+    Assignment,
+    Or,
+    And,
     Equality,
     Comparison,
     Term,
     Factor,
     Unary,
+    Call,
     Primary
 };
 
-struct NumericLiteralExpression : public Expression
+using ExpressionIndex = uint32_t;
+constexpr ExpressionIndex k_invalidExpressionIndex = std::numeric_limits<ExpressionIndex>::max();
+
+// One struct per kind of expression, held in an ExpressionNode's variant. Children are indices
+// into the same tree rather than pointers
+struct NumericLiteralExpression
+{
+    // Kept as two 32-bit halves: a double member would make the variant 8-byte aligned and
+    // grow every node in the tree from 24 to 32 bytes
+    constexpr explicit NumericLiteralExpression(double value = std::numeric_limits<double>::max()) noexcept :
+        valueBits(std::bit_cast<std::array<uint32_t, 2>>(value)) {}
+    constexpr double Value() const noexcept { return std::bit_cast<double>(valueBits); }
+
+    std::array<uint32_t, 2> valueBits;
+};
+
+// A string's text is kept by the tree it's in (see ExpressionTree::StringText), so it goes away
+// with the tree rather than piling up in the symbol table. Only identifiers get interned
+struct StringLiteralExpression
 {
-    explicit NumericLiteralExpression(float val) noexcept : value{ val } {}
-    float value{ std::numeric_limits<float>::max() };
+    uint32_t offset = 0u;
+    uint32_t length = 0u;
 };
 
-struct StringLiteralExpression : public Expression
+// identifier text lives in the symbol table, this just holds the interned id
+struct IdentifierExpression
 {
-    explicit StringLiteralExpression(std::string_view sv) noexcept :
-        value{ sv } {}
-    std::string value{};
+    SymbolId identifier{ k_invalidSymbolId };
 };
 
-struct IdentifierLiteralExpression : public Expression
+// true, false and nil
+struct LanguageLiteralExpression
 {
-    explicit IdentifierLiteralExpression(std::string_view sv) noexcept :
-        identifier{ sv } {}
-    std::string identifier{};
+    TokenType literal{ TokenType::Invalid };
 };
 
-struct UnaryExpression : public Expression
+struct UnaryExpression
 {
-    explicit UnaryExpression(LoxToken op, Expression _rhs) noexcept :
-        operatorToken(std::move(op)), rhs(std::move(_rhs)) {}
-    LoxToken operatorToken;
-    Expression rhs;
+    TokenType op{ TokenType::Invalid };
+    ExpressionIndex operand{ k_invalidExpressionIndex };
 };
 
-struct BinaryExpression : public Expression
+// and/or are binary expressions too, whatever runs them has to short-circuit
+struct BinaryExpression
 {
-    explicit BinaryExpression(Expression _lhs, LoxToken op, Expression _rhs) noexcept :
-        lhs(std::move(_lhs)), operatorToken(std::move(op)), rhs(std::move(_rhs)) {}
-    Expression lhs;
-    LoxToken operatorToken;
-    Expression rhs;
+    ExpressionIndex lhs{ k_invalidExpressionIndex };
+    TokenType op{ TokenType::Invalid };
+    ExpressionIndex rhs{ k_invalidExpressionIndex };
 };
 
-struct LanguageLiteralExpression : public Expression
+struct GroupingExpression
 {
-    explicit LanguageLiteralExpression(TokenType _type, LoxToken _literal) noexcept :
-        type(_type), literal(_literal) {}
-    TokenType type;
-    LoxToken literal;
+    ExpressionIndex inner{ k_invalidExpressionIndex };
 };
 
-struct GroupingExpression : public Expression
+// target is always an IdentifierExpression node, so the tree still reaches every node once
+struct AssignExpression
 {
-    Expression group;
+    ExpressionIndex target{ k_invalidExpressionIndex };
+    ExpressionIndex value{ k_invalidExpressionIndex };
 };
 
+// The variant's index is the node's kind tag. Visiting it dispatches statically: no virtual
+// calls, no RTTI, and a visitor over a whole tree can be inlined into one function
+using ExpressionVariant = std::variant<
+    NumericLiteralExpression,
+    StringLiteralExpression,
+    IdentifierExpression,
+    LanguageLiteralExpression,
+    UnaryExpression,
+    BinaryExpression,
+    GroupingExpression,
+    AssignExpression>;
+
+template<typename T, typename Variant>
+struct IsVariantAlternative;
+
+template<typename T, typename... Alternatives>
+struct IsVariantAlternative<T, std::variant<Alternatives...>> : std::bool_constant<(std::is_same_v<T, Alternatives> || ...)> {};
+
 template<typename T>
-concept IsExpressionType = std::is_base_of_v<Expression, T>;
+concept IsExpressionType = IsVariantAlternative<T, ExpressionVariant>::value;
+
+struct ExpressionNode
+{
+    ExpressionVariant expression;
+    uint32_t line = 0u;
+    uint32_t column = 0u;
+};
+
+static_assert(sizeof(ExpressionNode) <= 24u, "Expression nodes should stay small, they're stored flat");
+
+// For building visitors out of lambdas: VisitExpression(tree, idx, Overloaded{ [](const UnaryExpression&) {...}, ... })
+template<typename... Visitors>
+struct Overloaded : Visitors...
+{
+    using Visitors::operator()...;
+};
+
+template<typename... Visitors>
+Overloaded(Visitors...) -> Overloaded<Visitors...>;
+
+// Flat AST: every node of a parse lives in one vector, so building a tree is one allocation
+// (when reserved up front) and walking it stays in contiguous memory. Nodes can only refer
+// to nodes added before them, which makes node order a valid post-order: a single forward
+// loop visits children before their parents, no recursion needed.
+class ExpressionTree
+{
+public:
+    ExpressionIndex AddNumericLiteral(double value, SourceLocation loc);
+    ExpressionIndex AddStringLiteral(std::string_view text, SourceLocation loc);
+    ExpressionIndex AddIdentifier(SymbolId identifier, SourceLocation loc);
+    ExpressionIndex AddLanguageLiteral(TokenType literal, SourceLocation loc);
+    ExpressionIndex AddUnary(TokenType op, ExpressionIndex operand, SourceLocation loc);
+    ExpressionIndex AddBinary(ExpressionIndex lhs, TokenType op, ExpressionIndex rhs, SourceLocation loc);
+    ExpressionIndex AddGrouping(ExpressionIndex inner, SourceLocation loc);
+    ExpressionIndex AddAssign(ExpressionIndex target, ExpressionIndex value, SourceLocation loc);
+
+    const ExpressionNode& operator[](ExpressionIndex idx) const noexcept { return nodes[idx]; }
+    // Overwrites node idx in place, for passes that rewrite the tree without renumbering it. The
+    // new node's children have to come before idx, same as for any other node
+    void Replace(ExpressionIndex idx, const ExpressionNode& node) noexcept { nodes[idx] = node; }
+    SourceLocation Location(ExpressionIndex idx) const noexcept;
+    // Copies text into the tree, for passes that make up new strings. Throws std::length_error
+    // once the tree holds 4GB of string text
+    StringLiteralExpression AddString(std::string_view text);
+    std::string_view StringText(const StringLiteralExpression& literal) const noexcept
+    {
+        return std::string_view(strings).substr(literal.offset, literal.length);
+    }
+    std::span<const ExpressionNode> Nodes() const noexcept { return nodes; }
+
+    // k_invalidExpressionIndex until something sets it
+    ExpressionIndex Root() const noexcept { return root; }
+    void SetRoot(ExpressionIndex idx) noexcept { root = idx; }
+
+    size_t Size() const noexcept { return nodes.size(); }
+    bool Empty() const noexcept { return nodes.empty(); }
+    void Reserve(size_t numNodes) { nodes.reserve(numNodes); }
+    void Clear() noexcept;
+    size_t MemoryUsage() const noexcept { return nodes.capacity() * sizeof(ExpressionNode) + strings.capacity(); }
+
+private:
+    // throws std::length_error once indices would run out
+    ExpressionIndex addNode(const ExpressionNode& node);
+
+    std::vector<ExpressionNode> nodes;
+    // text of every string literal in the tree, back to back
+    std::string strings;
+    ExpressionIndex root = k_invalidExpressionIndex;
+};
+
+// Calls visitor with the expression struct of node idx, whichever type that is
+template<typename Visitor>
+decltype(auto) VisitExpression(const ExpressionTree& tree, ExpressionIndex idx, Visitor&& visitor)
+{
+    return std::visit(std::forward<Visitor>(visitor), tree[idx].expression);
+}
+
+// "+", "!=" and so on, for printing operators back out
+const char* OperatorLexeme(TokenType type) noexcept;
 
+// Same format as the book's AstPrinter, for debugging and tests: (* (- 123) (group 45.67))
 struct PrettyPrinterVisitor
 {
+    const ExpressionTree& tree;
+
     template<IsExpressionType ExpressionType>
-    std::string Visit(const ExpressionType& expr)
+    std::string operator()(const ExpressionType& expr) const
     {
-        // doing this ourself ensures that recursive calls parenthetize as well
-        std::string result("(");
-
         if constexpr (std::is_same_v<ExpressionType, NumericLiteralExpression>)
         {
-            result += std::to_string(expr.value);
+            // shortest round-trip form, so 2 prints as 2 and not 2.000000
+            char buffer[32];
+            const auto result = std::to_chars(buffer, buffer + sizeof(buffer), expr.Value());
+            return std::string(buffer, result.ptr);
         }
         else if constexpr (std::is_same_v<ExpressionType, StringLiteralExpression>)
         {
-            result += expr.value;
+            return std::string(tree.StringText(expr));
+        }
+        else if constexpr (std::is_same_v<ExpressionType, IdentifierExpression>)
+        {
+            return std::string(SymbolTable::GetSymbolTableInstance().GetName(expr.identifier));
         }
-        else if constexpr (std::is_same_v<ExpressionType, IdentifierLiteralExpression>)
+        else if constexpr (std::is_same_v<ExpressionType, LanguageLiteralExpression>)
         {
-            result += expr.identifier;
+            return expr.literal == TokenType::True ? "true" : (expr.literal == TokenType::False ? "false" : "nil");
         }
         else if constexpr (std::is_same_v<ExpressionType, UnaryExpression>)
         {
-            result += TokenTypeToString(expr.operatorToken);
-            result += " ";
-            result += Visit(expr.rhs);
+            return "(" + std::string(OperatorLexeme(expr.op)) + " " + VisitExpression(tree, expr.operand, *this) + ")";
         }
         else if constexpr (std::is_same_v<ExpressionType, BinaryExpression>)
         {
-            result += Visit(expr.lhs);
-            result += " ";
-            result += TokenTypeToString(expr.operatorToken);
-            result += " ";
-            result += Visit(expr.rhs);
+            return "(" + std::string(OperatorLexeme(expr.op)) + " " + VisitExpression(tree, expr.lhs, *this) + " " +
+                   VisitExpression(tree, expr.rhs, *this) + ")";
+        }
+        else if constexpr (std::is_same_v<ExpressionType, GroupingExpression>)
+        {
+            return "(group " + VisitExpression(tree, expr.inner, *this) + ")";
         }
         else
         {
-            result += "INVALID_EXPRESSION_TYPE";
+            static_assert(std::is_same_v<ExpressionType, AssignExpression>, "PrettyPrinterVisitor is missing an expression type");
+            return "(= " + VisitExpression(tree, expr.target, *this) + " " + VisitExpression(tree, expr.value, *this) + ")";
         }
-
-        result += ")";
-
-        return result;
     }
 };
 
+std::string PrintExpression(const ExpressionTree& tree, ExpressionIndex idx);
 
 #endif //!LOX_EXPRESSION_HPP
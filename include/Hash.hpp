@@ -0,0 +1,186 @@
+#pragma once
+#ifndef LOX_HASH_HPP
+#define LOX_HASH_HPP
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/*
+    General purpose 64-bit hash for everything the lexer keys on: session sources, interned
+    names, cache checksums. Follows wyhash (https://github.com/wangyi-fudan/wyhash, public
+    domain): keys up to 16 bytes take a short branchy path with at most two multiplies, which
+    is where identifiers live, and longer keys go through three independent 128-bit multiply
+    lanes of 48 bytes a round. The whole thing is constexpr, and gives the same value at
+    compile time as at run time, so tables built with it in a static_assert or constexpr
+    initializer line up with runtime lookups.
+    Not meant for anything adversarial: no secret is mixed in beyond the seed.
+*/
+namespace LoxHashDetail
+{
+    constexpr uint64_t k_secret0 = 0x2d358dccaa6c78a5ull;
+    constexpr uint64_t k_secret1 = 0x8bb84b93962eacc9ull;
+    constexpr uint64_t k_secret2 = 0x4b33a62ed433d4a3ull;
+    constexpr uint64_t k_secret3 = 0x4d5a2da51de1aa47ull;
+
+    struct Product128
+    {
+        uint64_t low;
+        uint64_t high;
+    };
+
+    constexpr Product128 Multiply128(const uint64_t a, const uint64_t b) noexcept
+    {
+        if (!std::is_constant_evaluated())
+        {
+#if defined(__SIZEOF_INT128__)
+            const unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+            return Product128{ static_cast<uint64_t>(product), static_cast<uint64_t>(product >> 64u) };
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+            uint64_t high = 0u;
+#if defined(_M_X64)
+            const uint64_t low = _umul128(a, b, &high);
+#else
+            const uint64_t low = a * b;
+            high = __umulh(a, b);
+#endif
+            return Product128{ low, high };
+#endif
+        }
+
+        // schoolbook on 32-bit halves, for constant evaluation and anything without a wide multiply
+        const uint64_t aLow = a & 0xFFFFFFFFull;
+        const uint64_t aHigh = a >> 32u;
+        const uint64_t bLow = b & 0xFFFFFFFFull;
+        const uint64_t bHigh = b >> 32u;
+        const uint64_t lowLow = aLow * bLow;
+        const uint64_t highLow = aHigh * bLow;
+        const uint64_t lowHigh = aLow * bHigh;
+        const uint64_t highHigh = aHigh * bHigh;
+        const uint64_t middle = (lowLow >> 32u) + (highLow & 0xFFFFFFFFull) + (lowHigh & 0xFFFFFFFFull);
+        return Product128{ (middle << 32u) | (lowLow & 0xFFFFFFFFull), highHigh + (highLow >> 32u) + (lowHigh >> 32u) + (middle >> 32u) };
+    }
+
+    constexpr uint64_t Mix(const uint64_t a, const uint64_t b) noexcept
+    {
+        const Product128 product = Multiply128(a, b);
+        return product.low ^ product.high;
+    }
+
+    // little-endian loads. Byte at a time when constant evaluating (or on a big-endian target),
+    // so both sides see the same value
+    template<size_t N>
+    constexpr uint64_t ReadLittleEndian(const char* p) noexcept
+    {
+        if (!std::is_constant_evaluated() && std::endian::native == std::endian::little)
+        {
+            if constexpr (N == 8u)
+            {
+                uint64_t value = 0u;
+                std::memcpy(&value, p, sizeof(value));
+                return value;
+            }
+            else
+            {
+                uint32_t value = 0u;
+                std::memcpy(&value, p, sizeof(value));
+                return value;
+            }
+        }
+
+        uint64_t value = 0u;
+        for (size_t i = 0; i < N; ++i)
+        {
+            value |= static_cast<uint64_t>(static_cast<uint8_t>(p[i])) << (8u * i);
+        }
+        return value;
+    }
+
+    // 1 to 3 bytes: first, middle and last, which covers all of them
+    constexpr uint64_t ReadSmall(const char* p, const size_t len) noexcept
+    {
+        return (static_cast<uint64_t>(static_cast<uint8_t>(p[0])) << 16u) |
+               (static_cast<uint64_t>(static_cast<uint8_t>(p[len >> 1u])) << 8u) |
+               static_cast<uint64_t>(static_cast<uint8_t>(p[len - 1u]));
+    }
+
+    constexpr uint64_t Finish(const uint64_t a, const uint64_t b, const uint64_t seed, const size_t len) noexcept
+    {
+        const Product128 product = Multiply128(a ^ k_secret1, b ^ seed);
+        return Mix(product.low ^ k_secret0 ^ len, product.high ^ k_secret1);
+    }
+
+    // over 16 bytes. Kept apart from LoxHash so the short path stays small enough to inline
+    constexpr uint64_t HashLong(const char* p, const size_t len, uint64_t seed) noexcept
+    {
+        size_t remaining = len;
+        if (remaining > 48u)
+        {
+            uint64_t lane1 = seed;
+            uint64_t lane2 = seed;
+            do
+            {
+                seed = Mix(ReadLittleEndian<8u>(p) ^ k_secret1, ReadLittleEndian<8u>(p + 8u) ^ seed);
+                lane1 = Mix(ReadLittleEndian<8u>(p + 16u) ^ k_secret2, ReadLittleEndian<8u>(p + 24u) ^ lane1);
+                lane2 = Mix(ReadLittleEndian<8u>(p + 32u) ^ k_secret3, ReadLittleEndian<8u>(p + 40u) ^ lane2);
+                p += 48u;
+                remaining -= 48u;
+            } while (remaining > 48u);
+            seed ^= lane1 ^ lane2;
+        }
+
+        while (remaining > 16u)
+        {
+            seed = Mix(ReadLittleEndian<8u>(p) ^ k_secret1, ReadLittleEndian<8u>(p + 8u) ^ seed);
+            p += 16u;
+            remaining -= 16u;
+        }
+
+        // last 16 bytes of the key, overlapping what the loops already took if need be
+        return Finish(ReadLittleEndian<8u>(p + remaining - 16u), ReadLittleEndian<8u>(p + remaining - 8u), seed, len);
+    }
+}
+
+constexpr uint64_t LoxHash(const char* data, const size_t len, uint64_t seed = 0u) noexcept
+{
+    using namespace LoxHashDetail;
+
+    // folds away when the seed is a constant, which it always is in the lexer
+    seed ^= Mix(seed ^ k_secret0, k_secret1);
+    if (len > 16u)
+    {
+        return HashLong(data, len, seed);
+    }
+
+    uint64_t a = 0u;
+    uint64_t b = 0u;
+    if (len >= 4u)
+    {
+        // two overlapping reads from each end cover 4..16 bytes without a loop
+        const size_t quarter = (len >> 3u) << 2u;
+        a = (ReadLittleEndian<4u>(data) << 32u) | ReadLittleEndian<4u>(data + quarter);
+        b = (ReadLittleEndian<4u>(data + len - 4u) << 32u) | ReadLittleEndian<4u>(data + len - 4u - quarter);
+    }
+    else if (len > 0u)
+    {
+        a = ReadSmall(data, len);
+    }
+    return Finish(a, b, seed, len);
+}
+
+constexpr uint64_t LoxHash(const std::string_view sv, const uint64_t seed = 0u) noexcept
+{
+    return LoxHash(sv.data(), sv.size(), seed);
+}
+
+inline uint64_t LoxHash(const void* key, const size_t len, const uint64_t seed = 0u) noexcept
+{
+    return LoxHash(static_cast<const char*>(key), len, seed);
+}
+
+#endif //!LOX_HASH_HPP
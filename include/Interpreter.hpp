@@ -1,6 +1,85 @@
 #pragma once
 #ifndef LOX_INTERPRETER_HPP
 #define LOX_INTERPRETER_HPP
+#include "Chunk.hpp"
+#include "Diagnostics.hpp"
 #include "Expression.hpp"
+#include "OpcodeProfile.hpp"
+#include "Value.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class InterpretResult
+{
+    Ok,
+    // lexer, parser or compiler errors: nothing ran
+    CompileError,
+    RuntimeError,
+};
+
+// Threaded dispatch: each handler jumps straight to the next one through a table of label
+// addresses (computed goto), instead of going back to one shared switch. Every opcode gets its
+// own indirect branch, which the predictor does much better on. Needs the GCC/Clang labels as
+// values extension, so everything else, or a build with LOX_COMPUTED_GOTO=0, gets the switch.
+#ifndef LOX_COMPUTED_GOTO
+#if defined(__GNUC__) || defined(__clang__)
+#define LOX_COMPUTED_GOTO 1
+#else
+#define LOX_COMPUTED_GOTO 0
+#endif
+#endif
+
+// Stack based bytecode VM. Runs a Chunk in one loop over its bytes, with the instruction
+// pointer and stack top kept in locals so they can live in registers. Values are on one
+// contiguous stack sized up front from the chunk's MaxStackDepth, so pushes never check
+// for overflow.
+class VirtualMachine
+{
+public:
+    // print statements write to output
+    explicit VirtualMachine(std::ostream& output);
+    ~VirtualMachine();
+    VirtualMachine(const VirtualMachine&) = delete;
+    VirtualMachine& operator=(const VirtualMachine&) = delete;
+
+    // Lexes, parses, folds constants, compiles, runs the peephole pass and runs source. All errors,
+    // from whichever stage, end up in diagnostics
+    InterpretResult Interpret(std::string source, DiagnosticBuffer& diagnostics);
+    // Runs chunk from the top with fresh globals. A runtime error stops it and goes into diagnostics
+    InterpretResult Run(const Chunk& chunk, DiagnosticBuffer& diagnostics);
+    // Run, counting every pair of opcodes that execute back to back into profile. A separate
+    // instantiation of the loop, so Run itself pays nothing for it
+    InterpretResult RunProfiled(const Chunk& chunk, DiagnosticBuffer& diagnostics, OpcodePairProfile& profile);
+
+    // strings made by concatenation, freed with the VM
+    size_t HeapMemoryUsage() const noexcept { return strings.MemoryUsage(); }
+
+    static constexpr size_t k_maxStackSlots = 1u << 20u;
+    // which dispatch loop this build runs
+    static constexpr bool k_threadedDispatch = LOX_COMPUTED_GOTO != 0;
+
+private:
+    template<bool Profiling>
+    InterpretResult run(const Chunk& chunk, DiagnosticBuffer& diagnostics, OpcodePairProfile* profile);
+    template<bool Profiling>
+    InterpretResult execute(const Chunk& chunk, DiagnosticBuffer& diagnostics, OpcodePairProfile* profile);
+    InterpretResult runtimeError(const Chunk& chunk, const uint8_t* instruction, LoxCompilerErrorCode errorCode,
+        DiagnosticBuffer& diagnostics, std::string_view lexeme = std::string_view{}) noexcept;
+    void flushOutput();
+
+    std::ostream& output;
+    // print output goes here first, and out in big writes
+    std::string outputBuffer;
+    std::unique_ptr<Value[]> stack;
+    size_t stackCapacity = 0u;
+    std::vector<Value> globals;
+    // whether the global in each slot has been defined yet
+    std::vector<uint8_t> globalsDefined;
+    StringHeap strings;
+};
 
 #endif //!LOX_INTERPRETER_HPP
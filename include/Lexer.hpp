@@ -1,12 +1,66 @@
 #pragma once
 #ifndef LOX_INTERPRETER_LEXER_HPP
 #define LOX_INTERPRETER_LEXER_HPP
+#include <atomic>
 #include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <span>
 #include <vector>
 #include <string>
+#include <string_view>
+#include "SessionStore.hpp"
+#include "Token.hpp"
 
-struct LoxToken;
 struct LoxScanSession;
+class CompactTokenBuffer;
+class DiagnosticBuffer;
+
+// Read-only view of a session's tokens, handed out without copying anything. The view shares
+// ownership of the session, so the tokens (and the source their string views point into) live
+// as long as the view does, even if the session gets released from the lexer in the meantime.
+// Sessions loaded from a token cache file, and ones ApplyEdit made, don't lay their tokens out
+// up front: Size(), Type() and Token() read them from wherever they are, while Tokens() and
+// everything built on it expands them all into LoxTokens the first time anything asks, once per
+// session.
+class TokenView
+{
+public:
+    TokenView() noexcept = default;
+
+    std::span<const LoxToken> Tokens() const;
+    size_t Size() const noexcept;
+    bool Empty() const noexcept { return Size() == 0u; }
+    TokenType Type(size_t idx) const noexcept;
+    // a copy of one token, without expanding the rest
+    LoxToken Token(size_t idx) const noexcept;
+    const LoxToken& operator[](size_t idx) const { return Tokens()[idx]; }
+    auto begin() const { return Tokens().begin(); }
+    auto end() const { return Tokens().end(); }
+    // whether the tokens are being read out of a token cache file
+    bool Mapped() const noexcept;
+    // false if the handle this came from didn't name a session
+    explicit operator bool() const noexcept { return session != nullptr; }
+
+private:
+    friend class Lexer;
+    TokenView(std::shared_ptr<LoxScanSession> _session, std::span<const LoxToken> _tokens, bool _deferred) noexcept :
+        session(std::move(_session)), tokens(_tokens), deferred(_deferred) {}
+
+    std::shared_ptr<LoxScanSession> session;
+    // empty for sessions that defer their tokens, which go through the session instead
+    std::span<const LoxToken> tokens;
+    bool deferred = false;
+};
+
+// Replace removedLength bytes at offset with replacement
+struct LoxSourceEdit
+{
+    size_t offset = 0u;
+    size_t removedLength = 0u;
+    std::string_view replacement;
+};
 
 class Lexer
 {
@@ -20,13 +74,64 @@ public:
 
     using OutputHandle = size_t;
     
-    // Returns size_t handle 
+    // Returns size_t handle. Sessions are cached by content: lexing the same source again
+    // hands back the existing session's handle without rescanning (sessions ApplyEdit made
+    // aren't, see there). Every Parse* call and
+    // ApplyEdit takes its own hold on the handle it returns, so each one needs its own
+    // ReleaseSession or ApplyEdit, and neither affects anyone else holding the same handle
     OutputHandle ParseScript(std::string sourceStr);
+    // Memory maps the file read-only and lexes directly over the mapping. The session
+    // owns the mapping, so token string views point into it without copying the source.
+    // Throws std::system_error if the file can't be opened.
+    OutputHandle ParseFile(const std::filesystem::path& path);
+    // ParseFile, backed by an on-disk token cache in cacheDirectory (see TokenCache.hpp). If the
+    // script has a cache file and hasn't changed since it was written, the session reads its tokens
+    // and line starts out of that instead of lexing, otherwise the file is lexed and, if it had no
+    // errors, a cache file is written for next time.
+    OutputHandle ParseFileCached(const std::filesystem::path& path, const std::filesystem::path& cacheDirectory);
+    // Splits the source at line boundaries and lexes the pieces on separate threads, then
+    // stitches the results back together. Output is identical to ParseScript(). A threadCount
+    // of 0 uses every hardware thread; small sources just go down the serial path.
+    OutputHandle ParseScriptParallel(std::string sourceStr, size_t threadCount = 0u);
+    // Copies the session's tokens out into tokensDest. Pass nullptr to just get the count.
+    // Prefer GetTokenView(), which doesn't copy anything.
     void GetTokensForHandle(const OutputHandle handle, size_t& numTokens, LoxToken* tokensDest);
+    // Lexes the previous session's source with edit applied. Edited sessions are kept as blocks of
+    // whole lines, about 16KB each, borrowed from the sessions that scanned them: only the blocks the
+    // edit touches get scanned again, and the rest are reused as they are, positions and all, so
+    // an edit costs about the same however big the script is. The caller's hold on the previous
+    // handle is released. If nobody else holds its session, handle or TokenView and it came from an
+    // earlier edit, it's updated in place and keeps its handle, otherwise it's left alone and the
+    // result gets a new handle. Edited sessions aren't cached by content, so ParseScript on the
+    // same source won't find them.
+    // Throws std::invalid_argument for unknown handles and std::out_of_range for bad edit ranges,
+    // in which case the previous handle stays valid.
+    OutputHandle ApplyEdit(const OutputHandle previous, const LoxSourceEdit& edit);
+    // Zero-copy access to the session's tokens. Unknown handles give an empty view.
+    TokenView GetTokenView(const OutputHandle handle) const;
+    // Reports the session's errors into diagnostics, in source order, with an ErrorLimitReached
+    // at the end if scanning had to stop early. Returns how many there were, whether or not
+    // they all fit. Unknown handles report nothing.
+    size_t CollectDiagnostics(const OutputHandle handle, DiagnosticBuffer& diagnostics) const;
+    // Drops the caller's hold on a session. Once nobody holds the handle the lexer lets go of the
+    // session, and its memory is freed once no TokenView still references it. Returns false if
+    // there was no such session.
+    bool ReleaseSession(const OutputHandle handle);
+    // Same tokens as GetTokensForHandle(), packed into a CompactTokenBuffer. String views
+    // in it point into the session's source, so don't release the session while using it.
+    // Unknown handles give an empty buffer.
+    CompactTokenBuffer GetCompactTokensForHandle(const OutputHandle handle);
     static void SetAllowableErrorCount(size_t count);
+    // Bounds how many finished sessions (and roughly how many bytes of them) the lexer keeps.
+    // Past that the least recently used ones get evicted and their handles stop resolving.
+    // Zero means unlimited. Defaults to 1024 sessions and 1GB.
+    static void SetSessionStoreLimits(size_t maxSessions, size_t maxBytes);
+    static SessionStoreMetrics GetSessionStoreMetrics();
 
 private:
 
+    OutputHandle scanSession(std::shared_ptr<LoxScanSession> session);
+    void scanLines(LoxScanSession& session);
     void processLine(std::string_view line, LoxScanSession& session);
     
     void extractDualCharToken(
@@ -39,7 +144,41 @@ private:
         std::string_view& line,
         LoxScanSession& session);
 
-    static size_t s_allowableErrorCount;
+    // atomic so worker threads can read it while someone else changes it
+    static std::atomic<size_t> s_allowableErrorCount;
+
+    friend class StreamingLexer;
+    friend struct LoxScanSession;
+};
+
+// Push-style lexer for input that shows up a piece at a time (pipes, sockets, stdin).
+// Complete lines are lexed as soon as they arrive and handed to the callback in batches.
+// Only a trailing partial line is ever buffered, so memory use is set by the chunk and
+// line size instead of the total input size. Token string views are only valid for the
+// duration of the callback: copy out anything that needs to live longer.
+class StreamingLexer
+{
+public:
+    using TokenCallback = std::function<void(const LoxToken* tokens, size_t numTokens)>;
+
+    explicit StreamingLexer(TokenCallback callback);
+    ~StreamingLexer();
+    StreamingLexer(const StreamingLexer&) = delete;
+    StreamingLexer& operator=(const StreamingLexer&) = delete;
+
+    void Feed(std::string_view chunk);
+    // lexes whatever partial line is left over, then emits the EOF token
+    void Finish();
+    size_t ErrorCount() const noexcept;
+
+private:
+    void lexLine(std::string_view line);
+    void flushTokens();
+
+    std::unique_ptr<LoxScanSession> session;
+    TokenCallback callback;
+    std::string pendingLine;
+    bool skipLeadingNewline = false;
 };
 
 
@@ -43,13 +43,18 @@ enum class LoxCompilerErrorCode : int
     StringLiteralMissingEndQuote, // no end quotation, can't create a valid string literal at all
     NumericLiteralParseFailure, // couldn't extract literal from string
     NumericLiteralConversionFailure, // conversion of literal to result num failed
-    InvalidKeywordUsage, // keyword followed by keyword, usually
+    InvalidKeywordUsage, // no longer reported: keyword pairs like "print nil" are fine, the parser catches bad ones
+    ErrorLimitReached, // more errors than the lexer allows, so it stopped scanning
     // Start of interpreter failures. Root cause is within our system, and user has no ability to stop this
     ScannerFailure = 30,
     // Internal failure: emplace into container of sessions failed. Not a good sign!
     UnableToSaveSessionResults,
     // Failure to extract token.
     TokenExtractionFailed,
+    // Couldn't open or memory map a source file handed to the lexer
+    UnableToOpenSourceFile,
+    // Couldn't write a token cache file out to the cache directory
+    UnableToWriteTokenCache,
 
 
     // Start of internal unknown failures
@@ -62,6 +67,16 @@ enum class LoxCompilerErrorCode : int
     InvalidTokenOrdering,
     MissingPrimaryToken,
     MissingEOF,
+    InvalidAssignmentTarget, // "a + b = c", only a variable can be assigned to
+
+    // Bytecode compiler failures: the program parsed, but breaks one of the VM's limits or a scoping rule
+    CompilerError = 140,
+    TooManyConstants,
+    TooManyLocals,
+    TooManyGlobals,
+    JumpTooLarge,
+    VariableAlreadyDeclared, // two locals with the same name in one scope
+    LocalInOwnInitializer, // var a = a; inside a block
 
     // Start of failures coming from tests
     TestFailError = 160,
@@ -73,6 +88,14 @@ enum class LoxCompilerErrorCode : int
     TestFailTokenPositionMismatch,
     // Content of a token is incorrect
     TestFailTokenContentMismatch,
+
+    // Start of runtime errors, raised by the VM while running a script
+    RuntimeError = 200,
+    OperandMustBeNumber,
+    OperandsMustBeNumbers,
+    OperandsMustBeNumbersOrStrings,
+    UndefinedVariable,
+    StackOverflow,
 };
 
 namespace std
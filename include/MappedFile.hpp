@@ -0,0 +1,40 @@
+#pragma once
+#ifndef LOX_MAPPED_FILE_HPP
+#define LOX_MAPPED_FILE_HPP
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+
+// Read-only memory mapping of a whole file. Move-only, unmaps on destruction.
+// Views into the mapping stay valid for as long as the MappedFile lives, even
+// if the MappedFile itself is moved around.
+class MappedFile
+{
+public:
+    MappedFile() noexcept = default;
+    // throws std::system_error if the file can't be opened or mapped
+    explicit MappedFile(const std::filesystem::path& path);
+    ~MappedFile();
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view View() const noexcept;
+    size_t Size() const noexcept;
+    bool IsOpen() const noexcept;
+
+private:
+    void close() noexcept;
+
+    const char* data = nullptr;
+    size_t size = 0u;
+    // empty files can't be mapped, so we track "opened" separately from having data
+    bool opened = false;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+#endif //!LOX_MAPPED_FILE_HPP
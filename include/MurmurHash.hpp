@@ -1,9 +1,14 @@
 #pragma once
+#ifndef LOX_MURMUR_HASH_HPP
+#define LOX_MURMUR_HASH_HPP
 #include <type_traits>
 #include <cstdint>
+#include <cstring>
 
 /*
     Implemented based on https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp
+    Nothing in the lexer hashes with these anymore, see Hash.hpp. Kept around as the
+    baseline the hash benchmarks compare against.
 */
 #if defined(_MSC_VER)
 
@@ -22,7 +27,7 @@ FORCE_INLINE uint64_t rotl64(uint64_t x, int r)
 
 #else
 
-#define FORCE_INLINE __attribute__((always_inline))
+#define FORCE_INLINE inline __attribute__((always_inline))
 
 FORCE_INLINE uint32_t rotl32(uint32_t x, int r)
 {
@@ -49,8 +54,7 @@ FORCE_INLINE constexpr uint64_t fmix64(uint64_t k) noexcept
 //-----------------------------------------------------------------------------
 // MurmurHash2 was written by Austin Appleby, and is placed in the public
 // domain. The author hereby disclaims copyright to this source code.
-// constexpr and noexcept hash is a fun thing
-uint64_t MurmurHash2(const void* key, const size_t len, const uint64_t seed) noexcept
+inline uint64_t MurmurHash2(const void* key, const size_t len, const uint64_t seed) noexcept
 {
     static_assert(std::is_same_v<size_t, uint64_t>, "uint64_t and size_t need to be the same for this code to work!");
     static_assert(sizeof(void*) == 8u, "This hash only works on 64-bit platforms!");
@@ -59,12 +63,15 @@ uint64_t MurmurHash2(const void* key, const size_t len, const uint64_t seed) noe
 
     uint64_t hashResult = seed ^ (static_cast<uint64_t>(len) * hashConstantM);
 
-    const uint64_t* data = reinterpret_cast<const uint64_t*>(key);
-    const uint64_t* end = data + (len / 8u);
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(key);
+    const uint8_t* end = data + (len / 8u) * 8u;
 
     while (data != end)
     {
-        uint64_t k = *data++;
+        // keys can start anywhere, so no dereferencing them as uint64_t
+        uint64_t k = 0u;
+        std::memcpy(&k, data, sizeof(k));
+        data += sizeof(k);
 
         k *= hashConstantM;
         k ^= k >> hashConstantR;
@@ -74,7 +81,7 @@ uint64_t MurmurHash2(const void* key, const size_t len, const uint64_t seed) noe
         hashResult *= hashConstantM;
     }
 
-    const uint8_t* data2 = reinterpret_cast<const uint8_t*>(data);
+    const uint8_t* data2 = data;
     const size_t lenMask = len & 7;
     switch (lenMask)
     {
@@ -101,6 +108,7 @@ uint64_t MurmurHash2(const void* key, const size_t len, const uint64_t seed) noe
         // since we can never reach any of the other cases above, this is safe
         // and can increase perf by generating less code
 #endif
+        break;
     }
 
     hashResult ^= hashResult >> hashConstantR;
@@ -119,7 +127,7 @@ struct murmur_hash_result_t
 //-----------------------------------------------------------------------------
 // MurmurHash3 was written by Austin Appleby, and is placed in the public
 // domain. The author hereby disclaims copyright to this source code.
-murmur_hash_result_t MurmurHash3(const void* key, size_t len, const uint32_t seed)
+inline murmur_hash_result_t MurmurHash3(const void* key, size_t len, const uint32_t seed)
 {
     static_assert(std::is_same_v<size_t, uint64_t>, "uint64_t and size_t need to be the same for this code to work!");
     const uint8_t* data = reinterpret_cast<const uint8_t*>(key);
@@ -131,11 +139,10 @@ murmur_hash_result_t MurmurHash3(const void* key, size_t len, const uint32_t see
     constexpr uint64_t hashConstant0 = 0x87c37b91114253d5LLU;
     constexpr uint64_t hashConstant1 = 0x4cf5ad432745937fLLU;
 
-    const uint64_t* blocks = reinterpret_cast<const uint64_t*>(data);
-
     for (size_t i = 0; i < num_blocks; ++i)
     {
-        uint64_t k0 = blocks[i * 2u + 0u];
+        uint64_t k0 = 0u;
+        std::memcpy(&k0, data + i * 16u, sizeof(k0));
 
         k0 *= hashConstant0;
         k0 = rotl64(k0, 31);
@@ -146,7 +153,8 @@ murmur_hash_result_t MurmurHash3(const void* key, size_t len, const uint32_t see
         hash0 += hash1;
         hash0 = hash0 * 5LLU + static_cast<uint64_t>(0x52dce729);
 
-        uint64_t k1 = blocks[i * 2u + 1u];
+        uint64_t k1 = 0u;
+        std::memcpy(&k1, data + i * 16u + 8u, sizeof(k1));
 
         k1 *= hashConstant1;
         k1 = rotl64(k1, 33);
@@ -159,7 +167,7 @@ murmur_hash_result_t MurmurHash3(const void* key, size_t len, const uint32_t see
 
     }
 
-    const uint8_t* tail = reinterpret_cast<const uint8_t*>(data + num_blocks * 16u);
+    const uint8_t* tail = data + num_blocks * 16u;
 
     uint64_t k0{ 0u };
     uint64_t k1{ 0u };
@@ -212,6 +220,7 @@ murmur_hash_result_t MurmurHash3(const void* key, size_t len, const uint32_t see
 #ifdef _MSC_VER
         __assume(0); // as above, len & 15u will ONLY ever create the above cases, so this is safe
 #endif
+        break;
     }
 
     hash0 ^= static_cast<uint64_t>(len);
@@ -227,4 +236,6 @@ murmur_hash_result_t MurmurHash3(const void* key, size_t len, const uint32_t see
     hash1 += hash0;
 
     return murmur_hash_result_t{ hash0, hash1 };
-}
\ No newline at end of file
+}
+
+#endif //!LOX_MURMUR_HASH_HPP
@@ -0,0 +1,46 @@
+#pragma once
+#ifndef LOX_OPCODE_PROFILE_HPP
+#define LOX_OPCODE_PROFILE_HPP
+#include "Chunk.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Histogram of which opcode runs right after which, filled in by VirtualMachine::RunProfiled.
+// Pairs are counted as they execute, so a loop body counts once per iteration and code that
+// never runs doesn't count at all. Its hot pairs are what the peephole pass fuses, see Peephole.hpp
+class OpcodePairProfile
+{
+public:
+    struct Pair
+    {
+        OpCode first = OpCode::Return;
+        OpCode second = OpCode::Return;
+        uint64_t count = 0u;
+    };
+
+    void Record(OpCode first, OpCode second) noexcept { ++pairCounts[index(first, second)]; }
+    uint64_t Count(OpCode first, OpCode second) const noexcept { return pairCounts[index(first, second)]; }
+    uint64_t TotalPairs() const noexcept;
+    // adds other's counts to these, for profiling a whole corpus one script at a time
+    void Merge(const OpcodePairProfile& other) noexcept;
+    void Clear() noexcept { pairCounts.fill(0u); }
+
+    // the numPairs most frequent pairs that ran at all, most frequent first
+    std::vector<Pair> TopPairs(size_t numPairs) const;
+    // TopPairs as a table, with each pair's share of everything that ran
+    std::string Report(size_t numPairs) const;
+
+private:
+    static constexpr size_t k_numOpCodes = static_cast<size_t>(OpCode::Count);
+    static constexpr size_t index(OpCode first, OpCode second) noexcept
+    {
+        return static_cast<size_t>(first) * k_numOpCodes + static_cast<size_t>(second);
+    }
+
+    std::array<uint64_t, k_numOpCodes * k_numOpCodes> pairCounts{};
+};
+
+#endif //!LOX_OPCODE_PROFILE_HPP
@@ -1,10 +1,14 @@
 #pragma once
 #ifndef LOX_PARSER_HPP
 #define LOX_PARSER_HPP
+#include "Diagnostics.hpp"
 #include "Expression.hpp"
+#include "Lexer.hpp"
 #include "LoxErrors.hpp"
-#include <vector>
+#include "Statement.hpp"
+#include <span>
 #include <stdexcept>
+#include <vector>
 
 struct ParseError : public std::runtime_error
 {
@@ -16,30 +20,97 @@ struct ParseError : public std::runtime_error
 class Parser
 {
 public:
-    Parser(const std::vector<LoxToken>& tokens);
+    // Borrows the tokens, which have to outlive the parser. Nothing is copied: the parser only
+    // keeps a cursor into them
+    explicit Parser(std::span<const LoxToken> tokens) noexcept;
+    // same, but holds on to the lexer session so the tokens can't go away underneath it. Token cache
+    // and edited sessions get expanded here, since rules keep references to the tokens they're handed
+    explicit Parser(TokenView tokenView) noexcept;
     ~Parser() = default;
     Parser(const Parser&) = delete;
     Parser& operator=(const Parser&) = delete;
 
+    // Parses declarations from the current position up to EndOfFile. Never throws over bad
+    // syntax: each error goes into diagnostics, the parser skips ahead to the next statement
+    // boundary and carries on, and the program gets every statement that did parse. Everything
+    // is allocated up front, so errors cost a Report() and a skip, not an exception.
+    Program ParseProgram(DiagnosticBuffer& diagnostics);
+    // Parses one expression from the current position into a fresh tree, with its root set, and
+    // leaves the cursor on the token after it. Comments are skipped. Throws ParseError with the
+    // first error if the tokens don't form one, or don't end in EndOfFile
+    ExpressionTree ParseExpression();
+    // whether the last parse found any errors
+    bool HadError() const noexcept { return hadError; }
+
 private:
-    std::vector<LoxToken> tokens;
-    using TokenIter = decltype(tokens)::const_iterator;
-
-    Expression expression(TokenIter iter) const;
-    Expression equality(TokenIter iter) const;
-    Expression comparison(TokenIter iter) const;
-    Expression term(TokenIter iter) const;
-    Expression factor(TokenIter iter) const;
-    Expression unary(TokenIter iter) const;
-    Expression primary(TokenIter iter) const;
-
-    bool isAtEnd(TokenIter iter) const;
-    const LoxToken& advance(TokenIter iter) const noexcept;
-    const LoxToken& previous(TokenIter iter) const noexcept;
-    const LoxToken& peek(TokenIter iter) const noexcept;
-    bool match(const std::vector<TokenType>& types, TokenIter iter) const noexcept;
-    void consume(TokenType type, std::string failureString) const;
+    // Pratt parsing: every token type gets a row in one table, saying what to do with it at the
+    // start of an expression (prefix), what to do with it after one (infix), and how tightly the
+    // infix form binds. A single loop in parsePrecedence handles every operator, so a new
+    // operator is a new row, not a new function and another level of recursion
+    using PrefixParseFn = ExpressionIndex (Parser::*)(ExpressionTree& tree, const LoxToken& token);
+    using InfixParseFn = ExpressionIndex (Parser::*)(ExpressionTree& tree, ExpressionIndex lhs, const LoxToken& token);
+
+    struct ParseRule
+    {
+        PrefixParseFn prefix = nullptr;
+        InfixParseFn infix = nullptr;
+        PrecedenceLevel precedence = PrecedenceLevel::Expression;
+    };
+
+    static const ParseRule& getRule(TokenType type) noexcept;
+
+    TokenView tokenView;
+    std::span<const LoxToken> tokens;
+    // index of the next unread token, never a comment. The one token of lookahead is tokens[currentToken]
     size_t currentToken = 0u;
+    const LoxToken* previousToken = nullptr;
+
+    // null when nobody's collecting (ParseExpression), in which case only the first error is kept
+    DiagnosticBuffer* diagnostics = nullptr;
+    // set by the first error in a statement, so the errors that fall out of it don't get reported.
+    // Cleared once synchronize() finds the next statement
+    bool panicMode = false;
+    bool hadError = false;
+    LoxCompilerErrorCode firstErrorCode = LoxCompilerErrorCode::ParserError;
+    LoxToken firstErrorToken;
+    // statements of the blocks we're in the middle of, reserved once per program
+    std::vector<StatementIndex> pendingStatements;
+
+    // Statement rules give back k_invalidStatementIndex, and expression rules
+    // k_invalidExpressionIndex, after an error
+    StatementIndex declaration(Program& program);
+    StatementIndex varDeclaration(Program& program, const LoxToken& keyword);
+    StatementIndex statement(Program& program);
+    StatementIndex printStatement(Program& program, const LoxToken& keyword);
+    StatementIndex whileStatement(Program& program, const LoxToken& keyword);
+    StatementIndex expressionStatement(Program& program);
+    StatementIndex block(Program& program, const LoxToken& leftBrace);
+
+    ExpressionIndex expression(ExpressionTree& tree);
+    // parses anything that binds at least as tightly as minPrecedence
+    ExpressionIndex parsePrecedence(ExpressionTree& tree, PrecedenceLevel minPrecedence);
+
+    ExpressionIndex languageLiteral(ExpressionTree& tree, const LoxToken& token);
+    ExpressionIndex numericLiteral(ExpressionTree& tree, const LoxToken& token);
+    ExpressionIndex stringLiteral(ExpressionTree& tree, const LoxToken& token);
+    ExpressionIndex identifier(ExpressionTree& tree, const LoxToken& token);
+    ExpressionIndex grouping(ExpressionTree& tree, const LoxToken& token);
+    ExpressionIndex unary(ExpressionTree& tree, const LoxToken& token);
+    ExpressionIndex binary(ExpressionTree& tree, ExpressionIndex lhs, const LoxToken& token);
+    ExpressionIndex assignment(ExpressionTree& tree, ExpressionIndex lhs, const LoxToken& token);
+
+    // the tokens have to end in EndOfFile for the cursor to be safe
+    bool tokensTerminated() const noexcept;
+    bool isAtEnd() const noexcept;
+    // hands back the token under the cursor and moves past it, unless it's EndOfFile
+    const LoxToken& advance() noexcept;
+    const LoxToken& peek() const noexcept;
+    void skipComments() noexcept;
+    // moves past the token if it's type, otherwise reports failureCode there
+    bool consume(TokenType type, LoxCompilerErrorCode failureCode) noexcept;
+    void errorAt(const LoxToken& token, LoxCompilerErrorCode errorCode) noexcept;
+    // panic mode: skips to whatever looks like the start of the next statement
+    void synchronize() noexcept;
 };
 
-#endif //!LOX_PARSER_HPP
\ No newline at end of file
+#endif //!LOX_PARSER_HPP
@@ -0,0 +1,30 @@
+#pragma once
+#ifndef LOX_PEEPHOLE_HPP
+#define LOX_PEEPHOLE_HPP
+#include "Chunk.hpp"
+#include <cstddef>
+#include <string>
+
+struct PeepholeStats
+{
+    size_t instructionsBefore = 0u;
+    size_t instructionsAfter = 0u;
+    size_t bytesBefore = 0u;
+    size_t bytesAfter = 0u;
+    // sequences that became one superinstruction
+    size_t fused = 0u;
+    // pushes straight followed by a Pop, dropped altogether
+    size_t removed = 0u;
+};
+
+// Rewrites a compiled chunk in place, fusing the instruction sequences that an OpcodePairProfile
+// of the benchmark scripts showed running back to back into the superinstructions at the end of
+// OpCode, and dropping values that get pushed only to be popped. Jumps are relocated to match.
+// Nothing gets fused across a jump target, so every path through the chunk still runs the same
+// instructions, only fewer of them. Every instruction keeps the line of the one it came from
+// that can fail, so runtime errors still point at the same place.
+PeepholeStats OptimizeChunk(Chunk& chunk);
+
+std::string FormatPeepholeStats(const PeepholeStats& stats);
+
+#endif //!LOX_PEEPHOLE_HPP
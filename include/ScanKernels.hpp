@@ -0,0 +1,39 @@
+#pragma once
+#ifndef LOX_SCAN_KERNELS_HPP
+#define LOX_SCAN_KERNELS_HPP
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Vectorized helpers the lexer uses to skip over runs of "boring" characters:
+// identifier bodies, string literal contents, whitespace and line contents. Implementation
+// is picked at runtime based on what the CPU supports, with a scalar fallback
+// for anything that isn't x86-64 (or is very old)
+enum class ScanKernelLevel : uint32_t
+{
+    Scalar = 0,
+    SSE2,
+    AVX2
+};
+
+// Highest kernel level the CPU we're running on can use
+ScanKernelLevel GetSupportedScanKernelLevel() noexcept;
+ScanKernelLevel GetActiveScanKernelLevel() noexcept;
+// Forces the kernels to a specific level, clamped to what's supported. Mostly meant
+// for benchmarks and tests: not safe to call while other threads are lexing.
+void SetScanKernelLevel(ScanKernelLevel level) noexcept;
+const char* ScanKernelLevelToString(ScanKernelLevel level) noexcept;
+
+// All of these return the index of the first matching character in sv,
+// or sv.size() if there wasn't one.
+
+// first character that can't continue an identifier ([a-zA-Z0-9_])
+size_t FindIdentifierEnd(std::string_view sv) noexcept;
+// first occurrence of c
+size_t FindChar(std::string_view sv, char c) noexcept;
+// first character that isn't a space
+size_t FindNonSpace(std::string_view sv) noexcept;
+// first '\n' or '\r'
+size_t FindLineTerminator(std::string_view sv) noexcept;
+
+#endif //!LOX_SCAN_KERNELS_HPP
@@ -0,0 +1,93 @@
+#pragma once
+#ifndef LOX_SESSION_STORE_HPP
+#define LOX_SESSION_STORE_HPP
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+struct LoxScanSession;
+
+struct SessionStoreMetrics
+{
+    size_t liveSessions = 0u;
+    // estimated: source text, tokens and errors held by live sessions
+    size_t bytesHeld = 0u;
+    size_t evictions = 0u;
+    // content cache stats, filled in by the lexer. A collision is a hash hit on different source
+    size_t cacheHits = 0u;
+    size_t cacheMisses = 0u;
+    size_t hashCollisions = 0u;
+    // the process-wide symbol table identifiers get interned into. Never shrinks, so it's worth watching
+    size_t symbolCount = 0u;
+    size_t symbolTableBytes = 0u;
+};
+
+// Thread-safe home for the lexer's scan sessions. Handles are spread across a fixed set of
+// shards, each with its own lock, map and LRU list, so threads lexing different scripts
+// rarely contend. Limits are split evenly between shards: once a shard goes over its share
+// of the session count or byte budget, its least recently used sessions get evicted.
+// Eviction only drops the store's reference, any TokenView still holding a session keeps it alive.
+// Handles are shared between everyone who lexed the same source, so each entry counts how many
+// holders it has: Insert and Retain add one, Release drops one, and the entry only goes once the
+// last holder releases it (or it gets evicted).
+class LexerSessionStore
+{
+public:
+    // zero means no limit
+    LexerSessionStore(size_t maxSessions, size_t maxBytes) noexcept;
+    LexerSessionStore(const LexerSessionStore&) = delete;
+    LexerSessionStore& operator=(const LexerSessionStore&) = delete;
+
+    // If handle is already present the existing session is kept, gains a holder and is returned,
+    // otherwise session is added with one holder. Either way the entry becomes the most recently
+    // used in its shard.
+    std::shared_ptr<LoxScanSession> Insert(size_t handle, std::shared_ptr<LoxScanSession> session, size_t sessionBytes);
+    // nullptr if not present. Counts as a use for LRU purposes
+    std::shared_ptr<LoxScanSession> Find(size_t handle);
+    // Find, taking a hold on the entry for the caller
+    std::shared_ptr<LoxScanSession> Retain(size_t handle);
+    // Drops one holder, and the entry with the last one. False if handle isn't present
+    bool Release(size_t handle);
+    void Clear();
+
+    // takes effect from the next insert
+    void SetLimits(size_t maxSessions, size_t maxBytes) noexcept;
+    SessionStoreMetrics GetMetrics() const noexcept;
+
+    static constexpr size_t k_shardCount = 16u;
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<LoxScanSession> session;
+        size_t bytes = 0u;
+        size_t holders = 1u;
+        std::list<size_t>::iterator lruPosition;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<size_t, Entry> entries;
+        // most recently used at the front
+        std::list<size_t> lruOrder;
+        size_t bytesHeld = 0u;
+    };
+
+    Shard& shardForHandle(size_t handle) noexcept;
+    void evictOverLimit(Shard& shard, size_t protectedHandle);
+    void eraseEntry(Shard& shard, std::unordered_map<size_t, Entry>::iterator entryIter);
+
+    std::array<Shard, k_shardCount> shards;
+    std::atomic<size_t> maxSessionsPerShard;
+    std::atomic<size_t> maxBytesPerShard;
+    std::atomic<size_t> liveSessions{ 0u };
+    std::atomic<size_t> bytesHeld{ 0u };
+    std::atomic<size_t> evictions{ 0u };
+};
+
+#endif //!LOX_SESSION_STORE_HPP
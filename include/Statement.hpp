@@ -0,0 +1,121 @@
+#pragma once
+#ifndef LOX_STATEMENT_HPP
+#define LOX_STATEMENT_HPP
+#include "Expression.hpp"
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <utility>
+#include <variant>
+#include <vector>
+
+/*
+Statements so far:
+
+program -> declaration* EOF ;
+declaration -> varDecl | statement ;
+varDecl -> "var" IDENTIFIER ( "=" expression )? ";" ;
+statement -> exprStmt | printStmt | whileStmt | block ;
+exprStmt -> expression ";" ;
+printStmt -> "print" expression ";" ;
+whileStmt -> "while" "(" expression ")" statement ;
+block -> "{" declaration* "}" ;
+*/
+
+using StatementIndex = uint32_t;
+constexpr StatementIndex k_invalidStatementIndex = std::numeric_limits<StatementIndex>::max();
+
+// Expressions are indices into the program's ExpressionTree
+struct ExpressionStatement
+{
+    ExpressionIndex expression{ k_invalidExpressionIndex };
+};
+
+struct PrintStatement
+{
+    ExpressionIndex expression{ k_invalidExpressionIndex };
+};
+
+struct VarStatement
+{
+    SymbolId name{ k_invalidSymbolId };
+    // k_invalidExpressionIndex for "var a;"
+    ExpressionIndex initializer{ k_invalidExpressionIndex };
+};
+
+// body is itemCount statement indices in the program's block item list, see Program::BlockBody
+struct BlockStatement
+{
+    uint32_t firstItem{ 0u };
+    uint32_t itemCount{ 0u };
+};
+
+struct WhileStatement
+{
+    ExpressionIndex condition{ k_invalidExpressionIndex };
+    StatementIndex body{ k_invalidStatementIndex };
+};
+
+using StatementVariant = std::variant<
+    ExpressionStatement,
+    PrintStatement,
+    VarStatement,
+    BlockStatement,
+    WhileStatement>;
+
+struct StatementNode
+{
+    StatementVariant statement;
+    uint32_t line = 0u;
+    uint32_t column = 0u;
+};
+
+// Everything one parse of a script produces, stored flat like ExpressionTree: statements in one
+// vector, their expressions in one tree, and block bodies as runs of indices in another vector.
+// A statement is always added after the statements in its body.
+class Program
+{
+public:
+    ExpressionTree& Expressions() noexcept { return expressions; }
+    const ExpressionTree& Expressions() const noexcept { return expressions; }
+
+    StatementIndex AddExpressionStatement(ExpressionIndex expression, SourceLocation loc);
+    StatementIndex AddPrint(ExpressionIndex expression, SourceLocation loc);
+    StatementIndex AddVar(SymbolId name, ExpressionIndex initializer, SourceLocation loc);
+    StatementIndex AddBlock(std::span<const StatementIndex> body, SourceLocation loc);
+    StatementIndex AddWhile(ExpressionIndex condition, StatementIndex body, SourceLocation loc);
+    void AddTopLevel(StatementIndex idx) { topLevel.emplace_back(idx); }
+
+    const StatementNode& operator[](StatementIndex idx) const noexcept { return statements[idx]; }
+    SourceLocation Location(StatementIndex idx) const noexcept;
+    std::span<const StatementNode> Statements() const noexcept { return statements; }
+    // the statements a script runs, in order
+    std::span<const StatementIndex> TopLevel() const noexcept { return topLevel; }
+    std::span<const StatementIndex> BlockBody(const BlockStatement& block) const noexcept
+    {
+        return std::span<const StatementIndex>(blockItems).subspan(block.firstItem, block.itemCount);
+    }
+
+    size_t Size() const noexcept { return statements.size(); }
+    // so a parse can do all its allocating up front
+    void Reserve(size_t numExpressions, size_t numStatements);
+    size_t MemoryUsage() const noexcept;
+
+private:
+    // throws std::length_error once indices would run out
+    StatementIndex addStatement(const StatementVariant& statement, SourceLocation loc);
+
+    ExpressionTree expressions;
+    std::vector<StatementNode> statements;
+    std::vector<StatementIndex> blockItems;
+    std::vector<StatementIndex> topLevel;
+};
+
+// Calls visitor with the statement struct of statement idx, whichever type that is
+template<typename Visitor>
+decltype(auto) VisitStatement(const Program& program, StatementIndex idx, Visitor&& visitor)
+{
+    return std::visit(std::forward<Visitor>(visitor), program[idx].statement);
+}
+
+#endif //!LOX_STATEMENT_HPP
@@ -0,0 +1,74 @@
+#pragma once
+#ifndef LOX_SYMBOL_TABLE_HPP
+#define LOX_SYMBOL_TABLE_HPP
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string_view>
+#include <vector>
+
+using SymbolId = uint32_t;
+// never handed out, so a default token or expression can't alias a real name
+constexpr SymbolId k_invalidSymbolId = 0u;
+
+// Process-wide interner for identifier text. Every distinct name gets one copy in an arena and
+// one 32-bit id, handed out at lex time, so later stages compare and hash names as integers.
+// Ids and the views GetName returns stay valid for the life of the process: nothing is ever
+// removed. That's why string literals stay out of it, and why Lexer::GetSessionStoreMetrics
+// reports its size. Split into shards like the session store, each with its
+// own lock, open-addressing table and arena, and the low bits of an id say which shard it's from.
+class SymbolTable
+{
+public:
+    static SymbolTable& GetSymbolTableInstance();
+
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+
+    // Same text always gives back the same id. Throws std::length_error if a shard runs out of ids
+    SymbolId Intern(std::string_view text);
+    // empty for k_invalidSymbolId, or an id this table never handed out
+    std::string_view GetName(SymbolId id) const noexcept;
+
+    size_t Size() const noexcept;
+    // arena blocks, tables and name directories, across all shards
+    size_t MemoryUsage() const noexcept;
+
+    static constexpr size_t k_shardCount = 16u;
+
+private:
+    SymbolTable() = default;
+
+    struct Slot
+    {
+        // low half of the text's hash, so most probes that miss never touch the arena
+        uint32_t hash = 0u;
+        // index into the shard's names, plus one. Zero means the slot is empty
+        uint32_t nameIndexPlusOne = 0u;
+    };
+
+    struct Shard
+    {
+        mutable std::shared_mutex mutex;
+        // power of two sized, kept under 3/4 full
+        std::vector<Slot> slots;
+        std::vector<std::string_view> names;
+        std::vector<std::unique_ptr<char[]>> arenaBlocks;
+        size_t arenaBlockBytes = 0u;
+        size_t arenaBlockUsed = 0u;
+        size_t arenaBytes = 0u;
+    };
+
+    // the slot's nameIndexPlusOne, or zero if text isn't in the shard
+    static uint32_t findInShard(const Shard& shard, std::string_view text, uint32_t hash) noexcept;
+    static std::string_view copyToArena(Shard& shard, std::string_view text);
+    static void growSlots(Shard& shard);
+
+    std::array<Shard, k_shardCount> shards;
+    std::atomic<size_t> symbolCount{ 0u };
+};
+
+#endif //!LOX_SYMBOL_TABLE_HPP
@@ -1,6 +1,7 @@
 #pragma once
 #ifndef LOX_TOKEN_HPP
 #define LOX_TOKEN_HPP
+#include "SymbolTable.hpp"
 #include <cstdint>
 #include <limits>
 #include <string_view>
@@ -64,7 +65,7 @@ struct LoxToken
         type(_type), line(_line), offset(_offset) {}
     explicit LoxToken(TokenType _type, size_t _line, size_t _offset, std::string_view sv) :
         type(_type), line(_line), offset(_offset), strLiteral(sv) {}
-    explicit LoxToken(TokenType t, size_t _line, size_t _offset, float num) :
+    explicit LoxToken(TokenType t, size_t _line, size_t _offset, double num) :
         type(t), line(_line), offset(_offset), numericLiteral(num) {}
     
     // noexcept things so this is maximally cheap to swap and move around...
@@ -77,11 +78,14 @@ struct LoxToken
     LoxToken& operator=(LoxToken&&) noexcept = default;
 
     TokenType type = TokenType::Invalid;
+    // interned text of identifiers, string literals don't get one. Sits in what was padding after type,
+    // so tokens didn't get any bigger
+    SymbolId symbol = k_invalidSymbolId;
     size_t line = 0;
     // distance (in characters) to this token in the line
     size_t offset = 0;
     std::string_view strLiteral{};
-    float numericLiteral = std::numeric_limits<float>::max();
+    double numericLiteral = std::numeric_limits<double>::max();
 };
 
 #endif //!LOX_TOKEN_HPP
@@ -0,0 +1,64 @@
+#pragma once
+#ifndef LOX_TOKEN_BUFFER_HPP
+#define LOX_TOKEN_BUFFER_HPP
+#include "Token.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Compact, structure-of-arrays copy of a token stream. A LoxToken is 48 bytes, but most
+// consumers only ever look at the type and maybe the position. Here types are one byte each
+// in their own array and positions are a 32-bit byte offset into the source, with line and
+// column worked out on demand from a line-start index. Literal payloads (lengths and symbols
+// of identifiers/strings/comments, values of numbers) live in a side table only literal tokens
+// pay for. Views into the source stay valid as long as the source does.
+class CompactTokenBuffer
+{
+public:
+    CompactTokenBuffer() noexcept = default;
+    // tokens must have come from lexing source. Throws std::length_error for sources over 4GB
+    CompactTokenBuffer(std::string_view source, const LoxToken* tokens, size_t numTokens);
+
+    size_t Size() const noexcept;
+    bool Empty() const noexcept;
+
+    TokenType Type(size_t idx) const noexcept;
+    uint32_t ByteOffset(size_t idx) const noexcept;
+    size_t Line(size_t idx) const noexcept;
+    size_t Column(size_t idx) const noexcept;
+    std::string_view StringLiteral(size_t idx) const noexcept;
+    SymbolId Symbol(size_t idx) const noexcept;
+    double NumericLiteral(size_t idx) const noexcept;
+    // rebuilds the full token, for when something really does want a LoxToken
+    LoxToken Expand(size_t idx) const noexcept;
+
+    // raw type array, for passes that only care about token types
+    const uint8_t* Types() const noexcept;
+    // bytes held by this buffer, not counting the source itself
+    size_t MemoryUsage() const noexcept;
+
+private:
+    struct LiteralPayload
+    {
+        uint32_t tokenIndex;
+        // string-ish literals store their length, numeric literals an index into numbers
+        uint32_t lengthOrNumberIdx;
+        SymbolId symbol;
+    };
+
+    const LiteralPayload* findPayload(size_t idx) const noexcept;
+    size_t lineForOffset(uint32_t offset) const noexcept;
+
+    std::string_view source;
+    std::vector<uint8_t> types;
+    std::vector<uint32_t> offsets;
+    // byte offset each line starts at, sorted. Has an entry for the line EOF lives on too
+    std::vector<uint32_t> lineStarts;
+    // sorted by tokenIndex
+    std::vector<LiteralPayload> payloads;
+    // values of numeric literals, kept out of the payloads so those stay 12 bytes
+    std::vector<double> numbers;
+};
+
+#endif //!LOX_TOKEN_BUFFER_HPP
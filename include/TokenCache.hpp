@@ -0,0 +1,93 @@
+#pragma once
+#ifndef LOX_TOKEN_CACHE_HPP
+#define LOX_TOKEN_CACHE_HPP
+#include "MappedFile.hpp"
+#include "SymbolTable.hpp"
+#include "Token.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string_view>
+#include <vector>
+
+/*
+    On-disk token cache. One file per script, named after the script's path, holding:
+        header | token records | symbol records | line starts
+    Records refer to their literals by byte offset into the script itself, so the file never
+    holds a second copy of the source, and loaded tokens point straight into the script's own
+    mapping. Each distinct name is stored once as a symbol record that tokens refer to by index,
+    and the line starts are stored too, so loading never rescans the source.
+    Loading only checks the header: its checksum, and that the script's size and last write time
+    still match what they were when the file was written (the same bet make takes). Records are
+    read out of the mapping one at a time when asked for, and one that's been damaged since comes
+    out as an Invalid token rather than anything that points outside the source. Symbol ids are
+    only good for the process that handed them out, so each distinct name gets interned again on
+    load, which is the only part that's linear in anything. Byte order is native: these are
+    meant for a local cache directory, not for moving between machines.
+*/
+
+constexpr uint32_t k_tokenCacheFormatVersion = 5u;
+
+// what a cache file gets checked against: which script it's for, and what that script looked
+// like when the file was written
+struct TokenCacheKey
+{
+    uint64_t pathHash = 0u;
+    uint64_t sourceSize = 0u;
+    int64_t sourceWriteTime = 0;
+
+    bool operator==(const TokenCacheKey&) const noexcept = default;
+};
+
+// Tokens of a loaded cache file, read straight out of its mapping
+class MappedTokenCache
+{
+public:
+    MappedTokenCache() noexcept = default;
+
+    size_t Size() const noexcept { return tokenCount; }
+    TokenType Type(size_t idx) const noexcept;
+    // expands the record into a LoxToken, with its literal pointing into the source
+    LoxToken Token(size_t idx) const noexcept;
+    size_t LineCount() const noexcept { return lineCount; }
+    // byte offset of the line, relative to the start of the source
+    size_t LineStart(size_t idx) const noexcept;
+    // LoxHash of the source, as of when the file was written
+    uint64_t SourceHash() const noexcept { return sourceHash; }
+    size_t MemoryUsage() const noexcept;
+
+private:
+    friend bool LoadTokenCacheFile(
+        const std::filesystem::path& cacheFile, const TokenCacheKey& key, std::string_view source, MappedTokenCache& cache);
+
+    MappedFile file;
+    std::string_view source;
+    const char* records = nullptr;
+    size_t tokenCount = 0u;
+    const char* lineStarts = nullptr;
+    size_t lineCount = 0u;
+    uint64_t sourceHash = 0u;
+    // this process's id for each symbol record
+    std::vector<SymbolId> symbolIds;
+};
+
+// Fills key in from the script's path and what the filesystem says about it. Returns false if
+// the script can't be looked at
+bool GetTokenCacheKey(const std::filesystem::path& sourcePath, TokenCacheKey& key);
+std::filesystem::path GetTokenCacheFilePath(const std::filesystem::path& cacheDirectory, const TokenCacheKey& key);
+// Writes to a temporary file first and renames it into place, so readers never see half a file.
+// Token literals have to point into source, and lineStarts are byte offsets into it.
+// Throws std::system_error if writing fails.
+void WriteTokenCacheFile(
+    const std::filesystem::path& cacheFile,
+    const TokenCacheKey& key,
+    uint64_t sourceHash,
+    std::string_view source,
+    std::span<const LoxToken> tokens,
+    std::span<const size_t> lineStarts);
+// Returns false for missing, truncated, corrupt or out of date files, or ones for another script.
+// source has to be the script key was taken from, and has to outlive cache.
+bool LoadTokenCacheFile(
+    const std::filesystem::path& cacheFile, const TokenCacheKey& key, std::string_view source, MappedTokenCache& cache);
+
+#endif //!LOX_TOKEN_CACHE_HPP
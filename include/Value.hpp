@@ -0,0 +1,182 @@
+#pragma once
+#ifndef LOX_VALUE_HPP
+#define LOX_VALUE_HPP
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Runtime string. Header and characters are allocated together by a StringHeap, and never move
+// or change once made, so values just point at them.
+class LoxString
+{
+public:
+    std::string_view View() const noexcept { return std::string_view(reinterpret_cast<const char*>(this + 1), length); }
+    size_t Length() const noexcept { return length; }
+
+private:
+    friend class StringHeap;
+    explicit LoxString(uint32_t _length) noexcept : length(_length) {}
+
+    uint32_t length = 0u;
+};
+
+// Owns every string a chunk or VM makes: string constants, and the results of concatenation.
+// Bump allocated out of blocks and all freed together when the heap goes away. There's no
+// collector yet, so a VM's strings live as long as the VM does.
+class StringHeap
+{
+public:
+    StringHeap() = default;
+    StringHeap(StringHeap&&) noexcept = default;
+    StringHeap& operator=(StringHeap&&) noexcept = default;
+
+    // throws std::length_error past 4GB, like any other string would eventually
+    const LoxString* Make(std::string_view text);
+    const LoxString* Concatenate(std::string_view lhs, std::string_view rhs);
+    size_t MemoryUsage() const noexcept { return bytesReserved; }
+
+private:
+    char* allocate(size_t textLength);
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t blockBytes = 0u;
+    size_t blockUsed = 0u;
+    size_t bytesReserved = 0u;
+};
+
+enum class ValueType : uint8_t
+{
+    Nil,
+    Bool,
+    Number,
+    String,
+};
+
+// Values are NaN-boxed by default: one 64-bit word holding either a double, or a quiet NaN
+// with a tag or pointer packed into the bits a NaN doesn't use. Build with LOX_NAN_BOXING=0 to
+// get a plain tagged union instead, which is easier to look at in a debugger. Both have the
+// same interface, so nothing outside this header cares which one it got.
+#ifndef LOX_NAN_BOXING
+#if UINTPTR_MAX == UINT64_MAX
+#define LOX_NAN_BOXING 1
+#else
+#define LOX_NAN_BOXING 0
+#endif
+#endif
+
+#if LOX_NAN_BOXING
+
+// Everything a Lox expression can evaluate to. Anything with all the quiet NaN bits set isn't
+// a number: nil, false and true are small tags in the low bits, and strings set the sign bit
+// too, with the pointer in the low 48 bits. Every NaN the FPU makes has the lower of those
+// two NaN bits clear, so real NaNs still read as numbers.
+class Value
+{
+public:
+    constexpr Value() noexcept : bits(k_nilBits) {}
+
+    static constexpr Value Nil() noexcept { return Value(); }
+    static constexpr Value Bool(bool value) noexcept { return Value(value ? k_trueBits : k_falseBits); }
+    static constexpr Value Number(double value) noexcept { return Value(std::bit_cast<uint64_t>(value)); }
+    static Value String(const LoxString* value) noexcept
+    {
+        return Value(k_signBit | k_quietNan | static_cast<uint64_t>(reinterpret_cast<uintptr_t>(value)));
+    }
+
+    constexpr ValueType Type() const noexcept
+    {
+        if (IsNumber())
+        {
+            return ValueType::Number;
+        }
+        if (IsString())
+        {
+            return ValueType::String;
+        }
+        return bits == k_nilBits ? ValueType::Nil : ValueType::Bool;
+    }
+    constexpr bool IsNil() const noexcept { return bits == k_nilBits; }
+    constexpr bool IsBool() const noexcept { return (bits | 1u) == k_trueBits; }
+    constexpr bool IsNumber() const noexcept { return (bits & k_quietNan) != k_quietNan; }
+    constexpr bool IsString() const noexcept { return (bits & (k_signBit | k_quietNan)) == (k_signBit | k_quietNan); }
+
+    // only valid for a value of that type
+    constexpr bool AsBool() const noexcept { return bits == k_trueBits; }
+    constexpr double AsNumber() const noexcept { return std::bit_cast<double>(bits); }
+    const LoxString* AsString() const noexcept
+    {
+        return reinterpret_cast<const LoxString*>(static_cast<uintptr_t>(bits & ~(k_signBit | k_quietNan)));
+    }
+
+    // nil and false are falsey, everything else is truthy. Their tags are next to each
+    // other, so it's one compare
+    constexpr bool IsFalsey() const noexcept { return bits - k_nilBits <= k_falseBits - k_nilBits; }
+
+    // raw word, for comparing values that aren't numbers
+    constexpr uint64_t Bits() const noexcept { return bits; }
+
+private:
+    static constexpr uint64_t k_signBit = 0x8000000000000000ull;
+    static constexpr uint64_t k_quietNan = 0x7ffc000000000000ull;
+    static constexpr uint64_t k_nilBits = k_quietNan | 1u;
+    static constexpr uint64_t k_falseBits = k_quietNan | 2u;
+    static constexpr uint64_t k_trueBits = k_quietNan | 3u;
+
+    constexpr explicit Value(uint64_t _bits) noexcept : bits(_bits) {}
+
+    uint64_t bits;
+};
+
+static_assert(sizeof(Value) == 8u, "NaN-boxed values are one word");
+
+#else
+
+// Everything a Lox expression can evaluate to, as a tag and a payload. Cheap to copy: strings
+// are just a pointer into whichever StringHeap made them.
+class Value
+{
+public:
+    constexpr Value() noexcept : type(ValueType::Nil), number(0.0) {}
+
+    static constexpr Value Nil() noexcept { return Value(); }
+    static constexpr Value Bool(bool value) noexcept { Value result; result.type = ValueType::Bool; result.boolean = value; return result; }
+    static constexpr Value Number(double value) noexcept { Value result; result.type = ValueType::Number; result.number = value; return result; }
+    static constexpr Value String(const LoxString* value) noexcept { Value result; result.type = ValueType::String; result.string = value; return result; }
+
+    constexpr ValueType Type() const noexcept { return type; }
+    constexpr bool IsNil() const noexcept { return type == ValueType::Nil; }
+    constexpr bool IsBool() const noexcept { return type == ValueType::Bool; }
+    constexpr bool IsNumber() const noexcept { return type == ValueType::Number; }
+    constexpr bool IsString() const noexcept { return type == ValueType::String; }
+
+    // only valid for a value of that type
+    constexpr bool AsBool() const noexcept { return boolean; }
+    constexpr double AsNumber() const noexcept { return number; }
+    constexpr const LoxString* AsString() const noexcept { return string; }
+
+    // nil and false are falsey, everything else is truthy
+    constexpr bool IsFalsey() const noexcept { return type == ValueType::Nil || (type == ValueType::Bool && !boolean); }
+
+private:
+    ValueType type;
+    union
+    {
+        bool boolean;
+        double number;
+        const LoxString* string;
+    };
+};
+
+#endif
+
+// Lox equality: never true across types, numbers compare as doubles (so NaN != NaN) and
+// strings by their text
+bool ValuesEqual(const Value& lhs, const Value& rhs) noexcept;
+// how print shows it
+void AppendValue(std::string& out, const Value& value);
+
+#endif //!LOX_VALUE_HPP
@@ -0,0 +1,180 @@
+#include "Chunk.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+
+const char* OpCodeName(OpCode op) noexcept
+{
+    constexpr std::array<const char*, static_cast<size_t>(OpCode::Count)> k_names
+    {
+        "Constant",
+        "ConstantLong",
+        "Nil",
+        "True",
+        "False",
+        "Pop",
+        "PopN",
+        "GetLocal",
+        "SetLocal",
+        "GetGlobal",
+        "DefineGlobal",
+        "SetGlobal",
+        "Equal",
+        "NotEqual",
+        "Greater",
+        "GreaterEqual",
+        "Less",
+        "LessEqual",
+        "Add",
+        "Subtract",
+        "Multiply",
+        "Divide",
+        "Not",
+        "Negate",
+        "Print",
+        "Jump",
+        "JumpIfFalse",
+        "Loop",
+        "Return",
+        "SetLocalPop",
+        "SetGlobalPop",
+        "PopJumpIfFalse",
+        "JumpIfNotLess",
+        "AddLocalConstant",
+    };
+
+    const size_t idx = static_cast<size_t>(op);
+    return idx < k_names.size() ? k_names[idx] : "Unknown";
+}
+
+void Chunk::Write(uint8_t byte, uint32_t line)
+{
+    if (lines.empty() || lines.back().line != line)
+    {
+        lines.emplace_back(LineStart{ static_cast<uint32_t>(code.size()), line });
+    }
+    code.emplace_back(byte);
+}
+
+void Chunk::ClearCode() noexcept
+{
+    code.clear();
+    lines.clear();
+}
+
+size_t Chunk::AddConstant(const Value& value)
+{
+    constants.emplace_back(value);
+    return constants.size() - 1u;
+}
+
+size_t Chunk::AddGlobal(SymbolId name)
+{
+    globals.emplace_back(name);
+    return globals.size() - 1u;
+}
+
+uint32_t Chunk::GetLine(size_t offset) const noexcept
+{
+    // last run starting at or before offset
+    auto iter = std::upper_bound(lines.begin(), lines.end(), offset,
+        [](const size_t value, const LineStart& run) { return value < run.offset; });
+    return iter == lines.begin() ? 0u : std::prev(iter)->line;
+}
+
+size_t Chunk::MemoryUsage() const noexcept
+{
+    return code.capacity() + constants.capacity() * sizeof(Value) + lines.capacity() * sizeof(LineStart) +
+           globals.capacity() * sizeof(SymbolId) + strings.MemoryUsage();
+}
+
+std::string DisassembleChunk(const Chunk& chunk, std::string_view name)
+{
+    std::string result = "== ";
+    result += name;
+    result += " ==\n";
+
+    const std::span<const uint8_t> code = chunk.Code();
+    size_t offset = 0u;
+    while (offset < code.size())
+    {
+        const OpCode op = static_cast<OpCode>(code[offset]);
+        const size_t operandBytes = OperandBytes(op);
+        if (offset + operandBytes >= code.size() && operandBytes != 0u)
+        {
+            result += "truncated instruction\n";
+            break;
+        }
+
+        uint32_t operand = 0u;
+        for (size_t i = 0; i < operandBytes; ++i)
+        {
+            operand |= static_cast<uint32_t>(code[offset + 1u + i]) << (8u * i);
+        }
+
+        char buffer[96];
+        std::snprintf(buffer, sizeof(buffer), "%04zu %4u %-16s", offset, chunk.GetLine(offset), OpCodeName(op));
+        result += buffer;
+
+        switch (op)
+        {
+        case OpCode::Constant:
+        case OpCode::ConstantLong:
+            std::snprintf(buffer, sizeof(buffer), " %4u '", operand);
+            result += buffer;
+            if (operand < chunk.Constants().size())
+            {
+                AppendValue(result, chunk.Constants()[operand]);
+            }
+            result += "'";
+            break;
+        case OpCode::GetGlobal:
+        case OpCode::DefineGlobal:
+        case OpCode::SetGlobal:
+        case OpCode::SetGlobalPop:
+            std::snprintf(buffer, sizeof(buffer), " %4u '", operand);
+            result += buffer;
+            if (operand < chunk.Globals().size())
+            {
+                result += SymbolTable::GetSymbolTableInstance().GetName(chunk.Globals()[operand]);
+            }
+            result += "'";
+            break;
+        case OpCode::Jump:
+        case OpCode::JumpIfFalse:
+        case OpCode::PopJumpIfFalse:
+        case OpCode::JumpIfNotLess:
+            std::snprintf(buffer, sizeof(buffer), " %4zu -> %zu", offset, offset + 1u + operandBytes + operand);
+            result += buffer;
+            break;
+        case OpCode::Loop:
+            std::snprintf(buffer, sizeof(buffer), " %4zu -> %zu", offset, offset + 1u + operandBytes - operand);
+            result += buffer;
+            break;
+        case OpCode::AddLocalConstant:
+        {
+            const uint32_t constantIdx = operand >> 8u;
+            std::snprintf(buffer, sizeof(buffer), " %4u %4u '", operand & 0xFFu, constantIdx);
+            result += buffer;
+            if (constantIdx < chunk.Constants().size())
+            {
+                AppendValue(result, chunk.Constants()[constantIdx]);
+            }
+            result += "'";
+            break;
+        }
+        default:
+            if (operandBytes != 0u)
+            {
+                std::snprintf(buffer, sizeof(buffer), " %4u", operand);
+                result += buffer;
+            }
+            break;
+        }
+
+        result += "\n";
+        offset += 1u + operandBytes;
+    }
+
+    return result;
+}
@@ -0,0 +1,445 @@
+#include "Compiler.hpp"
+#include <algorithm>
+#include <bit>
+#include <limits>
+
+namespace
+{
+    // how many values each instruction leaves on the stack, minus how many it takes. PopN's
+    // depends on its operand, so emitPops handles that one
+    constexpr ptrdiff_t StackEffect(const OpCode op) noexcept
+    {
+        switch (op)
+        {
+        case OpCode::Constant:
+        case OpCode::ConstantLong:
+        case OpCode::Nil:
+        case OpCode::True:
+        case OpCode::False:
+        case OpCode::GetLocal:
+        case OpCode::GetGlobal:
+            return 1;
+        case OpCode::Pop:
+        case OpCode::DefineGlobal:
+        case OpCode::Equal:
+        case OpCode::NotEqual:
+        case OpCode::Greater:
+        case OpCode::GreaterEqual:
+        case OpCode::Less:
+        case OpCode::LessEqual:
+        case OpCode::Add:
+        case OpCode::Subtract:
+        case OpCode::Multiply:
+        case OpCode::Divide:
+        case OpCode::Print:
+            return -1;
+        default:
+            return 0;
+        }
+    }
+
+    OpCode BinaryOpCode(const TokenType op) noexcept
+    {
+        switch (op)
+        {
+        case TokenType::EqualEqual: return OpCode::Equal;
+        case TokenType::LogicalNotEqual: return OpCode::NotEqual;
+        case TokenType::Greater: return OpCode::Greater;
+        case TokenType::GreaterEqual: return OpCode::GreaterEqual;
+        case TokenType::Less: return OpCode::Less;
+        case TokenType::LessEqual: return OpCode::LessEqual;
+        case TokenType::Plus: return OpCode::Add;
+        case TokenType::Minus: return OpCode::Subtract;
+        case TokenType::Star: return OpCode::Multiply;
+        default: return OpCode::Divide;
+        }
+    }
+}
+
+Compiler::Compiler(const Program& _program) noexcept : program(_program) {}
+
+Chunk Compiler::Compile(DiagnosticBuffer& _diagnostics)
+{
+    Chunk result;
+    chunk = &result;
+    diagnostics = &_diagnostics;
+    hadError = false;
+    localCount = 0u;
+    scopeDepth = 0u;
+    stackDepth = 0u;
+    maxStackDepth = 0u;
+    globalSlots.clear();
+    numberConstants.clear();
+    stringConstants.clear();
+
+    uint32_t lastLine = 0u;
+    for (const StatementIndex idx : program.TopLevel())
+    {
+        statement(idx);
+        lastLine = program[idx].line;
+    }
+    emit(OpCode::Return, lastLine);
+
+    result.SetMaxStackDepth(maxStackDepth);
+    chunk = nullptr;
+    diagnostics = nullptr;
+    return result;
+}
+
+void Compiler::statement(StatementIndex idx)
+{
+    const StatementNode& node = program[idx];
+    VisitStatement(program, idx, Overloaded{
+        [this, &node](const ExpressionStatement& statement)
+        {
+            expression(statement.expression);
+            emit(OpCode::Pop, node.line);
+        },
+        [this, &node](const PrintStatement& statement)
+        {
+            expression(statement.expression);
+            emit(OpCode::Print, node.line);
+        },
+        [this, &node](const VarStatement& var) { varDeclaration(var, node.line, node.column); },
+        [this, &node](const BlockStatement& body) { block(body, node.line); },
+        [this, &node](const WhileStatement& loop) { whileStatement(loop, node.line); } });
+}
+
+void Compiler::varDeclaration(const VarStatement& var, uint32_t line, uint32_t column)
+{
+    if (scopeDepth == 0u)
+    {
+        const uint16_t slot = globalSlot(var.name, line, column);
+        if (var.initializer != k_invalidExpressionIndex)
+        {
+            expression(var.initializer);
+        }
+        else
+        {
+            emit(OpCode::Nil, line);
+        }
+        emit(OpCode::DefineGlobal, line);
+        emitByte(static_cast<uint8_t>(slot), line);
+        emitByte(static_cast<uint8_t>(slot >> 8u), line);
+        return;
+    }
+
+    // Locals live where their initializer left its value on the stack, so declaring one emits
+    // nothing beyond the initializer
+    for (size_t i = localCount; i > 0u && locals[i - 1u].depth >= scopeDepth; --i)
+    {
+        if (locals[i - 1u].name == var.name && locals[i - 1u].depth == scopeDepth)
+        {
+            error(LoxCompilerErrorCode::VariableAlreadyDeclared, line, column, var.name);
+            break;
+        }
+    }
+    if (localCount == k_maxLocals)
+    {
+        error(LoxCompilerErrorCode::TooManyLocals, line, column, var.name);
+        return;
+    }
+
+    const size_t localIdx = localCount++;
+    locals[localIdx] = Local{ var.name, k_uninitializedDepth };
+    if (var.initializer != k_invalidExpressionIndex)
+    {
+        expression(var.initializer);
+    }
+    else
+    {
+        emit(OpCode::Nil, line);
+    }
+    locals[localIdx].depth = scopeDepth;
+}
+
+void Compiler::block(const BlockStatement& body, uint32_t line)
+{
+    ++scopeDepth;
+    for (const StatementIndex idx : program.BlockBody(body))
+    {
+        statement(idx);
+    }
+    --scopeDepth;
+
+    size_t numLocals = 0u;
+    while (localCount > 0u && locals[localCount - 1u].depth > scopeDepth)
+    {
+        --localCount;
+        ++numLocals;
+    }
+    emitPops(numLocals, line);
+}
+
+void Compiler::whileStatement(const WhileStatement& loop, uint32_t line)
+{
+    const size_t loopStart = chunk->Code().size();
+    expression(loop.condition);
+    const size_t exitJump = emitJump(OpCode::JumpIfFalse, line);
+    emit(OpCode::Pop, line);
+    statement(loop.body);
+    emitLoop(loopStart, line);
+
+    patchJump(exitJump, line, 0u);
+    // the exit comes straight from the jump, so the condition's still on the stack here
+    adjustStack(1);
+    emit(OpCode::Pop, line);
+}
+
+void Compiler::expression(ExpressionIndex idx)
+{
+    const ExpressionTree& tree = program.Expressions();
+    const ExpressionNode& node = tree[idx];
+    VisitExpression(tree, idx, Overloaded{
+        [this, &node](const NumericLiteralExpression& literal)
+        {
+            emitConstant(numberConstant(literal.Value(), node.line, node.column), node.line);
+        },
+        [this, &node, &tree](const StringLiteralExpression& literal)
+        {
+            emitConstant(stringConstant(tree.StringText(literal), node.line, node.column), node.line);
+        },
+        [this, &node](const IdentifierExpression& identifier) { variable(identifier.identifier, node.line, node.column); },
+        [this, &node](const LanguageLiteralExpression& literal)
+        {
+            emit(literal.literal == TokenType::True ? OpCode::True : (literal.literal == TokenType::False ? OpCode::False : OpCode::Nil), node.line);
+        },
+        [this, &node](const UnaryExpression& unary)
+        {
+            expression(unary.operand);
+            emit(unary.op == TokenType::Minus ? OpCode::Negate : OpCode::Not, node.line);
+        },
+        [this, &node](const BinaryExpression& binaryExpression) { binary(binaryExpression, node.line); },
+        [this](const GroupingExpression& grouping) { expression(grouping.inner); },
+        [this, &node](const AssignExpression& assignment) { assign(assignment, node.line, node.column); } });
+}
+
+void Compiler::variable(SymbolId name, uint32_t line, uint32_t column)
+{
+    const int localSlot = resolveLocal(name, line, column);
+    if (localSlot >= 0)
+    {
+        emit(OpCode::GetLocal, line);
+        emitByte(static_cast<uint8_t>(localSlot), line);
+        return;
+    }
+
+    const uint16_t slot = globalSlot(name, line, column);
+    emit(OpCode::GetGlobal, line);
+    emitByte(static_cast<uint8_t>(slot), line);
+    emitByte(static_cast<uint8_t>(slot >> 8u), line);
+}
+
+void Compiler::assign(const AssignExpression& assignment, uint32_t line, uint32_t column)
+{
+    // the parser only makes assignments to identifiers
+    const SymbolId name = std::get<IdentifierExpression>(program.Expressions()[assignment.target].expression).identifier;
+    expression(assignment.value);
+
+    const int localSlot = resolveLocal(name, line, column);
+    if (localSlot >= 0)
+    {
+        emit(OpCode::SetLocal, line);
+        emitByte(static_cast<uint8_t>(localSlot), line);
+        return;
+    }
+
+    const uint16_t slot = globalSlot(name, line, column);
+    emit(OpCode::SetGlobal, line);
+    emitByte(static_cast<uint8_t>(slot), line);
+    emitByte(static_cast<uint8_t>(slot >> 8u), line);
+}
+
+void Compiler::binary(const BinaryExpression& binaryExpression, uint32_t line)
+{
+    if (binaryExpression.op == TokenType::And || binaryExpression.op == TokenType::Or)
+    {
+        logical(binaryExpression, line);
+        return;
+    }
+
+    expression(binaryExpression.lhs);
+    expression(binaryExpression.rhs);
+    emit(BinaryOpCode(binaryExpression.op), line);
+}
+
+void Compiler::logical(const BinaryExpression& binaryExpression, uint32_t line)
+{
+    // Short circuits: the left operand stays as the result if it decides things, otherwise
+    // it's popped and the right operand is the result
+    expression(binaryExpression.lhs);
+    if (binaryExpression.op == TokenType::And)
+    {
+        const size_t endJump = emitJump(OpCode::JumpIfFalse, line);
+        emit(OpCode::Pop, line);
+        expression(binaryExpression.rhs);
+        patchJump(endJump, line, 0u);
+        return;
+    }
+
+    const size_t elseJump = emitJump(OpCode::JumpIfFalse, line);
+    const size_t endJump = emitJump(OpCode::Jump, line);
+    patchJump(elseJump, line, 0u);
+    emit(OpCode::Pop, line);
+    expression(binaryExpression.rhs);
+    patchJump(endJump, line, 0u);
+}
+
+void Compiler::emit(OpCode op, uint32_t line)
+{
+    chunk->Write(op, line);
+    adjustStack(StackEffect(op));
+}
+
+void Compiler::emitByte(uint8_t byte, uint32_t line)
+{
+    chunk->Write(byte, line);
+}
+
+void Compiler::emitConstant(size_t constantIdx, uint32_t line)
+{
+    if (constantIdx <= UINT8_MAX)
+    {
+        emit(OpCode::Constant, line);
+        emitByte(static_cast<uint8_t>(constantIdx), line);
+        return;
+    }
+
+    emit(OpCode::ConstantLong, line);
+    emitByte(static_cast<uint8_t>(constantIdx), line);
+    emitByte(static_cast<uint8_t>(constantIdx >> 8u), line);
+    emitByte(static_cast<uint8_t>(constantIdx >> 16u), line);
+}
+
+size_t Compiler::numberConstant(double value, uint32_t line, uint32_t column)
+{
+    // keyed on the bits, so 0 and -0 stay apart
+    const auto [iter, inserted] = numberConstants.try_emplace(std::bit_cast<uint64_t>(value), 0u);
+    if (inserted)
+    {
+        if (chunk->Constants().size() >= k_maxConstants)
+        {
+            error(LoxCompilerErrorCode::TooManyConstants, line, column);
+            numberConstants.erase(iter);
+            return 0u;
+        }
+        iter->second = static_cast<uint32_t>(chunk->AddConstant(Value::Number(value)));
+    }
+    return iter->second;
+}
+
+size_t Compiler::stringConstant(std::string_view text, uint32_t line, uint32_t column)
+{
+    const auto [iter, inserted] = stringConstants.try_emplace(text, 0u);
+    if (inserted)
+    {
+        if (chunk->Constants().size() >= k_maxConstants)
+        {
+            error(LoxCompilerErrorCode::TooManyConstants, line, column);
+            stringConstants.erase(iter);
+            return 0u;
+        }
+        const LoxString* string = chunk->MakeString(text);
+        iter->second = static_cast<uint32_t>(chunk->AddConstant(Value::String(string)));
+    }
+    return iter->second;
+}
+
+size_t Compiler::emitJump(OpCode op, uint32_t line)
+{
+    emit(op, line);
+    emitByte(0xFFu, line);
+    emitByte(0xFFu, line);
+    return chunk->Code().size() - 2u;
+}
+
+void Compiler::patchJump(size_t operandOffset, uint32_t line, uint32_t column)
+{
+    // relative to the end of the jump instruction
+    const size_t distance = chunk->Code().size() - operandOffset - 2u;
+    if (distance > UINT16_MAX)
+    {
+        error(LoxCompilerErrorCode::JumpTooLarge, line, column);
+        return;
+    }
+
+    chunk->Patch(operandOffset, static_cast<uint8_t>(distance));
+    chunk->Patch(operandOffset + 1u, static_cast<uint8_t>(distance >> 8u));
+}
+
+void Compiler::emitLoop(size_t loopStart, uint32_t line)
+{
+    emit(OpCode::Loop, line);
+    // back from the end of this instruction, so counting its operand too
+    const size_t distance = chunk->Code().size() + 2u - loopStart;
+    if (distance > UINT16_MAX)
+    {
+        error(LoxCompilerErrorCode::JumpTooLarge, line, 0u);
+    }
+    emitByte(static_cast<uint8_t>(distance), line);
+    emitByte(static_cast<uint8_t>(distance >> 8u), line);
+}
+
+void Compiler::emitPops(size_t count, uint32_t line)
+{
+    while (count > 0u)
+    {
+        if (count == 1u)
+        {
+            emit(OpCode::Pop, line);
+            return;
+        }
+
+        const size_t batch = std::min<size_t>(count, UINT8_MAX);
+        emit(OpCode::PopN, line);
+        emitByte(static_cast<uint8_t>(batch), line);
+        adjustStack(-static_cast<ptrdiff_t>(batch));
+        count -= batch;
+    }
+}
+
+int Compiler::resolveLocal(SymbolId name, uint32_t line, uint32_t column)
+{
+    for (size_t i = localCount; i > 0u; --i)
+    {
+        const Local& local = locals[i - 1u];
+        if (local.name == name)
+        {
+            if (local.depth == k_uninitializedDepth)
+            {
+                error(LoxCompilerErrorCode::LocalInOwnInitializer, line, column, name);
+            }
+            return static_cast<int>(i - 1u);
+        }
+    }
+    return -1;
+}
+
+uint16_t Compiler::globalSlot(SymbolId name, uint32_t line, uint32_t column)
+{
+    // globals can be used before they're declared, the VM checks they were defined by then
+    const auto [iter, inserted] = globalSlots.try_emplace(name, static_cast<uint16_t>(0u));
+    if (inserted)
+    {
+        if (chunk->Globals().size() >= k_maxGlobals)
+        {
+            error(LoxCompilerErrorCode::TooManyGlobals, line, column, name);
+            globalSlots.erase(iter);
+            return 0u;
+        }
+        iter->second = static_cast<uint16_t>(chunk->AddGlobal(name));
+    }
+    return iter->second;
+}
+
+void Compiler::adjustStack(ptrdiff_t delta) noexcept
+{
+    stackDepth = static_cast<size_t>(static_cast<ptrdiff_t>(stackDepth) + delta);
+    maxStackDepth = std::max(maxStackDepth, stackDepth);
+}
+
+void Compiler::error(LoxCompilerErrorCode errorCode, uint32_t line, uint32_t column, SymbolId name) noexcept
+{
+    hadError = true;
+    diagnostics->Report(errorCode, line, column, SymbolTable::GetSymbolTableInstance().GetName(name));
+}
@@ -0,0 +1,288 @@
+#include "ConstantFolding.hpp"
+#include <cmath>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // What a node is sure to give if it gives anything at all. A node that would give anything
+    // else is a runtime error instead, so an Add that gets this far only ever added numbers
+    enum class StaticType : uint8_t
+    {
+        Unknown,
+        Number,
+        Bool,
+        String,
+    };
+
+    const NumericLiteralExpression* AsNumber(const ExpressionNode& node) noexcept
+    {
+        return std::get_if<NumericLiteralExpression>(&node.expression);
+    }
+
+    bool IsLiteral(const ExpressionNode& node) noexcept
+    {
+        return std::holds_alternative<NumericLiteralExpression>(node.expression) ||
+               std::holds_alternative<StringLiteralExpression>(node.expression) ||
+               std::holds_alternative<LanguageLiteralExpression>(node.expression);
+    }
+
+    // nil and false, same as the VM
+    bool IsFalseyLiteral(const ExpressionNode& node) noexcept
+    {
+        const LanguageLiteralExpression* literal = std::get_if<LanguageLiteralExpression>(&node.expression);
+        return literal != nullptr && literal->literal != TokenType::True;
+    }
+
+    bool IsNumberLiteral(const ExpressionNode& node, const double value) noexcept
+    {
+        const NumericLiteralExpression* number = AsNumber(node);
+        return number != nullptr && number->Value() == value && std::signbit(number->Value()) == std::signbit(value);
+    }
+
+    ExpressionVariant MakeBool(const bool value) noexcept
+    {
+        return LanguageLiteralExpression{ value ? TokenType::True : TokenType::False };
+    }
+
+    // ValuesEqual on two literals
+    bool LiteralsEqual(const ExpressionTree& tree, const ExpressionNode& lhs, const ExpressionNode& rhs) noexcept
+    {
+        if (lhs.expression.index() != rhs.expression.index())
+        {
+            return false;
+        }
+        if (const NumericLiteralExpression* number = AsNumber(lhs))
+        {
+            return number->Value() == AsNumber(rhs)->Value();
+        }
+        if (const StringLiteralExpression* string = std::get_if<StringLiteralExpression>(&lhs.expression))
+        {
+            return tree.StringText(*string) == tree.StringText(std::get<StringLiteralExpression>(rhs.expression));
+        }
+        return std::get<LanguageLiteralExpression>(lhs.expression).literal == std::get<LanguageLiteralExpression>(rhs.expression).literal;
+    }
+
+    // Both sides are literals. Nothing if the VM would raise an error instead, so it still does
+    // Concatenations get their text added to tree
+    std::optional<ExpressionVariant> FoldBinary(ExpressionTree& tree, const ExpressionNode& lhs, const TokenType op, const ExpressionNode& rhs)
+    {
+        if (op == TokenType::EqualEqual || op == TokenType::LogicalNotEqual)
+        {
+            return MakeBool(LiteralsEqual(tree, lhs, rhs) == (op == TokenType::EqualEqual));
+        }
+
+        const NumericLiteralExpression* lhsNumber = AsNumber(lhs);
+        const NumericLiteralExpression* rhsNumber = AsNumber(rhs);
+        if (lhsNumber != nullptr && rhsNumber != nullptr)
+        {
+            const double a = lhsNumber->Value();
+            const double b = rhsNumber->Value();
+            switch (op)
+            {
+            case TokenType::Plus: return NumericLiteralExpression(a + b);
+            case TokenType::Minus: return NumericLiteralExpression(a - b);
+            case TokenType::Star: return NumericLiteralExpression(a * b);
+            case TokenType::Slash: return NumericLiteralExpression(a / b);
+            case TokenType::Greater: return MakeBool(a > b);
+            case TokenType::GreaterEqual: return MakeBool(a >= b);
+            case TokenType::Less: return MakeBool(a < b);
+            case TokenType::LessEqual: return MakeBool(a <= b);
+            default: return std::nullopt;
+            }
+        }
+
+        const StringLiteralExpression* lhsString = std::get_if<StringLiteralExpression>(&lhs.expression);
+        const StringLiteralExpression* rhsString = std::get_if<StringLiteralExpression>(&rhs.expression);
+        if (op == TokenType::Plus && lhsString != nullptr && rhsString != nullptr)
+        {
+            // built up on the side, adding to the tree can move the text of both halves
+            std::string text(tree.StringText(*lhsString));
+            text += tree.StringText(*rhsString);
+            return tree.AddString(text);
+        }
+        return std::nullopt;
+    }
+
+    StaticType TypeOf(const ExpressionNode& node, const std::vector<StaticType>& types) noexcept
+    {
+        return std::visit(Overloaded{
+            [](const NumericLiteralExpression&) { return StaticType::Number; },
+            [](const StringLiteralExpression&) { return StaticType::String; },
+            [](const LanguageLiteralExpression& literal) { return literal.literal == TokenType::Nil ? StaticType::Unknown : StaticType::Bool; },
+            [](const UnaryExpression& unary) { return unary.op == TokenType::Minus ? StaticType::Number : StaticType::Bool; },
+            [&types](const BinaryExpression& binary)
+            {
+                switch (binary.op)
+                {
+                case TokenType::Minus:
+                case TokenType::Star:
+                case TokenType::Slash:
+                    return StaticType::Number;
+                // and/or give one side or the other, + adds numbers or concatenates strings
+                case TokenType::Plus:
+                case TokenType::And:
+                case TokenType::Or:
+                    return types[binary.lhs] == types[binary.rhs] ? types[binary.lhs] : StaticType::Unknown;
+                default:
+                    return StaticType::Bool;
+                }
+            },
+            [&types](const GroupingExpression& grouping) { return types[grouping.inner]; },
+            [&types](const AssignExpression& assignment) { return types[assignment.value]; },
+            [](const IdentifierExpression&) { return StaticType::Unknown; } }, node.expression);
+    }
+
+    size_t SubtreeSize(const ExpressionNode& node, const std::vector<size_t>& sizes) noexcept
+    {
+        return 1u + std::visit(Overloaded{
+            [&sizes](const UnaryExpression& unary) { return sizes[unary.operand]; },
+            [&sizes](const BinaryExpression& binary) { return sizes[binary.lhs] + sizes[binary.rhs]; },
+            [&sizes](const GroupingExpression& grouping) { return sizes[grouping.inner]; },
+            [&sizes](const AssignExpression& assignment) { return sizes[assignment.target] + sizes[assignment.value]; },
+            [](const auto&) { return size_t{ 0u }; } }, node.expression);
+    }
+
+    size_t ReachableNodes(const std::vector<size_t>& sizes, std::span<const ExpressionIndex> roots) noexcept
+    {
+        size_t total = 0u;
+        for (const ExpressionIndex root : roots)
+        {
+            total += root == k_invalidExpressionIndex ? 0u : sizes[root];
+        }
+        return total;
+    }
+}
+
+FoldStats FoldConstants(ExpressionTree& tree, std::span<const ExpressionIndex> roots)
+{
+    FoldStats stats;
+    std::vector<size_t> sizes(tree.Size(), 0u);
+    std::vector<StaticType> types(tree.Size(), StaticType::Unknown);
+    for (ExpressionIndex idx = 0u; idx < tree.Size(); ++idx)
+    {
+        sizes[idx] = SubtreeSize(tree[idx], sizes);
+    }
+    stats.nodesBefore = ReachableNodes(sizes, roots);
+
+    for (ExpressionIndex idx = 0u; idx < tree.Size(); ++idx)
+    {
+        const ExpressionNode node = tree[idx];
+        std::optional<ExpressionVariant> folded;
+        // the operand this node boils down to, which takes its place location and all
+        ExpressionIndex replacement = k_invalidExpressionIndex;
+
+        if (const GroupingExpression* grouping = std::get_if<GroupingExpression>(&node.expression))
+        {
+            replacement = grouping->inner;
+            ++stats.groupingsRemoved;
+        }
+        else if (const UnaryExpression* unary = std::get_if<UnaryExpression>(&node.expression))
+        {
+            const ExpressionNode& operand = tree[unary->operand];
+            const UnaryExpression* inner = std::get_if<UnaryExpression>(&operand.expression);
+            if (unary->op == TokenType::Minus && AsNumber(operand) != nullptr)
+            {
+                folded = NumericLiteralExpression(-AsNumber(operand)->Value());
+            }
+            else if (unary->op == TokenType::LogicalNot && IsLiteral(operand))
+            {
+                folded = MakeBool(IsFalseyLiteral(operand));
+            }
+            // !!b is b when b is already a bool, and - -x is x when x is a number, NaNs and -0 included
+            else if (inner != nullptr && inner->op == unary->op &&
+                     types[inner->operand] == (unary->op == TokenType::Minus ? StaticType::Number : StaticType::Bool))
+            {
+                replacement = inner->operand;
+            }
+        }
+        else if (const BinaryExpression* binary = std::get_if<BinaryExpression>(&node.expression))
+        {
+            const ExpressionNode& lhs = tree[binary->lhs];
+            const ExpressionNode& rhs = tree[binary->rhs];
+            const bool lhsNumber = types[binary->lhs] == StaticType::Number;
+            const bool rhsNumber = types[binary->rhs] == StaticType::Number;
+            if (binary->op == TokenType::And || binary->op == TokenType::Or)
+            {
+                // a literal on the left decides which side the expression gives, and the right
+                // side only runs when it's the one given
+                if (IsLiteral(lhs))
+                {
+                    replacement = IsFalseyLiteral(lhs) == (binary->op == TokenType::And) ? binary->lhs : binary->rhs;
+                }
+            }
+            else if (IsLiteral(lhs) && IsLiteral(rhs))
+            {
+                folded = FoldBinary(tree, lhs, binary->op, rhs);
+            }
+            // Identities that hold for every double. x + 0 isn't one, -0 + 0 is 0, but x + -0 is.
+            // The literal side can go, but not the operator's type check on the other
+            else if (binary->op == TokenType::Star && lhsNumber && IsNumberLiteral(rhs, 1.0))
+            {
+                replacement = binary->lhs;
+            }
+            else if (binary->op == TokenType::Star && rhsNumber && IsNumberLiteral(lhs, 1.0))
+            {
+                replacement = binary->rhs;
+            }
+            else if ((binary->op == TokenType::Slash && lhsNumber && IsNumberLiteral(rhs, 1.0)) ||
+                     (binary->op == TokenType::Minus && lhsNumber && IsNumberLiteral(rhs, 0.0)) ||
+                     (binary->op == TokenType::Plus && lhsNumber && IsNumberLiteral(rhs, -0.0)))
+            {
+                replacement = binary->lhs;
+            }
+            else if (binary->op == TokenType::Plus && rhsNumber && IsNumberLiteral(lhs, -0.0))
+            {
+                replacement = binary->rhs;
+            }
+        }
+
+        if (folded.has_value())
+        {
+            tree.Replace(idx, ExpressionNode{ *folded, node.line, node.column });
+            ++stats.folded;
+        }
+        else if (replacement != k_invalidExpressionIndex)
+        {
+            tree.Replace(idx, tree[replacement]);
+            stats.simplified += std::holds_alternative<GroupingExpression>(node.expression) ? 0u : 1u;
+        }
+        sizes[idx] = SubtreeSize(tree[idx], sizes);
+        types[idx] = TypeOf(tree[idx], types);
+    }
+
+    stats.nodesAfter = ReachableNodes(sizes, roots);
+    return stats;
+}
+
+FoldStats FoldConstants(ExpressionTree& tree)
+{
+    const ExpressionIndex root = tree.Root();
+    return FoldConstants(tree, std::span<const ExpressionIndex>(&root, 1u));
+}
+
+FoldStats FoldConstants(Program& program)
+{
+    std::vector<ExpressionIndex> roots;
+    roots.reserve(program.Size());
+    for (StatementIndex idx = 0u; idx < program.Size(); ++idx)
+    {
+        VisitStatement(program, idx, Overloaded{
+            [&roots](const ExpressionStatement& statement) { roots.emplace_back(statement.expression); },
+            [&roots](const PrintStatement& statement) { roots.emplace_back(statement.expression); },
+            [&roots](const VarStatement& statement) { roots.emplace_back(statement.initializer); },
+            [&roots](const WhileStatement& statement) { roots.emplace_back(statement.condition); },
+            [](const BlockStatement&) {} });
+    }
+    return FoldConstants(program.Expressions(), roots);
+}
+
+std::string FormatFoldStats(const FoldStats& stats)
+{
+    char buffer[160];
+    std::snprintf(buffer, sizeof(buffer), "%zu -> %zu nodes, %zu eliminated: %zu folded, %zu simplified, %zu groupings removed",
+        stats.nodesBefore, stats.nodesAfter, stats.Eliminated(), stats.folded, stats.simplified, stats.groupingsRemoved);
+    return buffer;
+}
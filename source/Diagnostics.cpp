@@ -0,0 +1,32 @@
+#include "Diagnostics.hpp"
+#include <algorithm>
+
+DiagnosticBuffer::DiagnosticBuffer(size_t _capacity) :
+    storage(std::make_unique<LoxDiagnostic[]>(_capacity)),
+    lexemeStorage(std::make_unique<char[]>(_capacity * k_lexemeBytesPerDiagnostic)), capacity(_capacity) {}
+
+bool DiagnosticBuffer::Report(LoxCompilerErrorCode errorCode, size_t line, size_t offset, std::string_view lexeme) noexcept
+{
+    if (size == capacity)
+    {
+        ++dropped;
+        return false;
+    }
+
+    // copied, since whatever the lexeme points into (a lexer session, usually) can be released
+    // long before anyone reads the diagnostic
+    const size_t lexemeBytes = std::min(lexeme.size(), capacity * k_lexemeBytesPerDiagnostic - lexemeBytesUsed);
+    char* const lexemeCopy = lexemeStorage.get() + lexemeBytesUsed;
+    std::copy_n(lexeme.data(), lexemeBytes, lexemeCopy);
+    lexemeBytesUsed += lexemeBytes;
+
+    storage[size++] = LoxDiagnostic{ errorCode, line, offset, std::string_view(lexemeCopy, lexemeBytes) };
+    return true;
+}
+
+void DiagnosticBuffer::Clear() noexcept
+{
+    size = 0u;
+    dropped = 0u;
+    lexemeBytesUsed = 0u;
+}
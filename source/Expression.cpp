@@ -0,0 +1,113 @@
+#include "Expression.hpp"
+#include "Utility.hpp"
+#include <stdexcept>
+
+namespace
+{
+    ExpressionNode MakeNode(const ExpressionVariant& expression, const SourceLocation loc) noexcept
+    {
+        return ExpressionNode{ expression, static_cast<uint32_t>(loc.line), static_cast<uint32_t>(loc.column) };
+    }
+}
+
+ExpressionIndex ExpressionTree::AddNumericLiteral(double value, SourceLocation loc)
+{
+    return addNode(MakeNode(NumericLiteralExpression(value), loc));
+}
+
+ExpressionIndex ExpressionTree::AddStringLiteral(std::string_view text, SourceLocation loc)
+{
+    return addNode(MakeNode(AddString(text), loc));
+}
+
+ExpressionIndex ExpressionTree::AddIdentifier(SymbolId identifier, SourceLocation loc)
+{
+    return addNode(MakeNode(IdentifierExpression{ identifier }, loc));
+}
+
+ExpressionIndex ExpressionTree::AddLanguageLiteral(TokenType literal, SourceLocation loc)
+{
+    return addNode(MakeNode(LanguageLiteralExpression{ literal }, loc));
+}
+
+ExpressionIndex ExpressionTree::AddUnary(TokenType op, ExpressionIndex operand, SourceLocation loc)
+{
+    return addNode(MakeNode(UnaryExpression{ op, operand }, loc));
+}
+
+ExpressionIndex ExpressionTree::AddBinary(ExpressionIndex lhs, TokenType op, ExpressionIndex rhs, SourceLocation loc)
+{
+    return addNode(MakeNode(BinaryExpression{ lhs, op, rhs }, loc));
+}
+
+ExpressionIndex ExpressionTree::AddGrouping(ExpressionIndex inner, SourceLocation loc)
+{
+    return addNode(MakeNode(GroupingExpression{ inner }, loc));
+}
+
+ExpressionIndex ExpressionTree::AddAssign(ExpressionIndex target, ExpressionIndex value, SourceLocation loc)
+{
+    return addNode(MakeNode(AssignExpression{ target, value }, loc));
+}
+
+SourceLocation ExpressionTree::Location(ExpressionIndex idx) const noexcept
+{
+    return SourceLocation{ nodes[idx].line, nodes[idx].column };
+}
+
+StringLiteralExpression ExpressionTree::AddString(std::string_view text)
+{
+    if (text.size() > std::numeric_limits<uint32_t>::max() - strings.size())
+    {
+        throw std::length_error("Expression tree is out of string space");
+    }
+
+    const StringLiteralExpression result{ static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(text.size()) };
+    strings.append(text);
+    return result;
+}
+
+void ExpressionTree::Clear() noexcept
+{
+    nodes.clear();
+    strings.clear();
+    root = k_invalidExpressionIndex;
+}
+
+ExpressionIndex ExpressionTree::addNode(const ExpressionNode& node)
+{
+    // the invalid index is reserved, so one less than the full range
+    if (nodes.size() >= static_cast<size_t>(k_invalidExpressionIndex))
+    {
+        throw std::length_error("Expression tree is out of node indices");
+    }
+
+    nodes.emplace_back(node);
+    return static_cast<ExpressionIndex>(nodes.size() - 1u);
+}
+
+const char* OperatorLexeme(TokenType type) noexcept
+{
+    switch (type)
+    {
+    case TokenType::Minus: return "-";
+    case TokenType::Plus: return "+";
+    case TokenType::Slash: return "/";
+    case TokenType::Star: return "*";
+    case TokenType::LogicalNot: return "!";
+    case TokenType::LogicalNotEqual: return "!=";
+    case TokenType::EqualEqual: return "==";
+    case TokenType::Greater: return ">";
+    case TokenType::GreaterEqual: return ">=";
+    case TokenType::Less: return "<";
+    case TokenType::LessEqual: return "<=";
+    case TokenType::And: return "and";
+    case TokenType::Or: return "or";
+    default: return TokenTypeToString(type);
+    }
+}
+
+std::string PrintExpression(const ExpressionTree& tree, ExpressionIndex idx)
+{
+    return VisitExpression(tree, idx, PrettyPrinterVisitor{ tree });
+}
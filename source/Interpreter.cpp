@@ -0,0 +1,369 @@
+#include "Interpreter.hpp"
+#include "Compiler.hpp"
+#include "ConstantFolding.hpp"
+#include "Lexer.hpp"
+#include "Parser.hpp"
+#include "Peephole.hpp"
+#include "SymbolTable.hpp"
+#include <algorithm>
+#include <ostream>
+
+namespace
+{
+    constexpr size_t k_outputFlushBytes = 16u * 1024u;
+
+    uint32_t ReadU16(const uint8_t* bytes) noexcept
+    {
+        return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8u);
+    }
+
+    uint32_t ReadU24(const uint8_t* bytes) noexcept
+    {
+        return ReadU16(bytes) | (static_cast<uint32_t>(bytes[2]) << 16u);
+    }
+}
+
+VirtualMachine::VirtualMachine(std::ostream& _output) : output(_output) {}
+
+VirtualMachine::~VirtualMachine() = default;
+
+InterpretResult VirtualMachine::Interpret(std::string source, DiagnosticBuffer& diagnostics)
+{
+    auto& lexer = Lexer::GetLexerInstance();
+    const Lexer::OutputHandle handle = lexer.ParseScript(std::move(source));
+    const size_t lexerErrors = lexer.CollectDiagnostics(handle, diagnostics);
+
+    // the program holds interned ids and nothing that points into the tokens, so the session can go once it's parsed
+    Program program;
+    bool parseFailed = false;
+    {
+        Parser parser(lexer.GetTokenView(handle));
+        program = parser.ParseProgram(diagnostics);
+        parseFailed = parser.HadError();
+    }
+    lexer.ReleaseSession(handle);
+    if (lexerErrors != 0u || parseFailed)
+    {
+        return InterpretResult::CompileError;
+    }
+
+    FoldConstants(program);
+    Compiler compiler(program);
+    Chunk chunk = compiler.Compile(diagnostics);
+    if (compiler.HadError())
+    {
+        return InterpretResult::CompileError;
+    }
+    OptimizeChunk(chunk);
+    return Run(chunk, diagnostics);
+}
+
+InterpretResult VirtualMachine::Run(const Chunk& chunk, DiagnosticBuffer& diagnostics)
+{
+    return run<false>(chunk, diagnostics, nullptr);
+}
+
+InterpretResult VirtualMachine::RunProfiled(const Chunk& chunk, DiagnosticBuffer& diagnostics, OpcodePairProfile& profile)
+{
+    return run<true>(chunk, diagnostics, &profile);
+}
+
+template<bool Profiling>
+InterpretResult VirtualMachine::run(const Chunk& chunk, DiagnosticBuffer& diagnostics, OpcodePairProfile* profile)
+{
+    if (chunk.Code().empty())
+    {
+        return InterpretResult::Ok;
+    }
+
+    if (chunk.MaxStackDepth() > k_maxStackSlots)
+    {
+        return runtimeError(chunk, chunk.Code().data(), LoxCompilerErrorCode::StackOverflow, diagnostics);
+    }
+    if (chunk.MaxStackDepth() > stackCapacity)
+    {
+        stackCapacity = std::max<size_t>(chunk.MaxStackDepth(), 256u);
+        stack = std::make_unique<Value[]>(stackCapacity);
+    }
+
+    globals.assign(chunk.Globals().size(), Value::Nil());
+    globalsDefined.assign(chunk.Globals().size(), 0u);
+
+    const InterpretResult result = execute<Profiling>(chunk, diagnostics, profile);
+    flushOutput();
+    return result;
+}
+
+// Both dispatch loops share one set of handlers. LOX_OPCODE starts a handler, as a label or a
+// case, and LOX_DISPATCH ends it by going to the next instruction: straight through the label
+// table with computed goto, or back round to the switch otherwise. When profiling, that's also
+// where the pair of this instruction and the next one gets counted; otherwise it compiles away
+#define LOX_PROFILE_PAIR() if constexpr (Profiling) { profile->Record(static_cast<OpCode>(*instruction), static_cast<OpCode>(*ip)); }
+#if LOX_COMPUTED_GOTO
+#define LOX_OPCODE(name) op_##name:
+#define LOX_DISPATCH() do { LOX_PROFILE_PAIR() instruction = ip; goto *s_dispatchTable[*ip++]; } while (false)
+#else
+#define LOX_OPCODE(name) case OpCode::name:
+#define LOX_DISPATCH() LOX_PROFILE_PAIR() break
+#endif
+
+#define LOX_BINARY_NUMBER_OP(valueType, op)                                                                      \
+    {                                                                                                            \
+        if (!stackTop[-2].IsNumber() || !stackTop[-1].IsNumber())                                                \
+        {                                                                                                        \
+            return runtimeError(chunk, instruction, LoxCompilerErrorCode::OperandsMustBeNumbers, diagnostics);   \
+        }                                                                                                        \
+        const double rhs = (--stackTop)->AsNumber();                                                             \
+        stackTop[-1] = Value::valueType(stackTop[-1].AsNumber() op rhs);                                         \
+    }
+
+template<bool Profiling>
+InterpretResult VirtualMachine::execute(const Chunk& chunk, DiagnosticBuffer& diagnostics, OpcodePairProfile* profile)
+{
+    const uint8_t* ip = chunk.Code().data();
+    // where the current instruction started, for errors
+    const uint8_t* instruction = ip;
+    const Value* const constants = chunk.Constants().data();
+    Value* const stackBase = stack.get();
+    Value* stackTop = stackBase;
+    Value* const globalValues = globals.data();
+    uint8_t* const globalDefined = globalsDefined.data();
+
+#if LOX_COMPUTED_GOTO
+    // In OpCode order. Only the compiler and the peephole pass make chunks, so there's nothing
+    // past OpCode::Count to guard against
+    static const void* const s_dispatchTable[] =
+    {
+        &&op_Constant, &&op_ConstantLong, &&op_Nil, &&op_True, &&op_False, &&op_Pop, &&op_PopN,
+        &&op_GetLocal, &&op_SetLocal, &&op_GetGlobal, &&op_DefineGlobal, &&op_SetGlobal,
+        &&op_Equal, &&op_NotEqual, &&op_Greater, &&op_GreaterEqual, &&op_Less, &&op_LessEqual,
+        &&op_Add, &&op_Subtract, &&op_Multiply, &&op_Divide, &&op_Not, &&op_Negate, &&op_Print,
+        &&op_Jump, &&op_JumpIfFalse, &&op_Loop, &&op_Return,
+        &&op_SetLocalPop, &&op_SetGlobalPop, &&op_PopJumpIfFalse, &&op_JumpIfNotLess, &&op_AddLocalConstant,
+    };
+    static_assert(sizeof(s_dispatchTable) / sizeof(s_dispatchTable[0]) == static_cast<size_t>(OpCode::Count),
+        "Dispatch table is out of sync with OpCode");
+
+    goto *s_dispatchTable[*ip++];
+#else
+    while (true)
+    {
+        instruction = ip;
+        switch (static_cast<OpCode>(*ip++))
+        {
+#endif
+        LOX_OPCODE(Constant)
+            *stackTop++ = constants[*ip++];
+            LOX_DISPATCH();
+        LOX_OPCODE(ConstantLong)
+            *stackTop++ = constants[ReadU24(ip)];
+            ip += 3u;
+            LOX_DISPATCH();
+        LOX_OPCODE(Nil)
+            *stackTop++ = Value::Nil();
+            LOX_DISPATCH();
+        LOX_OPCODE(True)
+            *stackTop++ = Value::Bool(true);
+            LOX_DISPATCH();
+        LOX_OPCODE(False)
+            *stackTop++ = Value::Bool(false);
+            LOX_DISPATCH();
+        LOX_OPCODE(Pop)
+            --stackTop;
+            LOX_DISPATCH();
+        LOX_OPCODE(PopN)
+            stackTop -= *ip++;
+            LOX_DISPATCH();
+        LOX_OPCODE(GetLocal)
+            *stackTop++ = stackBase[*ip++];
+            LOX_DISPATCH();
+        LOX_OPCODE(SetLocal)
+            stackBase[*ip++] = stackTop[-1];
+            LOX_DISPATCH();
+        LOX_OPCODE(GetGlobal)
+        {
+            const uint32_t slot = ReadU16(ip);
+            ip += 2u;
+            if (!globalDefined[slot])
+            {
+                return runtimeError(chunk, instruction, LoxCompilerErrorCode::UndefinedVariable, diagnostics,
+                    SymbolTable::GetSymbolTableInstance().GetName(chunk.Globals()[slot]));
+            }
+            *stackTop++ = globalValues[slot];
+            LOX_DISPATCH();
+        }
+        LOX_OPCODE(DefineGlobal)
+        {
+            const uint32_t slot = ReadU16(ip);
+            ip += 2u;
+            globalValues[slot] = *--stackTop;
+            globalDefined[slot] = 1u;
+            LOX_DISPATCH();
+        }
+        LOX_OPCODE(SetGlobal)
+        {
+            // assigning doesn't declare, the global has to exist already
+            const uint32_t slot = ReadU16(ip);
+            ip += 2u;
+            if (!globalDefined[slot])
+            {
+                return runtimeError(chunk, instruction, LoxCompilerErrorCode::UndefinedVariable, diagnostics,
+                    SymbolTable::GetSymbolTableInstance().GetName(chunk.Globals()[slot]));
+            }
+            globalValues[slot] = stackTop[-1];
+            LOX_DISPATCH();
+        }
+        LOX_OPCODE(Equal)
+            --stackTop;
+            stackTop[-1] = Value::Bool(ValuesEqual(stackTop[-1], stackTop[0]));
+            LOX_DISPATCH();
+        LOX_OPCODE(NotEqual)
+            --stackTop;
+            stackTop[-1] = Value::Bool(!ValuesEqual(stackTop[-1], stackTop[0]));
+            LOX_DISPATCH();
+        LOX_OPCODE(Greater)
+            LOX_BINARY_NUMBER_OP(Bool, >)
+            LOX_DISPATCH();
+        LOX_OPCODE(GreaterEqual)
+            LOX_BINARY_NUMBER_OP(Bool, >=)
+            LOX_DISPATCH();
+        LOX_OPCODE(Less)
+            LOX_BINARY_NUMBER_OP(Bool, <)
+            LOX_DISPATCH();
+        LOX_OPCODE(LessEqual)
+            LOX_BINARY_NUMBER_OP(Bool, <=)
+            LOX_DISPATCH();
+        LOX_OPCODE(Add)
+        {
+            const Value& lhs = stackTop[-2];
+            const Value& rhs = stackTop[-1];
+            if (lhs.IsNumber() && rhs.IsNumber())
+            {
+                stackTop[-2] = Value::Number(lhs.AsNumber() + rhs.AsNumber());
+            }
+            else if (lhs.IsString() && rhs.IsString())
+            {
+                stackTop[-2] = Value::String(strings.Concatenate(lhs.AsString()->View(), rhs.AsString()->View()));
+            }
+            else
+            {
+                return runtimeError(chunk, instruction, LoxCompilerErrorCode::OperandsMustBeNumbersOrStrings, diagnostics);
+            }
+            --stackTop;
+            LOX_DISPATCH();
+        }
+        LOX_OPCODE(Subtract)
+            LOX_BINARY_NUMBER_OP(Number, -)
+            LOX_DISPATCH();
+        LOX_OPCODE(Multiply)
+            LOX_BINARY_NUMBER_OP(Number, *)
+            LOX_DISPATCH();
+        LOX_OPCODE(Divide)
+            LOX_BINARY_NUMBER_OP(Number, /)
+            LOX_DISPATCH();
+        LOX_OPCODE(Not)
+            stackTop[-1] = Value::Bool(stackTop[-1].IsFalsey());
+            LOX_DISPATCH();
+        LOX_OPCODE(Negate)
+            if (!stackTop[-1].IsNumber())
+            {
+                return runtimeError(chunk, instruction, LoxCompilerErrorCode::OperandMustBeNumber, diagnostics);
+            }
+            stackTop[-1] = Value::Number(-stackTop[-1].AsNumber());
+            LOX_DISPATCH();
+        LOX_OPCODE(Print)
+            AppendValue(outputBuffer, *--stackTop);
+            outputBuffer += '\n';
+            if (outputBuffer.size() >= k_outputFlushBytes)
+            {
+                flushOutput();
+            }
+            LOX_DISPATCH();
+        LOX_OPCODE(Jump)
+            ip += 2u + ReadU16(ip);
+            LOX_DISPATCH();
+        LOX_OPCODE(JumpIfFalse)
+            ip += 2u + (stackTop[-1].IsFalsey() ? ReadU16(ip) : 0u);
+            LOX_DISPATCH();
+        LOX_OPCODE(Loop)
+            ip += 2u;
+            ip -= ReadU16(ip - 2u);
+            LOX_DISPATCH();
+        LOX_OPCODE(Return)
+            return InterpretResult::Ok;
+        LOX_OPCODE(SetLocalPop)
+            stackBase[*ip++] = *--stackTop;
+            LOX_DISPATCH();
+        LOX_OPCODE(SetGlobalPop)
+        {
+            const uint32_t slot = ReadU16(ip);
+            ip += 2u;
+            if (!globalDefined[slot])
+            {
+                return runtimeError(chunk, instruction, LoxCompilerErrorCode::UndefinedVariable, diagnostics,
+                    SymbolTable::GetSymbolTableInstance().GetName(chunk.Globals()[slot]));
+            }
+            globalValues[slot] = *--stackTop;
+            LOX_DISPATCH();
+        }
+        LOX_OPCODE(PopJumpIfFalse)
+            ip += 2u + ((--stackTop)->IsFalsey() ? ReadU16(ip) : 0u);
+            LOX_DISPATCH();
+        LOX_OPCODE(JumpIfNotLess)
+            if (!stackTop[-2].IsNumber() || !stackTop[-1].IsNumber())
+            {
+                return runtimeError(chunk, instruction, LoxCompilerErrorCode::OperandsMustBeNumbers, diagnostics);
+            }
+            stackTop -= 2;
+            ip += 2u + (stackTop[0].AsNumber() < stackTop[1].AsNumber() ? 0u : ReadU16(ip));
+            LOX_DISPATCH();
+        LOX_OPCODE(AddLocalConstant)
+        {
+            // same as the Add it came from, down to the error, just without the trip through the stack
+            Value& local = stackBase[ip[0]];
+            const Value& rhs = constants[ip[1]];
+            ip += 2u;
+            if (local.IsNumber() && rhs.IsNumber())
+            {
+                local = Value::Number(local.AsNumber() + rhs.AsNumber());
+            }
+            else if (local.IsString() && rhs.IsString())
+            {
+                local = Value::String(strings.Concatenate(local.AsString()->View(), rhs.AsString()->View()));
+            }
+            else
+            {
+                return runtimeError(chunk, instruction, LoxCompilerErrorCode::OperandsMustBeNumbersOrStrings, diagnostics);
+            }
+            LOX_DISPATCH();
+        }
+#if !LOX_COMPUTED_GOTO
+        default:
+            // the compiler never emits anything else
+            return runtimeError(chunk, instruction, LoxCompilerErrorCode::RuntimeError, diagnostics);
+        }
+    }
+#endif
+}
+
+#undef LOX_BINARY_NUMBER_OP
+#undef LOX_DISPATCH
+#undef LOX_OPCODE
+#undef LOX_PROFILE_PAIR
+
+InterpretResult VirtualMachine::runtimeError(const Chunk& chunk, const uint8_t* instruction, LoxCompilerErrorCode errorCode,
+    DiagnosticBuffer& diagnostics, std::string_view lexeme) noexcept
+{
+    const size_t offset = static_cast<size_t>(instruction - chunk.Code().data());
+    diagnostics.Report(errorCode, chunk.GetLine(offset), 0u, lexeme);
+    return InterpretResult::RuntimeError;
+}
+
+void VirtualMachine::flushOutput()
+{
+    if (!outputBuffer.empty())
+    {
+        output.write(outputBuffer.data(), static_cast<std::streamsize>(outputBuffer.size()));
+        outputBuffer.clear();
+    }
+}
@@ -1,65 +1,126 @@
 #include "Lexer.hpp"
+#include <atomic>
 #include <cstdint>
-#include <unordered_map>
-#include <unordered_set>
+#include <array>
 #include <charconv>
 #include <algorithm>
+#include <exception>
+#include <stdexcept>
 #include <iostream>
-#include "MurmurHash.hpp"
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "Diagnostics.hpp"
+#include "Hash.hpp"
+#include "MappedFile.hpp"
+#include "ScanKernels.hpp"
+#include "SessionStore.hpp"
+#include "SymbolTable.hpp"
 #include "LoxErrors.hpp"
 #include "Token.hpp"
+#include "TokenCache.hpp"
+#include "TokenBuffer.hpp"
 
 namespace
 {
     constexpr size_t k_maxErrorsInScanSession = 16u;
-    static const std::unordered_map<TokenType, size_t> k_keywordLengthMap
-    {
-        { TokenType::And, 3u },
-        { TokenType::Class, 4u },
-        { TokenType::Else, 4u },
-        { TokenType::False, 5u },
-        { TokenType::For, 3u },
-        { TokenType::Fun, 3u },
-        { TokenType::If, 2u },
-        { TokenType::Nil, 3u },
-        { TokenType::Or, 2u },
-        { TokenType::Print, 5u },
-        { TokenType::Return, 6u },
-        { TokenType::Super, 5u },
-        { TokenType::This, 4u },
-        { TokenType::True, 4u },
-        { TokenType::Var, 3u },
-        { TokenType::While, 5u }
+    // smallest slice of source we'll hand to a thread when lexing in parallel
+    constexpr size_t k_minParallelChunkSize = 256u * 1024u;
+    // roughly how much source each block of an edited session covers, see ApplyEdit
+    constexpr size_t k_editBlockSize = 16u * 1024u;
+    // handles with this bit set belong to sessions ApplyEdit made, the rest are content hashes
+    constexpr size_t k_editedSessionBit = size_t{ 1u } << (std::numeric_limits<size_t>::digits - 1);
+    // default bounds on what the lexer keeps around between ParseScript and release
+    constexpr size_t k_defaultMaxSessions = 1024u;
+    constexpr size_t k_defaultMaxSessionBytes = 1024u * 1024u * 1024u;
+    // Every byte of input maps to one of these, so the main scan loop can
+    // dispatch on a single table load instead of probing hash containers
+    enum class CharClass : uint8_t
+    {
+        Unrecognized = 0,
+        Whitespace,
+        SingleChar,
+        DualCharPrefix,
+        Quote,
+        Digit,
+        Alpha
     };
 
-    static const std::unordered_map<char, TokenType> singleCharLexemes
-    {
-        { '(', TokenType::LeftParen },
-        { ')', TokenType::RightParen },
-        { '{', TokenType::LeftBrace },
-        { '}', TokenType::RightBrace },
-        { ',', TokenType::Comma },
-        { '.', TokenType::Dot },
-        { '-', TokenType::Minus },
-        { '+', TokenType::Plus },
-        { ';', TokenType::Semicolon },
-        { '*', TokenType::Star }
+    struct CharClassEntry
+    {
+        CharClass charClass = CharClass::Unrecognized;
+        // only valid for CharClass::SingleChar entries
+        TokenType singleCharType = TokenType::Invalid;
     };
 
-    static const std::unordered_set<char> dualCharPrefixes
+    using CharClassTable = std::array<CharClassEntry, 256u>;
+
+    constexpr CharClassTable BuildCharClassTable() noexcept
     {
-        '!', '=', '<', '>', '/' 
-    };
+        CharClassTable table{};
+
+        auto setSingle = [&table](const char c, const TokenType type)
+        {
+            table[static_cast<uint8_t>(c)] = CharClassEntry{ CharClass::SingleChar, type };
+        };
+
+        setSingle('(', TokenType::LeftParen);
+        setSingle(')', TokenType::RightParen);
+        setSingle('{', TokenType::LeftBrace);
+        setSingle('}', TokenType::RightBrace);
+        setSingle(',', TokenType::Comma);
+        setSingle('.', TokenType::Dot);
+        setSingle('-', TokenType::Minus);
+        setSingle('+', TokenType::Plus);
+        setSingle(';', TokenType::Semicolon);
+        setSingle('*', TokenType::Star);
+
+        for (const char c : { '!', '=', '<', '>', '/' })
+        {
+            table[static_cast<uint8_t>(c)].charClass = CharClass::DualCharPrefix;
+        }
+
+        for (char c = '0'; c <= '9'; ++c)
+        {
+            table[static_cast<uint8_t>(c)].charClass = CharClass::Digit;
+        }
+
+        for (char c = 'a'; c <= 'z'; ++c)
+        {
+            table[static_cast<uint8_t>(c)].charClass = CharClass::Alpha;
+        }
+
+        for (char c = 'A'; c <= 'Z'; ++c)
+        {
+            table[static_cast<uint8_t>(c)].charClass = CharClass::Alpha;
+        }
+
+        table[static_cast<uint8_t>('_')].charClass = CharClass::Alpha;
+        table[static_cast<uint8_t>('"')].charClass = CharClass::Quote;
+        table[static_cast<uint8_t>(' ')].charClass = CharClass::Whitespace;
+
+        return table;
+    }
+
+    constexpr CharClassTable k_charClassTable = BuildCharClassTable();
+
+    constexpr const CharClassEntry& ClassifyChar(const char c) noexcept
+    {
+        return k_charClassTable[static_cast<uint8_t>(c)];
+    }
 
     constexpr size_t k_keywordStrArraySz = static_cast<size_t>(TokenType::KeywordCount);
-    static const std::string k_keywordStrings[k_keywordStrArraySz]
+    // in TokenType order, starting from the first keyword after TokenType::KeywordsBeginRange
+    constexpr std::array<std::string_view, k_keywordStrArraySz> k_keywordStrings
     {
         "and",
         "class",
         "else",
         "false",
-        "for",
         "fun",
+        "for",
         "if",
         "nil",
         "or",
@@ -72,48 +133,83 @@ namespace
         "while"
     };
 
-    static const std::unordered_map<std::string_view, TokenType> k_keywordTokenTypeMap
-    {
-        { k_keywordStrings[0], TokenType::And },
-        { k_keywordStrings[1], TokenType::Class },
-        { k_keywordStrings[2], TokenType::Else },
-        { k_keywordStrings[3], TokenType::False },
-        { k_keywordStrings[4], TokenType::For },
-        { k_keywordStrings[5], TokenType::Fun },
-        { k_keywordStrings[6], TokenType::If },
-        { k_keywordStrings[7], TokenType::Nil },
-        { k_keywordStrings[8], TokenType::Or },
-        { k_keywordStrings[9], TokenType::Print },
-        { k_keywordStrings[10], TokenType::Return },
-        { k_keywordStrings[11], TokenType::Super },
-        { k_keywordStrings[12], TokenType::This },
-        { k_keywordStrings[13], TokenType::True },
-        { k_keywordStrings[14], TokenType::Var },
-        { k_keywordStrings[15], TokenType::While }
-    };
-
-    constexpr bool IsNumericDigit(const char c) noexcept
+    // Switch on length then first character, which is enough to narrow every keyword
+    // down to at most two candidates. Resolves to TokenType::Invalid for anything that
+    // isn't a keyword. No tables to build, so no static init or allocation either.
+    constexpr TokenType MatchKeyword(const std::string_view sv) noexcept
     {
-        return c >= '0' && c <= '9';
-    }
+        auto matchesKeyword = [sv](const TokenType type) noexcept
+        {
+            const size_t keywordIdx = static_cast<size_t>(type) - static_cast<size_t>(TokenType::KeywordsBeginRange) - 1u;
+            return sv == k_keywordStrings[keywordIdx] ? type : TokenType::Invalid;
+        };
 
-    constexpr bool IsAlpha(const char c) noexcept
-    {
-        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c == '_'); 
-    }
+        switch (sv.size())
+        {
+        case 2u:
+            switch (sv[0])
+            {
+            case 'i': return matchesKeyword(TokenType::If);
+            case 'o': return matchesKeyword(TokenType::Or);
+            default: break;
+            }
+            break;
+        case 3u:
+            switch (sv[0])
+            {
+            case 'a': return matchesKeyword(TokenType::And);
+            case 'f': return sv[1] == 'o' ? matchesKeyword(TokenType::For) : matchesKeyword(TokenType::Fun);
+            case 'n': return matchesKeyword(TokenType::Nil);
+            case 'v': return matchesKeyword(TokenType::Var);
+            default: break;
+            }
+            break;
+        case 4u:
+            switch (sv[0])
+            {
+            case 'e': return matchesKeyword(TokenType::Else);
+            case 't': return sv[1] == 'h' ? matchesKeyword(TokenType::This) : matchesKeyword(TokenType::True);
+            default: break;
+            }
+            break;
+        case 5u:
+            switch (sv[0])
+            {
+            case 'c': return matchesKeyword(TokenType::Class);
+            case 'f': return matchesKeyword(TokenType::False);
+            case 'p': return matchesKeyword(TokenType::Print);
+            case 's': return matchesKeyword(TokenType::Super);
+            case 'w': return matchesKeyword(TokenType::While);
+            default: break;
+            }
+            break;
+        case 6u:
+            return sv[0] == 'r' ? matchesKeyword(TokenType::Return) : TokenType::Invalid;
+        default:
+            break;
+        }
 
-    constexpr bool IsAlphaNumeric(const char c) noexcept
-    {
-        return IsAlpha(c) || IsNumericDigit(c);
+        return TokenType::Invalid;
     }
 
-    constexpr bool IsKeywordTokenType(const TokenType type)
+    constexpr bool MatchKeywordCoversAllKeywords() noexcept
     {
-        // TokenType::KeywordsEndRange is itself a valid value, it's "while"
-        return (type > TokenType::KeywordsBeginRange) &&
-               (type <= TokenType::KeywordsEndRange);
+        for (size_t i = 0; i < k_keywordStrings.size(); ++i)
+        {
+            const TokenType expected = static_cast<TokenType>(static_cast<size_t>(TokenType::KeywordsBeginRange) + 1u + i);
+            if (MatchKeyword(k_keywordStrings[i]) != expected)
+            {
+                return false;
+            }
+        }
+        return true;
     }
 
+    static_assert(MatchKeywordCoversAllKeywords(), "MatchKeyword is out of sync with the keyword range of TokenType");
+    static_assert(MatchKeyword("fo") == TokenType::Invalid && MatchKeyword("thus") == TokenType::Invalid &&
+                  MatchKeyword("classy") == TokenType::Invalid && MatchKeyword("") == TokenType::Invalid,
+                  "MatchKeyword should reject near-miss identifiers");
+
     // For error handling, we want to extract the broken str as best as we can. 
     // Can be a little sloppy since this isn't meant to be fast, things are already broken!
     constexpr std::string_view findEndOfBrokenStrLiteral(const std::string_view& sv)
@@ -146,9 +242,25 @@ namespace
         return sv;
     }
 
+    // Points view at the same offset from newBase as it had from oldBase
+    std::string_view rebaseView(const std::string_view view, const char* oldBase, const char* newBase)
+    {
+        if (view.empty())
+        {
+            return view;
+        }
+        return std::string_view(newBase + (view.data() - oldBase), view.size());
+    }
+
+    // content hashes are keys for sessions of the whole script, so keep them clear of edited ones
+    constexpr size_t contentHandle(const uint64_t hash) noexcept
+    {
+        return static_cast<size_t>(hash) & ~k_editedSessionBit;
+    }
+
 }
 
-size_t Lexer::s_allowableErrorCount = k_maxErrorsInScanSession;
+std::atomic<size_t> Lexer::s_allowableErrorCount{ k_maxErrorsInScanSession };
 
 struct LoxScannerErrorInfo
 {
@@ -159,15 +271,269 @@ struct LoxScannerErrorInfo
     std::string_view errorItemStr;
 };
 
+// A run of whole lines out of the session that scanned them. Nothing is copied: the block keeps
+// its owner alive and points into the owner's source and arrays, so lines and line starts are the
+// owner's and get rebased against firstLine and textOffset on the way out
+struct SourceBlock
+{
+    std::shared_ptr<const LoxScanSession> owner;
+    std::string_view text;
+    std::span<const LoxToken> tokens;
+    std::span<const LoxScannerErrorInfo> errors;
+    std::span<const size_t> lineStarts;
+    size_t firstLine = 0u;
+    size_t textOffset = 0u;
+};
+
+// where a block starts in the edited source, counting everything in the blocks before it
+struct BlockPosition
+{
+    size_t byteStart = 0u;
+    size_t lineStart = 0u;
+    size_t tokenStart = 0u;
+    size_t errorStart = 0u;
+};
+
+// Source of a session ApplyEdit made, as the blocks it's made up of. positions has one more entry
+// than blocks, the last one holding the totals
+struct EditedSource
+{
+    std::vector<SourceBlock> blocks;
+    std::vector<BlockPosition> positions{ BlockPosition{} };
+
+    const BlockPosition& totals() const noexcept
+    {
+        return positions.back();
+    }
+
+    // the block pos falls in, or the last one for the end of the source
+    size_t blockContaining(const size_t pos) const noexcept
+    {
+        auto iter = std::upper_bound(positions.begin(), positions.begin() + blocks.size(), pos,
+            [](const size_t bytePos, const BlockPosition& position) { return bytePos < position.byteStart; });
+        return iter == positions.begin() ? 0u : static_cast<size_t>(std::distance(positions.begin(), iter)) - 1u;
+    }
+
+    // finds the block on the fly, the EOF token after the last one is made up
+    LoxToken tokenAt(const size_t idx) const noexcept
+    {
+        if (idx >= totals().tokenStart)
+        {
+            return LoxToken(TokenType::EndOfFile, totals().lineStart, 0);
+        }
+
+        auto iter = std::upper_bound(positions.begin(), positions.begin() + blocks.size(), idx,
+            [](const size_t tokenIdx, const BlockPosition& position) { return tokenIdx < position.tokenStart; });
+        const size_t blockIdx = static_cast<size_t>(std::distance(positions.begin(), iter)) - 1u;
+        const SourceBlock& block = blocks[blockIdx];
+        LoxToken token = block.tokens[idx - positions[blockIdx].tokenStart];
+        token.line = token.line - block.firstLine + positions[blockIdx].lineStart;
+        return token;
+    }
+
+    // recounts positions from firstBlock on, after blocks there have changed
+    void updatePositions(const size_t firstBlock)
+    {
+        positions.resize(blocks.size() + 1u);
+        for (size_t i = firstBlock; i < blocks.size(); ++i)
+        {
+            const SourceBlock& block = blocks[i];
+            const BlockPosition& start = positions[i];
+            positions[i + 1u] = BlockPosition{ start.byteStart + block.text.size(), start.lineStart + block.lineStarts.size(),
+                                               start.tokenStart + block.tokens.size(), start.errorStart + block.errors.size() };
+        }
+    }
+
+    size_t memoryUsage() const noexcept
+    {
+        size_t bytes = blocks.capacity() * sizeof(SourceBlock) + positions.capacity() * sizeof(BlockPosition);
+        for (const SourceBlock& block : blocks)
+        {
+            bytes += block.text.size() + block.tokens.size_bytes() + block.errors.size_bytes() + block.lineStarts.size_bytes();
+        }
+        return bytes;
+    }
+};
+
 struct LoxScanSession
 {
     size_t currentLineNumber = 0;
     size_t offsetInCurrentLine = 0;
     size_t line = 1;
+    // source is either owned as a string, or mapped from a file for ParseFile()
     std::string sourceText;
+    MappedFile sourceFile;
+    // the source's bytes within sourceFile
+    std::string_view mappedSource;
     std::string_view sourceTextView;
     std::vector<LoxToken> tokens;
     std::vector<LoxScannerErrorInfo> errors;
+    // byte offset of every line scanned, relative to lineStartsBase. Lets edits find their lines
+    std::vector<size_t> lineStarts;
+    const char* lineStartsBase = nullptr;
+    // sessions loaded from a token cache file leave tokens and lineStarts empty, and read out of
+    // the cache file's mapping until something needs them laid out for real
+    std::unique_ptr<MappedTokenCache> tokenCache;
+    // sessions ApplyEdit made leave sourceText, tokens, errors and lineStarts empty the same way,
+    // and read out of the blocks they were edited together from
+    std::unique_ptr<EditedSource> editedSource;
+    std::once_flag tokensExpanded;
+    // error limit in effect when the session was made, so changing it mid-scan can't tear a session
+    size_t errorLimit = Lexer::s_allowableErrorCount;
+    // scanning stopped partway because there were more errors than errorLimit. The
+    // tokens end at the line that went over, followed by the usual EOF
+    bool errorLimitReached = false;
+
+    bool tooManyErrors() const noexcept
+    {
+        return errors.size() > errorLimit;
+    }
+
+    // whether scanning again under limit would give the same result. A session that ran to the end
+    // stays good for any limit its errors fit in, one that stopped early only for the same limit
+    bool matchesErrorLimit(size_t limit) const noexcept
+    {
+        return errorLimitReached ? errorLimit == limit : errorCount() <= limit;
+    }
+
+    // rough footprint, for the session store's byte budget
+    size_t memoryUsage() const noexcept
+    {
+        return sourceText.capacity() + sourceFile.Size() +
+               tokens.capacity() * sizeof(LoxToken) +
+               errors.capacity() * sizeof(LoxScannerErrorInfo) +
+               lineStarts.capacity() * sizeof(size_t) +
+               (tokenCache != nullptr ? tokenCache->MemoryUsage() : 0u) +
+               (editedSource != nullptr ? editedSource->memoryUsage() : 0u);
+    }
+
+    // whether tokens and friends still need expandTokens() before they can be used
+    bool tokensDeferred() const noexcept
+    {
+        return tokenCache != nullptr || editedSource != nullptr;
+    }
+
+    // Lays tokens, lineStarts and the rest out for sessions that defer them. Sessions are shared
+    // between threads, so only the first call does anything and the rest wait for it
+    void expandTokens()
+    {
+        if (!tokensDeferred())
+        {
+            return;
+        }
+
+        std::call_once(tokensExpanded, [this]()
+        {
+            if (editedSource != nullptr)
+            {
+                flattenEditedSource();
+                return;
+            }
+
+            tokens.reserve(tokenCache->Size());
+            for (size_t i = 0; i < tokenCache->Size(); ++i)
+            {
+                tokens.emplace_back(tokenCache->Token(i));
+            }
+            lineStarts.reserve(tokenCache->LineCount());
+            for (size_t i = 0; i < tokenCache->LineCount(); ++i)
+            {
+                lineStarts.emplace_back(tokenCache->LineStart(i));
+            }
+        });
+    }
+
+    // copies the blocks out into one source, rebasing everything that pointed into them
+    void flattenEditedSource()
+    {
+        const BlockPosition& totals = editedSource->totals();
+        sourceText.reserve(totals.byteStart);
+        tokens.reserve(totals.tokenStart + 1u);
+        errors.reserve(totals.errorStart);
+        lineStarts.reserve(totals.lineStart);
+
+        for (size_t i = 0; i < editedSource->blocks.size(); ++i)
+        {
+            const SourceBlock& block = editedSource->blocks[i];
+            const BlockPosition& position = editedSource->positions[i];
+            sourceText.append(block.text);
+            const char* const blockData = sourceText.data() + position.byteStart;
+
+            for (const LoxToken& blockToken : block.tokens)
+            {
+                LoxToken& token = tokens.emplace_back(blockToken);
+                token.line = token.line - block.firstLine + position.lineStart;
+                token.strLiteral = rebaseView(token.strLiteral, block.text.data(), blockData);
+            }
+            for (const LoxScannerErrorInfo& blockError : block.errors)
+            {
+                LoxScannerErrorInfo& error = errors.emplace_back(blockError);
+                error.line = error.line - block.firstLine + position.lineStart;
+                error.lineStr = rebaseView(error.lineStr, block.text.data(), blockData);
+                error.errorItemStr = rebaseView(error.errorItemStr, block.text.data(), blockData);
+            }
+            for (const size_t lineStart : block.lineStarts)
+            {
+                lineStarts.emplace_back(lineStart - block.textOffset + position.byteStart);
+            }
+        }
+
+        lineStartsBase = sourceText.data();
+        currentLineNumber = totals.lineStart;
+        finalize();
+    }
+
+    // whole source, wherever it ended up living. Empty for edited sessions until they're expanded
+    std::string_view source() const noexcept
+    {
+        return sourceFile.IsOpen() ? mappedSource : std::string_view(sourceText);
+    }
+
+    size_t sourceSize() const noexcept
+    {
+        return editedSource != nullptr ? editedSource->totals().byteStart : source().size();
+    }
+
+    // whole source as a string, for edited sessions too
+    std::string copySource() const
+    {
+        if (editedSource == nullptr)
+        {
+            return std::string(source());
+        }
+
+        std::string text;
+        text.reserve(sourceSize());
+        for (const SourceBlock& block : editedSource->blocks)
+        {
+            text.append(block.text);
+        }
+        return text;
+    }
+
+    size_t tokenCount() const noexcept
+    {
+        if (editedSource != nullptr)
+        {
+            return editedSource->totals().tokenStart + 1u;
+        }
+        return tokenCache != nullptr ? tokenCache->Size() : tokens.size();
+    }
+
+    // a copy of one token, without expanding the rest
+    LoxToken tokenAt(const size_t idx) const noexcept
+    {
+        if (editedSource != nullptr)
+        {
+            return editedSource->tokenAt(idx);
+        }
+        return tokenCache != nullptr ? tokenCache->Token(idx) : tokens[idx];
+    }
+
+    size_t errorCount() const noexcept
+    {
+        return editedSource != nullptr ? editedSource->totals().errorStart : errors.size();
+    }
     
     // just adds EOF token
     void finalize()
@@ -216,6 +582,8 @@ struct LoxScanSession
         offsetInCurrentLine += 1u;
         currLine.remove_prefix(1u); 
         
+        // no symbol: string text is only ever needed as text, and interning every literal
+        // would grow the process-wide symbol table without bound
         tokens.emplace_back(TokenType::StringLiteral, currentLineNumber, offsetInCurrentLine, literal);
 
         // offset for this is the length of the literal +1 for end quote
@@ -227,7 +595,7 @@ struct LoxScanSession
 
     void addNumLiteralToken(
         std::string_view& currLine,
-        float value,
+        double value,
         size_t literalLen)
     {
         tokens.emplace_back(TokenType::NumberLiteral, currentLineNumber, offsetInCurrentLine, value);
@@ -237,10 +605,10 @@ struct LoxScanSession
 
     void addKeywordToken(
         std::string_view& currLine,
-        const TokenType type)
+        const TokenType type,
+        const size_t kwLength)
     {
         tokens.emplace_back(type, currentLineNumber, offsetInCurrentLine);
-        const size_t kwLength = k_keywordLengthMap.at(type);
         currLine.remove_prefix(kwLength);
         offsetInCurrentLine += kwLength;
     }
@@ -249,7 +617,8 @@ struct LoxScanSession
         std::string_view& currLine,
         std::string_view identifier)
     {
-        tokens.emplace_back(TokenType::Identifier, currentLineNumber, offsetInCurrentLine, identifier);
+        LoxToken& token = tokens.emplace_back(TokenType::Identifier, currentLineNumber, offsetInCurrentLine, identifier);
+        token.symbol = SymbolTable::GetSymbolTableInstance().Intern(identifier);
         currLine.remove_prefix(identifier.length());
         offsetInCurrentLine += identifier.length();
     }
@@ -268,43 +637,172 @@ struct LoxScanSession
     }
 };
 
-static std::unordered_map<Lexer::OutputHandle, LoxScanSession> sessions;
+// sessions are heap allocated and never move once scanned, so token views into their source stay put
+static LexerSessionStore sessions(k_defaultMaxSessions, k_defaultMaxSessionBytes);
+static std::atomic<size_t> s_sessionCacheHits{ 0u };
+static std::atomic<size_t> s_sessionCacheMisses{ 0u };
+static std::atomic<size_t> s_sessionHashCollisions{ 0u };
+// handed out to edited sessions, with k_editedSessionBit set
+static std::atomic<size_t> s_nextEditedSession{ 0u };
 
-std::string_view readLine(LoxScanSession& input)
+// Handles of whole scripts are the source's hash. Those sessions are content-addressed, so a hash hit only counts if
+// the source matches byte for byte and the session was scanned under an error limit that gives the
+// same result as errorLimit: otherwise we probe the following handles instead.
+// Returns the matching session with a hold on it taken for the caller, or nullptr with handle
+// set to the first free slot
+std::shared_ptr<LoxScanSession> findCachedSession(std::string_view source, size_t errorLimit, Lexer::OutputHandle& handle)
 {
-    std::string_view resultView = std::string_view{};
-    if (input.sourceTextView.empty())
+    while (std::shared_ptr<LoxScanSession> cachedSession = sessions.Retain(handle))
     {
-        return resultView;
+        if (cachedSession->source() == source && cachedSession->matchesErrorLimit(errorLimit))
+        {
+            ++s_sessionCacheHits;
+            return cachedSession;
+        }
+        // some other script that hashed the same (or ours under another error limit), not ours to hold
+        sessions.Release(handle);
+        ++s_sessionHashCollisions;
+        handle = contentHandle(handle + 1u);
     }
 
-    const size_t firstNewline = input.sourceTextView.find_first_of('\n');
-    const size_t firstReturn = input.sourceTextView.find_first_of('\r');
-    
-    // Catch cases where current line only contains a newline character or two
-    if (firstNewline == 0 || firstReturn == 0)
+    ++s_sessionCacheMisses;
+    return nullptr;
+}
+
+// Inserts a freshly scanned session, probing past any slot another thread filled with
+// different source since we looked. Returns the handle it ended up under
+Lexer::OutputHandle storeSession(Lexer::OutputHandle handle, std::shared_ptr<LoxScanSession> session)
+{
+    const size_t sessionBytes = session->memoryUsage();
+    while (true)
+    {
+        std::shared_ptr<LoxScanSession> storedSession = sessions.Insert(handle, session, sessionBytes);
+        // same session, or an identical one someone else finished first, which we now hold too
+        if (storedSession == session ||
+            (storedSession->source() == session->source() && storedSession->matchesErrorLimit(session->errorLimit)))
+        {
+            return handle;
+        }
+        sessions.Release(handle);
+        ++s_sessionHashCollisions;
+        handle = contentHandle(handle + 1u);
+    }
+}
+
+// Splits lines [firstLine, endLine) of a session scanned in one go into blocks of whole lines,
+// roughly k_editBlockSize each, and adds them to blocks. Only binary searches the session's arrays
+void appendBlocks(std::vector<SourceBlock>& blocks, const std::shared_ptr<const LoxScanSession>& owner, const size_t firstLine, const size_t endLine)
+{
+    const std::string_view source = owner->source();
+    const std::vector<size_t>& lineStarts = owner->lineStarts;
+    const size_t endByte = endLine < lineStarts.size() ? lineStarts[endLine] : source.size();
+    auto tokenIter = owner->tokens.begin();
+    auto errorIter = owner->errors.begin();
+
+    size_t blockLine = firstLine;
+    while (blockLine < endLine)
+    {
+        const size_t blockStart = lineStarts[blockLine];
+        size_t nextLine = endLine;
+        // leave a short tail in this block rather than make a block of its own out of it
+        if (endByte - blockStart >= k_editBlockSize + k_editBlockSize / 2u)
+        {
+            auto iter = std::lower_bound(lineStarts.begin() + blockLine + 1u, lineStarts.begin() + endLine, blockStart + k_editBlockSize);
+            nextLine = static_cast<size_t>(std::distance(lineStarts.begin(), iter));
+        }
+        const size_t blockEnd = nextLine < endLine ? lineStarts[nextLine] : endByte;
+
+        tokenIter = std::partition_point(tokenIter, owner->tokens.end(), [blockLine](const LoxToken& token) { return token.line < blockLine; });
+        auto tokenEnd = std::partition_point(tokenIter, owner->tokens.end(), [nextLine](const LoxToken& token) { return token.line < nextLine; });
+        errorIter = std::partition_point(errorIter, owner->errors.end(), [blockLine](const LoxScannerErrorInfo& error) { return error.line < blockLine; });
+        auto errorEnd = std::partition_point(errorIter, owner->errors.end(), [nextLine](const LoxScannerErrorInfo& error) { return error.line < nextLine; });
+
+        SourceBlock& block = blocks.emplace_back();
+        block.owner = owner;
+        block.text = source.substr(blockStart, blockEnd - blockStart);
+        block.tokens = std::span<const LoxToken>(tokenIter, tokenEnd);
+        block.errors = std::span<const LoxScannerErrorInfo>(errorIter, errorEnd);
+        block.lineStarts = std::span<const size_t>(lineStarts.data() + blockLine, nextLine - blockLine);
+        block.firstLine = blockLine;
+        block.textOffset = blockStart;
+
+        tokenIter = tokenEnd;
+        errorIter = errorEnd;
+        blockLine = nextLine;
+    }
+}
+
+// Splits source into roughly chunkCount pieces, each ending right after a line terminator
+// (so CRLF pairs stay together). May return fewer chunks than asked for on short inputs.
+std::vector<std::string_view> splitAtLineBoundaries(std::string_view source, const size_t chunkCount)
+{
+    std::vector<std::string_view> chunks;
+    chunks.reserve(chunkCount);
+
+    const size_t targetChunkSize = source.size() / chunkCount;
+    while (!source.empty() && chunks.size() + 1u < chunkCount && source.size() > targetChunkSize)
     {
-        // when at 0, the current line is just empty! return an empty string view.
-        input.sourceTextView.remove_prefix(1u);
-        return resultView;
+        size_t chunkEnd = targetChunkSize + FindLineTerminator(source.substr(targetChunkSize));
+        if (chunkEnd >= source.size())
+        {
+            break;
+        }
+
+        const bool isCrlf = (source[chunkEnd] == '\r') &&
+                            (chunkEnd + 1u < source.size()) &&
+                            (source[chunkEnd + 1u] == '\n');
+        chunkEnd += isCrlf ? 2u : 1u;
+
+        chunks.emplace_back(source.substr(0, chunkEnd));
+        source.remove_prefix(chunkEnd);
     }
-    else if (firstReturn != std::string::npos)
+
+    if (!source.empty())
     {
-        resultView = input.sourceTextView.substr(0, firstReturn);
-        input.sourceTextView.remove_prefix(firstReturn + 1);
+        chunks.emplace_back(source);
     }
-    else if (firstNewline != std::string::npos)
+
+    return chunks;
+}
+
+// Runs fn(0) .. fn(count - 1), one per thread, with fn(0) on the calling thread
+template<typename Fn>
+void runOnWorkerThreads(const size_t count, Fn&& fn)
+{
+    std::vector<std::thread> workers;
+    workers.reserve(count);
+    for (size_t i = 1u; i < count; ++i)
     {
-        resultView = input.sourceTextView.substr(0, firstNewline);
-        input.sourceTextView.remove_prefix(firstNewline + 1);
+        workers.emplace_back(fn, i);
     }
-    else
+
+    fn(0u);
+
+    for (std::thread& worker : workers)
     {
-        // nothing captured, return empty view? propagate errors? this shouldn't occur so likely indicates
-        // malformed input of some kind
-        return resultView;
+        worker.join();
     }
+}
+
+// Pulls the next line off the front of the remaining source, consuming its terminator.
+// LF, CRLF and a lone CR all count as a single line break. Only looks as far as the end
+// of the current line, so splitting the whole source stays linear in its size.
+std::string_view readLine(LoxScanSession& input)
+{
+    std::string_view& remaining = input.sourceTextView;
+    const size_t lineLength = FindLineTerminator(remaining);
+    const std::string_view resultView = remaining.substr(0, lineLength);
 
+    size_t terminatorLength = 0u;
+    if (lineLength < remaining.size())
+    {
+        const bool isCrlf = (remaining[lineLength] == '\r') &&
+                            (lineLength + 1u < remaining.size()) &&
+                            (remaining[lineLength + 1u] == '\n');
+        terminatorLength = isCrlf ? 2u : 1u;
+    }
+
+    remaining.remove_prefix(lineLength + terminatorLength);
     return resultView;
 }
 
@@ -320,19 +818,358 @@ Lexer& Lexer::GetLexerInstance(size_t hash /*= 0u*/)
 
 size_t Lexer::ParseScript(std::string sourceStr)
 {
-    LoxScanSession session;
+    auto session = std::make_shared<LoxScanSession>();
+    session->sourceText = std::move(sourceStr);
+    session->sourceTextView = session->sourceText;
+    return scanSession(std::move(session));
+}
+
+size_t Lexer::ParseFile(const std::filesystem::path& path)
+{
+    auto session = std::make_shared<LoxScanSession>();
+    session->sourceFile = MappedFile(path);
+    session->mappedSource = session->sourceFile.View();
+    session->sourceTextView = session->mappedSource;
+    return scanSession(std::move(session));
+}
+
+size_t Lexer::ParseFileCached(const std::filesystem::path& path, const std::filesystem::path& cacheDirectory)
+{
+    // looked at on both sides of mapping it: if the file changed in between, we can't tell which
+    // version we got, so leave the cache out of it
+    TokenCacheKey cacheKey;
+    const bool haveCacheKey = GetTokenCacheKey(path, cacheKey);
+
+    auto session = std::make_shared<LoxScanSession>();
+    session->sourceFile = MappedFile(path);
+    session->mappedSource = session->sourceFile.View();
+    session->sourceTextView = session->mappedSource;
+
+    TokenCacheKey mappedCacheKey;
+    if (!haveCacheKey || !GetTokenCacheKey(path, mappedCacheKey) || mappedCacheKey != cacheKey ||
+        cacheKey.sourceSize != session->mappedSource.size())
+    {
+        return scanSession(std::move(session));
+    }
+
+    // a valid cache file vouches for the source, so its hash stands in for hashing it ourselves
+    const std::filesystem::path cacheFile = GetTokenCacheFilePath(cacheDirectory, cacheKey);
+    auto tokenCache = std::make_unique<MappedTokenCache>();
+    if (LoadTokenCacheFile(cacheFile, cacheKey, session->mappedSource, *tokenCache))
+    {
+        size_t sessionKey = contentHandle(tokenCache->SourceHash());
+        if (findCachedSession(session->sourceTextView, session->errorLimit, sessionKey) != nullptr)
+        {
+            return sessionKey;
+        }
+
+        session->tokenCache = std::move(tokenCache);
+        session->lineStartsBase = session->mappedSource.data();
+        session->sourceTextView = std::string_view{};
+        return storeSession(sessionKey, std::move(session));
+    }
+
+    const uint64_t sourceHash = LoxHash(session->sourceTextView, 1u);
+    // may get probed past a collision, the cache file keeps the plain hash
+    size_t sessionKey = contentHandle(sourceHash);
+    if (findCachedSession(session->sourceTextView, session->errorLimit, sessionKey) != nullptr)
+    {
+        return sessionKey;
+    }
+
+    scanLines(*session);
+    session->finalize();
+
+    // cache only clean scripts, and don't fail the parse over a cache we couldn't write
+    if (session->errors.empty())
+    {
+        try
+        {
+            WriteTokenCacheFile(cacheFile, cacheKey, sourceHash, session->source(), session->tokens, session->lineStarts);
+        }
+        catch (const std::system_error&)
+        {
+        }
+    }
+
+    return storeSession(sessionKey, std::move(session));
+}
+
+size_t Lexer::scanSession(std::shared_ptr<LoxScanSession> session)
+{
+    size_t sessionKey = contentHandle(LoxHash(session->sourceTextView, 1u));
+
+    if (findCachedSession(session->sourceTextView, session->errorLimit, sessionKey) != nullptr)
+    {
+        return sessionKey;
+    }
+
+    scanLines(*session);
+    session->finalize();
+
+    return storeSession(sessionKey, std::move(session));
+}
+
+size_t Lexer::ParseScriptParallel(std::string sourceStr, size_t threadCount /*= 0u*/)
+{
+    auto sessionPtr = std::make_shared<LoxScanSession>();
+    LoxScanSession& session = *sessionPtr;
     session.sourceText = std::move(sourceStr);
     session.sourceTextView = session.sourceText;
 
-    size_t sessionKey =
-        MurmurHash2(session.sourceTextView.data(),
-                    session.sourceTextView.length(), 1u);
+    if (threadCount == 0u)
+    {
+        threadCount = std::max<size_t>(std::thread::hardware_concurrency(), 1u);
+    }
+    // not worth spinning up threads for tiny chunks
+    threadCount = std::min(threadCount, session.sourceTextView.size() / k_minParallelChunkSize);
+    if (threadCount <= 1u)
+    {
+        return scanSession(std::move(sessionPtr));
+    }
+
+    size_t sessionKey = contentHandle(LoxHash(session.sourceTextView, 1u));
+
+    if (findCachedSession(session.sourceTextView, session.errorLimit, sessionKey) != nullptr)
+    {
+        return sessionKey;
+    }
+
+    const std::vector<std::string_view> chunks = splitAtLineBoundaries(session.sourceTextView, threadCount);
+    std::vector<LoxScanSession> chunkSessions(chunks.size());
+    std::vector<std::exception_ptr> chunkFailures(chunks.size());
+
+    // each chunk is lexed as if it were a whole script starting at line 0 with nothing before it
+    auto scanChunk = [this, &session, &chunks, &chunkSessions, &chunkFailures](const size_t chunkIdx)
+    {
+        try
+        {
+            chunkSessions[chunkIdx].sourceTextView = chunks[chunkIdx];
+            chunkSessions[chunkIdx].errorLimit = session.errorLimit;
+            scanLines(chunkSessions[chunkIdx]);
+        }
+        catch (...)
+        {
+            chunkFailures[chunkIdx] = std::current_exception();
+        }
+    };
+
+    runOnWorkerThreads(chunks.size(), scanChunk);
+
+    for (const std::exception_ptr& failure : chunkFailures)
+    {
+        if (failure)
+        {
+            std::rethrow_exception(failure);
+        }
+    }
+
+    // Errors can only go up across the whole script, so the total goes over the limit exactly
+    // when the serial path would have stopped somewhere
+    std::vector<size_t> tokenOffsets(chunkSessions.size());
+    std::vector<size_t> lineOffsets(chunkSessions.size());
+    size_t totalTokens = 0u;
+    size_t totalLines = 0u;
+    size_t totalErrors = 0u;
+    for (size_t chunkIdx = 0u; chunkIdx < chunkSessions.size(); ++chunkIdx)
+    {
+        tokenOffsets[chunkIdx] = totalTokens;
+        lineOffsets[chunkIdx] = totalLines;
+        totalTokens += chunkSessions[chunkIdx].tokens.size();
+        totalLines += chunkSessions[chunkIdx].currentLineNumber;
+        totalErrors += chunkSessions[chunkIdx].errors.size();
+    }
+
+    if (totalErrors > session.errorLimit)
+    {
+        // which line it stops on depends on everything before it, so let the serial path work
+        // that out. Scripts this broken aren't worth stitching
+        return scanSession(std::move(sessionPtr));
+    }
+
+    // stitch everything back together, shifting lines by however many came before each chunk
+    session.tokens.resize(totalTokens);
+    auto stitchChunk = [&session, &chunkSessions, &tokenOffsets, &lineOffsets](const size_t chunkIdx)
+    {
+        LoxToken* destination = session.tokens.data() + tokenOffsets[chunkIdx];
+        for (const LoxToken& token : chunkSessions[chunkIdx].tokens)
+        {
+            *destination = token;
+            destination->line += lineOffsets[chunkIdx];
+            ++destination;
+        }
+    };
+
+    runOnWorkerThreads(chunks.size(), stitchChunk);
+
+    session.errors.reserve(totalErrors);
+    session.lineStarts.reserve(totalLines);
+    for (size_t chunkIdx = 0u; chunkIdx < chunkSessions.size(); ++chunkIdx)
+    {
+        for (LoxScannerErrorInfo& error : chunkSessions[chunkIdx].errors)
+        {
+            error.line += lineOffsets[chunkIdx];
+            session.errors.emplace_back(error);
+        }
+
+        const size_t chunkByteOffset = static_cast<size_t>(chunks[chunkIdx].data() - session.sourceText.data());
+        for (const size_t lineStart : chunkSessions[chunkIdx].lineStarts)
+        {
+            session.lineStarts.emplace_back(lineStart + chunkByteOffset);
+        }
+    }
+
+    session.sourceTextView = std::string_view{};
+    session.currentLineNumber = totalLines;
+    session.finalize();
+
+    return storeSession(sessionKey, std::move(sessionPtr));
+}
+
+size_t Lexer::ApplyEdit(const Lexer::OutputHandle previous, const LoxSourceEdit& edit)
+{
+    std::shared_ptr<LoxScanSession> oldSession = sessions.Find(previous);
+    if (oldSession == nullptr)
+    {
+        throw std::invalid_argument("ApplyEdit: no session for the given handle");
+    }
+
+    const size_t oldSourceSize = oldSession->sourceSize();
+    if (edit.offset > oldSourceSize || edit.removedLength > oldSourceSize - edit.offset)
+    {
+        throw std::out_of_range("ApplyEdit: edit range is outside the source");
+    }
+
+    // Past the error limit, where scanning stops depends on the whole script. Lex it again from
+    // scratch rather than patch up a session that never saw its tail. Same if the limit has changed
+    // since the old session was scanned and it would have come out differently under the new one
+    const size_t errorLimit = Lexer::s_allowableErrorCount;
+    auto rescanWholeSource = [this, previous, &oldSession, &edit]()
+    {
+        std::string newSource = oldSession->copySource();
+        newSource.replace(edit.offset, edit.removedLength, edit.replacement);
+        sessions.Release(previous);
+        return ParseScript(std::move(newSource));
+    };
+
+    if (oldSession->errorLimitReached || !oldSession->matchesErrorLimit(errorLimit))
+    {
+        return rescanWholeSource();
+    }
+
+    // Edited sessions are made of blocks of whole lines, borrowed from whichever session scanned
+    // them. The first edit to a session that was scanned in one go splits it into blocks in place
+    EditedSource flatBlocks;
+    const EditedSource* oldBlocks = oldSession->editedSource.get();
+    if (oldBlocks == nullptr)
+    {
+        oldSession->expandTokens();
+        appendBlocks(flatBlocks.blocks, oldSession, 0u, oldSession->lineStarts.size());
+        flatBlocks.updatePositions(0u);
+        oldBlocks = &flatBlocks;
+    }
+    const std::vector<BlockPosition>& positions = oldBlocks->positions;
+    const size_t blockCount = oldBlocks->blocks.size();
+    const size_t editEnd = edit.offset + edit.removedLength;
+
+    // Lines are lexed independently, so only the blocks holding lines the edit touches need another
+    // look. An edit right at the start of a block also takes the block before, in case it turns a
+    // lone CR into CRLF
+    size_t firstBlock = oldBlocks->blockContaining(edit.offset);
+    if (firstBlock != 0u && edit.offset == positions[firstBlock].byteStart)
+    {
+        --firstBlock;
+    }
+    size_t endBlock = std::min(oldBlocks->blockContaining(editEnd) + 1u, blockCount);
+    // pull in neighbours until there's a block's worth, so deletions can't whittle blocks down to nothing
+    auto regionSize = [&positions, &firstBlock, &endBlock, &edit]()
+    {
+        return positions[endBlock].byteStart - positions[firstBlock].byteStart - edit.removedLength + edit.replacement.size();
+    };
+    while (regionSize() < k_editBlockSize && (endBlock < blockCount || firstBlock != 0u))
+    {
+        if (endBlock < blockCount)
+        {
+            ++endBlock;
+        }
+        else
+        {
+            --firstBlock;
+        }
+    }
+
+    // rescan the region on its own, nothing the lexer does looks across a line break
+    const size_t regionStart = positions[firstBlock].byteStart;
+    auto region = std::make_shared<LoxScanSession>();
+    region->sourceText.reserve(positions[endBlock].byteStart - regionStart + edit.replacement.size());
+    for (size_t i = firstBlock; i < endBlock; ++i)
+    {
+        region->sourceText.append(oldBlocks->blocks[i].text);
+    }
+    region->sourceText.replace(edit.offset - regionStart, edit.removedLength, edit.replacement);
+    region->sourceTextView = region->sourceText;
+    region->errorLimit = errorLimit;
+    scanLines(*region);
+
+    const size_t keptErrorCount = positions[blockCount].errorStart - (positions[endBlock].errorStart - positions[firstBlock].errorStart);
+    if (region->errorLimitReached || keptErrorCount + region->errors.size() > errorLimit)
+    {
+        return rescanWholeSource();
+    }
+
+    std::vector<SourceBlock> regionBlocks;
+    appendBlocks(regionBlocks, region, 0u, region->lineStarts.size());
+
+    // From here on we can't fail, so the previous handle gets consumed. If that leaves us the only
+    // owner of an edited session (no other holders of the handle, no TokenViews into it) its blocks
+    // get spliced in place and it keeps its handle. Otherwise the block list gets copied, which only
+    // costs a reference count per block, and the result gets a handle of its own.
+    sessions.Release(previous);
+    const bool editInPlace = oldSession->editedSource != nullptr && oldSession.use_count() == 1;
+
+    std::unique_ptr<EditedSource> editedSource;
+    if (oldSession->editedSource == nullptr)
+    {
+        editedSource = std::make_unique<EditedSource>(std::move(flatBlocks));
+    }
+    else if (editInPlace)
+    {
+        editedSource = std::move(oldSession->editedSource);
+    }
+    else
+    {
+        editedSource = std::make_unique<EditedSource>(*oldSession->editedSource);
+    }
+
+    std::vector<SourceBlock>& blocks = editedSource->blocks;
+    blocks.erase(blocks.begin() + firstBlock, blocks.begin() + endBlock);
+    blocks.insert(blocks.begin() + firstBlock, std::make_move_iterator(regionBlocks.begin()), std::make_move_iterator(regionBlocks.end()));
+    // blocks after the region only move along, their own positions are all relative to themselves
+    editedSource->updatePositions(firstBlock);
+
+    auto session = std::make_shared<LoxScanSession>();
+    session->editedSource = std::move(editedSource);
+    session->errorLimit = errorLimit;
+
+    // Edited sessions aren't keyed by content, hashing the result would cost as much as lexing it
+    const Lexer::OutputHandle handle = editInPlace ? previous : (k_editedSessionBit | s_nextEditedSession++);
+    const size_t sessionBytes = session->memoryUsage();
+    sessions.Insert(handle, std::move(session), sessionBytes);
+    return handle;
+}
+
+void Lexer::scanLines(LoxScanSession& session)
+{
+    if (session.lineStartsBase == nullptr)
+    {
+        session.lineStartsBase = session.sourceTextView.data();
+    }
 
     // runs as long as there's text left to consume within
     // the source text view
     while (!session.sourceTextView.empty())
     {
-
+        session.lineStarts.emplace_back(static_cast<size_t>(session.sourceTextView.data() - session.lineStartsBase));
         std::string_view currentLine = readLine(session);
         if (currentLine.empty())
         {
@@ -344,29 +1181,26 @@ size_t Lexer::ParseScript(std::string sourceStr)
 
         processLine(currentLine, session);
 
-        if (session.errors.size() > Lexer::s_allowableErrorCount)
+        if (session.tooManyErrors())
         {
-            throw std::runtime_error("Surpassed max error count");
+            session.errorLimitReached = true;
+            break;
         }
 
         session.advanceToNextLine();
     }
-
-    session.finalize();
-
-    auto sessionEmplaced = sessions.emplace(sessionKey, std::move(session));
-    return sessionKey;
 }
 
 void Lexer::GetTokensForHandle(const Lexer::OutputHandle handle, size_t& numTokens, LoxToken* tokens)
 {
-    auto sessionIter = sessions.find(handle);
-    if (sessionIter != sessions.end())
+    std::shared_ptr<LoxScanSession> session = sessions.Find(handle);
+    if (session != nullptr)
     {
-        numTokens = sessionIter->second.tokens.size();
+        session->expandTokens();
+        numTokens = session->tokens.size();
         if (tokens != nullptr)
         {
-            std::copy(sessionIter->second.tokens.begin(), sessionIter->second.tokens.end(), tokens);
+            std::copy(session->tokens.begin(), session->tokens.end(), tokens);
         }
     }
     else
@@ -375,73 +1209,298 @@ void Lexer::GetTokensForHandle(const Lexer::OutputHandle handle, size_t& numToke
     }
 }
 
-void Lexer::SetAllowableErrorCount(size_t count)
+TokenView Lexer::GetTokenView(const Lexer::OutputHandle handle) const
 {
-    Lexer::s_allowableErrorCount = count;
+    std::shared_ptr<LoxScanSession> session = sessions.Find(handle);
+    if (session == nullptr)
+    {
+        return TokenView{};
+    }
+
+    // sessions that defer their tokens may be expanding them on another thread, so their views
+    // only go through the session
+    if (session->tokensDeferred())
+    {
+        return TokenView(std::move(session), std::span<const LoxToken>{}, true);
+    }
+    const std::span<const LoxToken> tokens(session->tokens.data(), session->tokens.size());
+    return TokenView(std::move(session), tokens, false);
 }
 
-void Lexer::processLine(std::string_view currentLine, LoxScanSession& session)
+std::span<const LoxToken> TokenView::Tokens() const
 {
+    if (!deferred)
+    {
+        return tokens;
+    }
+    session->expandTokens();
+    return session->tokens;
+}
 
-    while (!currentLine.empty())
+size_t TokenView::Size() const noexcept
+{
+    return deferred ? session->tokenCount() : tokens.size();
+}
+
+TokenType TokenView::Type(size_t idx) const noexcept
+{
+    if (!deferred)
     {
-        const char firstLexeme = currentLine[0];
-        // if current token is a space, skip because the rest of this system
-        // does not care a bit about that
-        if (firstLexeme == ' ')
+        return tokens[idx].type;
+    }
+    return session->tokenCache != nullptr ? session->tokenCache->Type(idx) : session->tokenAt(idx).type;
+}
+
+LoxToken TokenView::Token(size_t idx) const noexcept
+{
+    return deferred ? session->tokenAt(idx) : tokens[idx];
+}
+
+bool TokenView::Mapped() const noexcept
+{
+    return session != nullptr && session->tokenCache != nullptr;
+}
+
+size_t Lexer::CollectDiagnostics(const Lexer::OutputHandle handle, DiagnosticBuffer& diagnostics) const
+{
+    std::shared_ptr<LoxScanSession> session = sessions.Find(handle);
+    if (session == nullptr)
+    {
+        return 0u;
+    }
+
+    if (session->editedSource != nullptr)
+    {
+        const EditedSource& editedSource = *session->editedSource;
+        for (size_t i = 0; i < editedSource.blocks.size(); ++i)
         {
-            currentLine.remove_prefix(1u);
-            session.offsetInCurrentLine += 1u;
-            continue;
+            const SourceBlock& block = editedSource.blocks[i];
+            for (const LoxScannerErrorInfo& error : block.errors)
+            {
+                const size_t line = error.line - block.firstLine + editedSource.positions[i].lineStart;
+                diagnostics.Report(error.errorCode, line, error.offset, error.errorItemStr);
+            }
         }
+        return editedSource.totals().errorStart;
+    }
 
-        // if this first lexeme matches this set, it's one of our guaranteed
-        // single character lexemes that we can just directly add
-        if (auto singleCharIter = singleCharLexemes.find(firstLexeme);
-            singleCharIter != singleCharLexemes.end())
+    for (const LoxScannerErrorInfo& error : session->errors)
+    {
+        diagnostics.Report(error.errorCode, error.line, error.offset, error.errorItemStr);
+    }
+
+    if (session->errorLimitReached)
+    {
+        diagnostics.Report(LoxCompilerErrorCode::ErrorLimitReached, session->currentLineNumber, 0u, std::string_view{});
+        return session->errors.size() + 1u;
+    }
+    return session->errors.size();
+}
+
+bool Lexer::ReleaseSession(const Lexer::OutputHandle handle)
+{
+    return sessions.Release(handle);
+}
+
+void Lexer::SetSessionStoreLimits(size_t maxSessions, size_t maxBytes)
+{
+    sessions.SetLimits(maxSessions, maxBytes);
+}
+
+SessionStoreMetrics Lexer::GetSessionStoreMetrics()
+{
+    SessionStoreMetrics metrics = sessions.GetMetrics();
+    metrics.cacheHits = s_sessionCacheHits.load(std::memory_order_relaxed);
+    metrics.cacheMisses = s_sessionCacheMisses.load(std::memory_order_relaxed);
+    metrics.hashCollisions = s_sessionHashCollisions.load(std::memory_order_relaxed);
+    const SymbolTable& symbols = SymbolTable::GetSymbolTableInstance();
+    metrics.symbolCount = symbols.Size();
+    metrics.symbolTableBytes = symbols.MemoryUsage();
+    return metrics;
+}
+
+CompactTokenBuffer Lexer::GetCompactTokensForHandle(const Lexer::OutputHandle handle)
+{
+    std::shared_ptr<LoxScanSession> session = sessions.Find(handle);
+    if (session == nullptr)
+    {
+        return CompactTokenBuffer{};
+    }
+
+    session->expandTokens();
+    return CompactTokenBuffer(session->source(), session->tokens.data(), session->tokens.size());
+}
+
+StreamingLexer::StreamingLexer(TokenCallback _callback) :
+    session(std::make_unique<LoxScanSession>()), callback(std::move(_callback)) {}
+
+StreamingLexer::~StreamingLexer() {}
+
+void StreamingLexer::Feed(std::string_view chunk)
+{
+    while (!chunk.empty())
+    {
+        // previous chunk ended on a '\r': if this one starts with '\n', it's the rest of a CRLF
+        if (std::exchange(skipLeadingNewline, false) && chunk[0] == '\n')
         {
-            session.addToken(singleCharIter->second, 1u, currentLine);
+            chunk.remove_prefix(1u);
             continue;
         }
-        
-        // if first lexeme is in set of dual-character lexemes, enter this
-        // logic loop
-        if (dualCharPrefixes.find(firstLexeme) != dualCharPrefixes.end())
+
+        const size_t lineLength = FindLineTerminator(chunk);
+        if (lineLength == chunk.size())
         {
-            extractDualCharToken(currentLine, firstLexeme, session);
-            continue;
+            // no terminator yet, hold on to the partial line until the rest of it shows up
+            pendingLine.append(chunk);
+            break;
         }
 
-        if (firstLexeme == '"')
+        if (pendingLine.empty())
         {
-            extractStringLiteral(currentLine, session);
-            continue;
+            lexLine(chunk.substr(0, lineLength));
+        }
+        else
+        {
+            pendingLine.append(chunk.substr(0, lineLength));
+            lexLine(pendingLine);
+            // tokens point into pendingLine, so hand them off before it gets reused
+            flushTokens();
+            pendingLine.clear();
         }
 
-        if (IsNumericDigit(firstLexeme))
+        size_t terminatorLength = 1u;
+        if (chunk[lineLength] == '\r')
         {
-            extractNumericLiteral(currentLine, session);
-            continue;
+            if (lineLength + 1u == chunk.size())
+            {
+                skipLeadingNewline = true;
+            }
+            else if (chunk[lineLength + 1u] == '\n')
+            {
+                terminatorLength = 2u;
+            }
         }
 
-        if (IsAlphaNumeric(firstLexeme))
+        chunk.remove_prefix(lineLength + terminatorLength);
+    }
+
+    // views into chunk are only good until we return
+    flushTokens();
+}
+
+void StreamingLexer::Finish()
+{
+    if (!pendingLine.empty())
+    {
+        lexLine(pendingLine);
+        pendingLine.clear();
+    }
+
+    session->finalize();
+    flushTokens();
+}
+
+size_t StreamingLexer::ErrorCount() const noexcept
+{
+    return session->errors.size();
+}
+
+void StreamingLexer::lexLine(std::string_view line)
+{
+    // same as the serial path: once over the limit, everything after is ignored
+    if (session->errorLimitReached)
+    {
+        return;
+    }
+
+    if (!line.empty())
+    {
+        Lexer::GetLexerInstance().processLine(line, *session);
+
+        if (session->tooManyErrors())
+        {
+            session->errorLimitReached = true;
+            return;
+        }
+    }
+
+    session->advanceToNextLine();
+}
+
+void StreamingLexer::flushTokens()
+{
+    if (!session->tokens.empty())
+    {
+        callback(session->tokens.data(), session->tokens.size());
+        session->tokens.clear();
+    }
+
+    // error views point into input we're about to let go of too
+    for (LoxScannerErrorInfo& error : session->errors)
+    {
+        error.lineStr = std::string_view{};
+        error.errorItemStr = std::string_view{};
+    }
+}
+
+void Lexer::SetAllowableErrorCount(size_t count)
+{
+    Lexer::s_allowableErrorCount = count;
+}
+
+void Lexer::processLine(std::string_view currentLine, LoxScanSession& session)
+{
+
+    while (!currentLine.empty())
+    {
+        const char firstLexeme = currentLine[0];
+        const CharClassEntry& lexemeClass = ClassifyChar(firstLexeme);
+
+        switch (lexemeClass.charClass)
         {
+        case CharClass::Whitespace:
+        {
+            // if current token is a space, skip the whole run because the rest of
+            // this system does not care a bit about that
+            const size_t whitespaceLen = FindNonSpace(currentLine);
+            currentLine.remove_prefix(whitespaceLen);
+            session.offsetInCurrentLine += whitespaceLen;
+            continue;
+        }
+        case CharClass::SingleChar:
+            // one of our guaranteed single character lexemes that we can just directly add
+            session.addToken(lexemeClass.singleCharType, 1u, currentLine);
+            continue;
+        case CharClass::DualCharPrefix:
+            extractDualCharToken(currentLine, firstLexeme, session);
+            continue;
+        case CharClass::Quote:
+            extractStringLiteral(currentLine, session);
+            continue;
+        case CharClass::Digit:
+            extractNumericLiteral(currentLine, session);
+            continue;
+        case CharClass::Alpha:
             extractKeywordOrIdentifier(currentLine, session);
             continue;
+        case CharClass::Unrecognized:
+            break;
         }
 
         // Reached here, means our current character isn't being processed at all
         session.addError(LoxCompilerErrorCode::UnrecognizedLexeme, currentLine, currentLine.substr(0, 1));
-        if (session.errors.size() > Lexer::s_allowableErrorCount)
+        if (session.tooManyErrors())
         {
-            throw std::runtime_error("Reached error limit!");
+            // whoever called us stops at the end of the line
+            return;
         }
     }
 }
 
 void Lexer::extractDualCharToken(std::string_view& line, const char firstChar, LoxScanSession& session)
 {
-    const char secondChar = line[1];
+    // the prefix can be the last character on the line
+    const char secondChar = line.size() > 1u ? line[1] : '\0';
     switch (firstChar)
     {
     case '!':
@@ -455,6 +1514,14 @@ void Lexer::extractDualCharToken(std::string_view& line, const char firstChar, L
     case '/':
         secondChar == '/' ? session.addSingleLineCommentToken(line) : session.addToken(TokenType::Slash, 1u, line);
         break;
+    case '<':
+        secondChar == '=' ?
+            session.addToken(TokenType::LessEqual, 2u, line) : session.addToken(TokenType::Less, 1u, line);
+        break;
+    case '>':
+        secondChar == '=' ?
+            session.addToken(TokenType::GreaterEqual, 2u, line) : session.addToken(TokenType::Greater, 1u, line);
+        break;
     default:
         session.addError(LoxCompilerErrorCode::UnrecognizedDualCharacterLexeme, line, line.substr(0, 2));
         // erase this line, because at the least the line is trashed
@@ -466,8 +1533,8 @@ void Lexer::extractDualCharToken(std::string_view& line, const char firstChar, L
 void Lexer::extractStringLiteral(std::string_view& line, LoxScanSession& session)
 {
     // str literal found. seach for end quote starting at +1 from here
-    const size_t endOfLiteral = line.find_first_of('"', 1u);
-    if (endOfLiteral == std::string_view::npos)
+    const size_t endOfLiteral = FindChar(line.substr(1u), '"') + 1u;
+    if (endOfLiteral >= line.size())
     {
         std::string_view extractedLiteral = findEndOfBrokenStrLiteral(line);
         session.addError(LoxCompilerErrorCode::StringLiteralMissingEndQuote, line, extractedLiteral);
@@ -504,7 +1571,7 @@ void Lexer::extractNumericLiteral(std::string_view& line, LoxScanSession& sessio
         }
     }
 
-    float convertedLiteral = 0.0f;
+    double convertedLiteral = 0.0;
     std::from_chars_result convertResult = std::from_chars(&line[0], &line[endOfNumLiteral], convertedLiteral);
     // If we just check EC, we can have cases where a literal is extracted correctly from an invalid numeric literal
     //string - from_chars failsafes into only parsing what it can. Compare returned data pointer to where we expect
@@ -525,36 +1592,17 @@ void Lexer::extractNumericLiteral(std::string_view& line, LoxScanSession& sessio
 void Lexer::extractKeywordOrIdentifier(std::string_view& line, LoxScanSession& session)
 {
     // first char that's not alphanumeric indicates end of keyword
-    auto endIter = std::find_if_not(line.begin(), line.end(), IsAlphaNumeric);
-    if (endIter != line.end())
+    const size_t identifierLen = FindIdentifierEnd(line);
+    if (identifierLen != line.size())
     {
-        std::string_view token = std::string_view{ line.begin(), endIter };
+        std::string_view token = line.substr(0, identifierLen);
         // see if token matches potential keywords, otherwise it is an identifier
-        auto keywordTokenIter = k_keywordTokenTypeMap.find(token);
-        if (keywordTokenIter != k_keywordTokenTypeMap.end())
+        const TokenType keywordType = MatchKeyword(token);
+        if (keywordType != TokenType::Invalid)
         {
-            // if last token type added isn't a keyword, we can add it
-            bool validToAddKeyword = true;
-            if (!session.tokens.empty())
-            {
-                const TokenType lastTokenType = session.tokens.back().type;
-                validToAddKeyword = !IsKeywordTokenType(lastTokenType);
-            }
-
-            // Should be valid in most cases, but this helps us catch potential errors
-            if (validToAddKeyword)
-            {
-                session.addKeywordToken(line, keywordTokenIter->second);
-            }
-            else
-            {
-                // last token added was a keyword, and in lox this is invalid
-                // behavior that won't work. log the error. likely
-                // that the user tried to do (keyword) (identifier)
-                session.addError(LoxCompilerErrorCode::InvalidKeywordUsage, line, token);
-                const size_t keywordLen = k_keywordLengthMap.at(keywordTokenIter->second);
-                line.remove_prefix(keywordLen);
-            }
+            // keywords can follow each other ("print nil", "true and false"), so whether the
+            // order makes sense is left to the parser
+            session.addKeywordToken(line, keywordType, token.length());
         }
         else
         {
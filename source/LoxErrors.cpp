@@ -32,6 +32,69 @@ namespace
         case LoxCompilerErrorCode::InvalidInputString:
             return std::string("Input source given to the scanner was invalid and could not be parsed.");
             break;
+        case LoxCompilerErrorCode::ErrorLimitReached:
+            return std::string("Too many errors in input source, scanning stopped early.");
+            break;
+        case LoxCompilerErrorCode::UnableToOpenSourceFile:
+            return std::string("Unable to open or memory map the given source file.");
+            break;
+        case LoxCompilerErrorCode::UnableToWriteTokenCache:
+            return std::string("Unable to write token cache file to the cache directory.");
+            break;
+        case LoxCompilerErrorCode::ExpectedTokenNotFound:
+            return std::string("Expected token not found.");
+            break;
+        case LoxCompilerErrorCode::UnclosedBrackets:
+            return std::string("Unclosed brackets found.");
+            break;
+        case LoxCompilerErrorCode::UnclosedParentheses:
+            return std::string("Unclosed parentheses found.");
+            break;
+        case LoxCompilerErrorCode::InvalidTokenOrdering:
+            return std::string("Invalid token ordering.");
+            break;
+        case LoxCompilerErrorCode::MissingPrimaryToken:
+            return std::string("Missing primary token.");
+            break;
+        case LoxCompilerErrorCode::MissingEOF:
+            return std::string("Token stream ended without an EOF token.");
+            break;
+        case LoxCompilerErrorCode::InvalidAssignmentTarget:
+            return std::string("Invalid assignment target.");
+            break;
+        case LoxCompilerErrorCode::TooManyConstants:
+            return std::string("Too many constants in one chunk.");
+            break;
+        case LoxCompilerErrorCode::TooManyLocals:
+            return std::string("Too many local variables in scope.");
+            break;
+        case LoxCompilerErrorCode::TooManyGlobals:
+            return std::string("Too many global variables in one script.");
+            break;
+        case LoxCompilerErrorCode::JumpTooLarge:
+            return std::string("Too much code to jump over.");
+            break;
+        case LoxCompilerErrorCode::VariableAlreadyDeclared:
+            return std::string("Already a variable with this name in this scope.");
+            break;
+        case LoxCompilerErrorCode::LocalInOwnInitializer:
+            return std::string("Can't read local variable in its own initializer.");
+            break;
+        case LoxCompilerErrorCode::OperandMustBeNumber:
+            return std::string("Operand must be a number.");
+            break;
+        case LoxCompilerErrorCode::OperandsMustBeNumbers:
+            return std::string("Operands must be numbers.");
+            break;
+        case LoxCompilerErrorCode::OperandsMustBeNumbersOrStrings:
+            return std::string("Operands must be two numbers or two strings.");
+            break;
+        case LoxCompilerErrorCode::UndefinedVariable:
+            return std::string("Undefined variable.");
+            break;
+        case LoxCompilerErrorCode::StackOverflow:
+            return std::string("Stack overflow.");
+            break;
         case LoxCompilerErrorCode::UnknownError:
             [[fallthrough]];
         default:
@@ -0,0 +1,170 @@
+#include "MappedFile.hpp"
+#include "LoxErrors.hpp"
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    [[noreturn]] void throwMappingFailure(const std::filesystem::path& path)
+    {
+        throw std::system_error(make_error_code(LoxCompilerErrorCode::UnableToOpenSourceFile), path.string());
+    }
+}
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        throwMappingFailure(path);
+    }
+
+    LARGE_INTEGER fileSize{};
+    if (!GetFileSizeEx(file, &fileSize))
+    {
+        CloseHandle(file);
+        throwMappingFailure(path);
+    }
+
+    fileHandle = file;
+    opened = true;
+    size = static_cast<size_t>(fileSize.QuadPart);
+    if (size == 0u)
+    {
+        return;
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        close();
+        throwMappingFailure(path);
+    }
+    mappingHandle = mapping;
+
+    data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (data == nullptr)
+    {
+        close();
+        throwMappingFailure(path);
+    }
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throwMappingFailure(path);
+    }
+
+    struct stat fileStat{};
+    if (::fstat(fd, &fileStat) != 0)
+    {
+        ::close(fd);
+        throwMappingFailure(path);
+    }
+
+    opened = true;
+    size = static_cast<size_t>(fileStat.st_size);
+    if (size != 0u)
+    {
+        void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            ::close(fd);
+            throwMappingFailure(path);
+        }
+        // we're going to read it front to back exactly once when lexing
+        ::madvise(mapped, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(mapped);
+    }
+
+    // the mapping keeps its own reference to the file, don't need the descriptor anymore
+    ::close(fd);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept :
+    data(std::exchange(other.data, nullptr)),
+    size(std::exchange(other.size, 0u)),
+    opened(std::exchange(other.opened, false))
+#ifdef _WIN32
+    , fileHandle(std::exchange(other.fileHandle, nullptr)),
+    mappingHandle(std::exchange(other.mappingHandle, nullptr))
+#endif
+{}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        data = std::exchange(other.data, nullptr);
+        size = std::exchange(other.size, 0u);
+        opened = std::exchange(other.opened, false);
+#ifdef _WIN32
+        fileHandle = std::exchange(other.fileHandle, nullptr);
+        mappingHandle = std::exchange(other.mappingHandle, nullptr);
+#endif
+    }
+    return *this;
+}
+
+std::string_view MappedFile::View() const noexcept
+{
+    return data != nullptr ? std::string_view(data, size) : std::string_view{};
+}
+
+size_t MappedFile::Size() const noexcept
+{
+    return size;
+}
+
+bool MappedFile::IsOpen() const noexcept
+{
+    return opened;
+}
+
+void MappedFile::close() noexcept
+{
+#ifdef _WIN32
+    if (data != nullptr)
+    {
+        UnmapViewOfFile(data);
+    }
+    if (mappingHandle != nullptr)
+    {
+        CloseHandle(mappingHandle);
+    }
+    if (fileHandle != nullptr)
+    {
+        CloseHandle(fileHandle);
+    }
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+#else
+    if (data != nullptr)
+    {
+        ::munmap(const_cast<char*>(data), size);
+    }
+#endif
+    data = nullptr;
+    size = 0u;
+    opened = false;
+}
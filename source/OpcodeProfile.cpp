@@ -0,0 +1,57 @@
+#include "OpcodeProfile.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+
+uint64_t OpcodePairProfile::TotalPairs() const noexcept
+{
+    return std::accumulate(pairCounts.begin(), pairCounts.end(), uint64_t{ 0u });
+}
+
+void OpcodePairProfile::Merge(const OpcodePairProfile& other) noexcept
+{
+    for (size_t i = 0; i < pairCounts.size(); ++i)
+    {
+        pairCounts[i] += other.pairCounts[i];
+    }
+}
+
+std::vector<OpcodePairProfile::Pair> OpcodePairProfile::TopPairs(size_t numPairs) const
+{
+    std::vector<Pair> pairs;
+    for (size_t i = 0; i < pairCounts.size(); ++i)
+    {
+        if (pairCounts[i] != 0u)
+        {
+            pairs.emplace_back(Pair{ static_cast<OpCode>(i / k_numOpCodes), static_cast<OpCode>(i % k_numOpCodes), pairCounts[i] });
+        }
+    }
+
+    // ties go to opcode order, so reports are stable
+    const auto moreFrequent = [](const Pair& lhs, const Pair& rhs)
+    {
+        if (lhs.count != rhs.count)
+        {
+            return lhs.count > rhs.count;
+        }
+        return lhs.first != rhs.first ? lhs.first < rhs.first : lhs.second < rhs.second;
+    };
+    numPairs = std::min(numPairs, pairs.size());
+    std::partial_sort(pairs.begin(), pairs.begin() + static_cast<ptrdiff_t>(numPairs), pairs.end(), moreFrequent);
+    pairs.resize(numPairs);
+    return pairs;
+}
+
+std::string OpcodePairProfile::Report(size_t numPairs) const
+{
+    const uint64_t total = TotalPairs();
+    std::string result;
+    char buffer[128];
+    for (const Pair& pair : TopPairs(numPairs))
+    {
+        std::snprintf(buffer, sizeof(buffer), "%-16s -> %-16s | %12llu | %5.1f%%\n", OpCodeName(pair.first), OpCodeName(pair.second),
+            static_cast<unsigned long long>(pair.count), 100.0 * static_cast<double>(pair.count) / static_cast<double>(total));
+        result += buffer;
+    }
+    return result;
+}
@@ -1,222 +1,430 @@
 #include "Parser.hpp"
-
-std::string getParseErrorString(LoxCompilerErrorCode errorCode) noexcept
-{
-    switch (errorCode)
-    {
-    case LoxCompilerErrorCode::ExpectedTokenNotFound:
-        return "Expected token not found";
-    case LoxCompilerErrorCode::UnclosedBrackets:
-        return "Unclosed brackets found";
-    case LoxCompilerErrorCode::UnclosedParentheses:
-        return "Unclosed parentheses found";
-    case LoxCompilerErrorCode::InvalidTokenOrdering:
-        return "Invalid token ordering";
-    case LoxCompilerErrorCode::MissingPrimaryToken:
-        return "Missing primary token";
-    default:
-        return "Invalid error code for ParseError class";
-    }
-}
+#include <algorithm>
+#include <array>
 
 ParseError::ParseError(LoxCompilerErrorCode ec, LoxToken _token) noexcept :
-    errorCode(ec), token(_token), std::runtime_error(getParseErrorString(ec)) {}
+    errorCode(ec), token(_token), std::runtime_error(make_error_code(ec).message()) {}
 
-Parser::Parser(const std::vector<LoxToken>& _tokens) : tokens(_tokens) {}
+Parser::Parser(std::span<const LoxToken> _tokens) noexcept : tokens(_tokens) {}
 
-Expression Parser::expression(Parser::TokenIter iter) const
+Parser::Parser(TokenView _tokenView) noexcept : tokenView(std::move(_tokenView)), tokens(tokenView.Tokens()) {}
+
+namespace
 {
-    return equality(iter);
+    SourceLocation TokenLocation(const LoxToken& token) noexcept
+    {
+        return SourceLocation{ token.line, token.offset };
+    }
 }
 
-Expression Parser::equality(Parser::TokenIter iter) const
+Program Parser::ParseProgram(DiagnosticBuffer& _diagnostics)
 {
-    const static std::vector<TokenType> equalityTokens
+    diagnostics = &_diagnostics;
+    panicMode = false;
+    hadError = false;
+
+    Program program;
+    if (!tokensTerminated())
     {
-        TokenType::EqualEqual,
-        TokenType::LogicalNotEqual
-    };
+        errorAt(LoxToken(), LoxCompilerErrorCode::MissingEOF);
+        diagnostics = nullptr;
+        return program;
+    }
+    skipComments();
 
-    Expression lhs = comparison(iter);
-    Expression result;
+    // every expression node eats at least one token and every statement at least two, so
+    // after this nothing in the parse allocates
+    const size_t remainingTokens = tokens.size() - currentToken;
+    program.Reserve(remainingTokens, remainingTokens / 2u + 1u);
+    pendingStatements.clear();
+    pendingStatements.reserve(remainingTokens / 2u + 1u);
 
-    // now a while loop to follow down
-    while (match(equalityTokens, iter))
+    while (!isAtEnd())
     {
-        LoxToken operatorToken = previous(iter);
-        Expression rhs = comparison(iter);
-        result = BinaryExpression{ lhs, operatorToken, rhs };
+        const StatementIndex idx = declaration(program);
+        if (idx != k_invalidStatementIndex)
+        {
+            program.AddTopLevel(idx);
+        }
     }
 
-    return result;
+    diagnostics = nullptr;
+    return program;
 }
 
-Expression Parser::comparison(TokenIter iter) const
+ExpressionTree Parser::ParseExpression()
 {
-    const static std::vector<TokenType> comparisonTokens
+    // checked once here so the cursor never has to bounds check: it stops on the EOF token
+    if (!tokensTerminated())
     {
-        TokenType::Greater,
-        TokenType::GreaterEqual,
-        TokenType::Less,
-        TokenType::LessEqual
-    };
+        throw ParseError(LoxCompilerErrorCode::MissingEOF, LoxToken());
+    }
+    skipComments();
+    panicMode = false;
+    hadError = false;
 
-    Expression lhs = term(iter);
-    Expression result = lhs;
-    
-    while (match(comparisonTokens, iter))
+    ExpressionTree tree;
+    // every node eats at least one token, so this is the only allocation the tree makes
+    tree.Reserve(tokens.size() - currentToken);
+    tree.SetRoot(expression(tree));
+    if (hadError)
     {
-        LoxToken operatorToken = previous(iter);
-        Expression rhs = term(iter);
-        result = BinaryExpression{ lhs, operatorToken, rhs };
+        throw ParseError(firstErrorCode, firstErrorToken);
     }
+    return tree;
+}
 
+StatementIndex Parser::declaration(Program& program)
+{
+    const StatementIndex result = peek().type == TokenType::Var ? varDeclaration(program, advance()) : statement(program);
+    if (panicMode)
+    {
+        synchronize();
+    }
     return result;
 }
 
-Expression Parser::term(TokenIter iter) const
+StatementIndex Parser::varDeclaration(Program& program, const LoxToken& keyword)
 {
-    const static std::vector<TokenType> termTokens
+    if (peek().type != TokenType::Identifier)
     {
-        TokenType::Minus,
-        TokenType::Plus
-    };
-
-    Expression lhs = factor(iter);
-    Expression result = lhs;
+        errorAt(peek(), LoxCompilerErrorCode::ExpectedTokenNotFound);
+        return k_invalidStatementIndex;
+    }
+    const SymbolId name = advance().symbol;
 
-    while (match(termTokens, iter))
+    ExpressionIndex initializer = k_invalidExpressionIndex;
+    if (peek().type == TokenType::Equal)
     {
-        LoxToken operatorToken = previous(iter);
-        Expression rhs = factor(iter);
-        result = BinaryExpression{ lhs, operatorToken, rhs };
+        advance();
+        initializer = expression(program.Expressions());
+        if (initializer == k_invalidExpressionIndex)
+        {
+            return k_invalidStatementIndex;
+        }
     }
 
-    return result;
+    if (!consume(TokenType::Semicolon, LoxCompilerErrorCode::ExpectedTokenNotFound))
+    {
+        return k_invalidStatementIndex;
+    }
+    return program.AddVar(name, initializer, TokenLocation(keyword));
 }
 
-Expression Parser::factor(TokenIter iter) const
+StatementIndex Parser::statement(Program& program)
 {
-    const static std::vector<TokenType> factorTokens
+    switch (peek().type)
     {
-        TokenType::Slash,
-        TokenType::Star
-    };
-
-    Expression lhs = unary(iter);
-    Expression result = lhs;
+    case TokenType::Print:
+        return printStatement(program, advance());
+    case TokenType::While:
+        return whileStatement(program, advance());
+    case TokenType::LeftBrace:
+        return block(program, advance());
+    default:
+        return expressionStatement(program);
+    }
+}
 
-    while (match(factorTokens, iter))
+StatementIndex Parser::printStatement(Program& program, const LoxToken& keyword)
+{
+    const ExpressionIndex value = expression(program.Expressions());
+    if (value == k_invalidExpressionIndex || !consume(TokenType::Semicolon, LoxCompilerErrorCode::ExpectedTokenNotFound))
     {
-        LoxToken operatorToken = previous(iter);
-        Expression rhs = unary(iter);
-        result = BinaryExpression{ lhs, operatorToken, rhs };
+        return k_invalidStatementIndex;
     }
-
-    return result;
+    return program.AddPrint(value, TokenLocation(keyword));
 }
 
-Expression Parser::unary(TokenIter iter) const
+StatementIndex Parser::whileStatement(Program& program, const LoxToken& keyword)
 {
-    const static std::vector<TokenType> unaryTokens
+    if (!consume(TokenType::LeftParen, LoxCompilerErrorCode::ExpectedTokenNotFound))
+    {
+        return k_invalidStatementIndex;
+    }
+    const ExpressionIndex condition = expression(program.Expressions());
+    if (condition == k_invalidExpressionIndex || !consume(TokenType::RightParen, LoxCompilerErrorCode::UnclosedParentheses))
     {
-        TokenType::LogicalNot,
-        TokenType::Minus
-    };
+        return k_invalidStatementIndex;
+    }
 
-    if (match(unaryTokens, iter))
+    const StatementIndex body = statement(program);
+    if (body == k_invalidStatementIndex)
     {
-        LoxToken operatorToken = previous(iter);
-        Expression rhs = unary(iter);
-        return UnaryExpression{ operatorToken, rhs };
+        return k_invalidStatementIndex;
     }
+    return program.AddWhile(condition, body, TokenLocation(keyword));
+}
 
-    return primary(iter);
+StatementIndex Parser::expressionStatement(Program& program)
+{
+    const SourceLocation location = TokenLocation(peek());
+    const ExpressionIndex value = expression(program.Expressions());
+    if (value == k_invalidExpressionIndex || !consume(TokenType::Semicolon, LoxCompilerErrorCode::ExpectedTokenNotFound))
+    {
+        return k_invalidStatementIndex;
+    }
+    return program.AddExpressionStatement(value, location);
 }
 
-Expression Parser::primary(TokenIter iter) const
+StatementIndex Parser::block(Program& program, const LoxToken& leftBrace)
 {
-    if (match({ TokenType::False }, iter))
+    // nested blocks push on top of ours and pop back off before we finish
+    const size_t firstPending = pendingStatements.size();
+    while (peek().type != TokenType::RightBrace && !isAtEnd())
     {
-        return LanguageLiteralExpression{ TokenType::False, *iter };
+        const StatementIndex idx = declaration(program);
+        if (idx != k_invalidStatementIndex)
+        {
+            pendingStatements.emplace_back(idx);
+        }
     }
-    else if (match({ TokenType::True }, iter))
+
+    StatementIndex result = k_invalidStatementIndex;
+    if (consume(TokenType::RightBrace, LoxCompilerErrorCode::UnclosedBrackets))
     {
-        return LanguageLiteralExpression{ TokenType::True, *iter };
+        const std::span<const StatementIndex> body(pendingStatements.data() + firstPending, pendingStatements.size() - firstPending);
+        result = program.AddBlock(body, TokenLocation(leftBrace));
     }
-    else if (match({ TokenType::Nil }, iter))
+    pendingStatements.resize(firstPending);
+    return result;
+}
+
+const Parser::ParseRule& Parser::getRule(TokenType type) noexcept
+{
+    constexpr size_t k_ruleCount = static_cast<size_t>(TokenType::TokenCount) + 1u;
+    static const std::array<ParseRule, k_ruleCount> s_rules = []()
     {
-        return LanguageLiteralExpression{ TokenType::Nil, *iter };
+        std::array<ParseRule, k_ruleCount> rules{};
+        const auto setRule = [&rules](TokenType type, PrefixParseFn prefix, InfixParseFn infix, PrecedenceLevel precedence)
+        {
+            rules[static_cast<size_t>(type)] = ParseRule{ prefix, infix, precedence };
+        };
+
+        setRule(TokenType::LeftParen, &Parser::grouping, nullptr, PrecedenceLevel::Expression);
+        setRule(TokenType::Equal, nullptr, &Parser::assignment, PrecedenceLevel::Assignment);
+        setRule(TokenType::Minus, &Parser::unary, &Parser::binary, PrecedenceLevel::Term);
+        setRule(TokenType::Plus, nullptr, &Parser::binary, PrecedenceLevel::Term);
+        setRule(TokenType::Slash, nullptr, &Parser::binary, PrecedenceLevel::Factor);
+        setRule(TokenType::Star, nullptr, &Parser::binary, PrecedenceLevel::Factor);
+        setRule(TokenType::LogicalNot, &Parser::unary, nullptr, PrecedenceLevel::Expression);
+        setRule(TokenType::LogicalNotEqual, nullptr, &Parser::binary, PrecedenceLevel::Equality);
+        setRule(TokenType::EqualEqual, nullptr, &Parser::binary, PrecedenceLevel::Equality);
+        setRule(TokenType::Greater, nullptr, &Parser::binary, PrecedenceLevel::Comparison);
+        setRule(TokenType::GreaterEqual, nullptr, &Parser::binary, PrecedenceLevel::Comparison);
+        setRule(TokenType::Less, nullptr, &Parser::binary, PrecedenceLevel::Comparison);
+        setRule(TokenType::LessEqual, nullptr, &Parser::binary, PrecedenceLevel::Comparison);
+        setRule(TokenType::Identifier, &Parser::identifier, nullptr, PrecedenceLevel::Expression);
+        setRule(TokenType::StringLiteral, &Parser::stringLiteral, nullptr, PrecedenceLevel::Expression);
+        setRule(TokenType::NumberLiteral, &Parser::numericLiteral, nullptr, PrecedenceLevel::Expression);
+        setRule(TokenType::And, nullptr, &Parser::binary, PrecedenceLevel::And);
+        setRule(TokenType::Or, nullptr, &Parser::binary, PrecedenceLevel::Or);
+        setRule(TokenType::False, &Parser::languageLiteral, nullptr, PrecedenceLevel::Expression);
+        setRule(TokenType::True, &Parser::languageLiteral, nullptr, PrecedenceLevel::Expression);
+        setRule(TokenType::Nil, &Parser::languageLiteral, nullptr, PrecedenceLevel::Expression);
+        return rules;
+    }();
+
+    return s_rules[static_cast<size_t>(type)];
+}
+
+ExpressionIndex Parser::expression(ExpressionTree& tree)
+{
+    return parsePrecedence(tree, PrecedenceLevel::Assignment);
+}
+
+ExpressionIndex Parser::parsePrecedence(ExpressionTree& tree, PrecedenceLevel minPrecedence)
+{
+    // taken even if it can't start an expression, so an error always moves the parse forward
+    const LoxToken& prefixToken = advance();
+    const PrefixParseFn prefix = getRule(prefixToken.type).prefix;
+    if (prefix == nullptr)
+    {
+        errorAt(prefixToken, LoxCompilerErrorCode::MissingPrimaryToken);
+        return k_invalidExpressionIndex;
     }
-    else if (match({ TokenType::NumberLiteral }, iter))
+    ExpressionIndex result = (this->*prefix)(tree, prefixToken);
+
+    // EndOfFile, ; and anything else that can't continue an expression have no infix rule
+    while (result != k_invalidExpressionIndex)
     {
-        return NumericLiteralExpression{ iter->numericLiteral };
+        const ParseRule& rule = getRule(peek().type);
+        if (rule.infix == nullptr || rule.precedence < minPrecedence)
+        {
+            break;
+        }
+        result = (this->*rule.infix)(tree, result, advance());
     }
-    else if (match({ TokenType::StringLiteral }, iter))
+
+    return result;
+}
+
+ExpressionIndex Parser::languageLiteral(ExpressionTree& tree, const LoxToken& token)
+{
+    return tree.AddLanguageLiteral(token.type, TokenLocation(token));
+}
+
+ExpressionIndex Parser::numericLiteral(ExpressionTree& tree, const LoxToken& token)
+{
+    return tree.AddNumericLiteral(token.numericLiteral, TokenLocation(token));
+}
+
+ExpressionIndex Parser::stringLiteral(ExpressionTree& tree, const LoxToken& token)
+{
+    return tree.AddStringLiteral(token.strLiteral, TokenLocation(token));
+}
+
+ExpressionIndex Parser::identifier(ExpressionTree& tree, const LoxToken& token)
+{
+    return tree.AddIdentifier(token.symbol, TokenLocation(token));
+}
+
+ExpressionIndex Parser::grouping(ExpressionTree& tree, const LoxToken& token)
+{
+    const ExpressionIndex inner = expression(tree);
+    if (inner == k_invalidExpressionIndex || !consume(TokenType::RightParen, LoxCompilerErrorCode::UnclosedParentheses))
     {
-        return StringLiteralExpression{ iter->strLiteral };
+        return k_invalidExpressionIndex;
     }
-    else if (match({ TokenType::LeftParen }, iter))
+    return tree.AddGrouping(inner, TokenLocation(token));
+}
+
+ExpressionIndex Parser::unary(ExpressionTree& tree, const LoxToken& token)
+{
+    // the operand can't contain a binary operator, "-a * b" is "(-a) * b"
+    const ExpressionIndex operand = parsePrecedence(tree, PrecedenceLevel::Unary);
+    if (operand == k_invalidExpressionIndex)
     {
-        Expression expr = expression(iter);
-        consume(TokenType::RightParen, "Expected a ')' after expression.");
-        return GroupingExpression{ expr };
+        return k_invalidExpressionIndex;
     }
-    else
+    return tree.AddUnary(token.type, operand, TokenLocation(token));
+}
+
+ExpressionIndex Parser::binary(ExpressionTree& tree, ExpressionIndex lhs, const LoxToken& token)
+{
+    // one level tighter on the right makes the operator left associative: 1 - 2 - 3 is (1 - 2) - 3
+    const PrecedenceLevel precedence = getRule(token.type).precedence;
+    const ExpressionIndex rhs = parsePrecedence(tree, static_cast<PrecedenceLevel>(static_cast<int>(precedence) + 1));
+    if (rhs == k_invalidExpressionIndex)
     {
-        // uh oh
-        throw std::runtime_error("Oops");
+        return k_invalidExpressionIndex;
     }
+    return tree.AddBinary(lhs, token.type, rhs, TokenLocation(token));
 }
 
-bool Parser::isAtEnd(TokenIter iter) const
+ExpressionIndex Parser::assignment(ExpressionTree& tree, ExpressionIndex lhs, const LoxToken& token)
 {
-    if (iter != tokens.cend() && iter->type == TokenType::EndOfFile)
+    // Only reached from an expression that allows assignment, since nothing else binds looser.
+    // The target's already parsed by now, so check it's something that can be assigned to
+    if (!std::holds_alternative<IdentifierExpression>(tree[lhs].expression))
     {
-        return true;
+        errorAt(token, LoxCompilerErrorCode::InvalidAssignmentTarget);
+        return k_invalidExpressionIndex;
     }
-    else
+
+    // same precedence on the right makes it right associative: a = b = c is a = (b = c)
+    const ExpressionIndex value = parsePrecedence(tree, PrecedenceLevel::Assignment);
+    if (value == k_invalidExpressionIndex)
     {
-        if (iter == tokens.cend())
-        {
-            // error? we shouldn't be able to do this. means
-            // scanner didn't generate/find valid EOF token
-            throw ParseError(LoxCompilerErrorCode::MissingEOF, LoxToken());
-        }
-        return false;
+        return k_invalidExpressionIndex;
     }
+    return tree.AddAssign(lhs, value, TokenLocation(token));
+}
+
+bool Parser::tokensTerminated() const noexcept
+{
+    return !tokens.empty() && tokens.back().type == TokenType::EndOfFile;
 }
 
-const LoxToken& Parser::advance(TokenIter iter) const noexcept
+bool Parser::isAtEnd() const noexcept
 {
-    if (!isAtEnd(iter))
+    return tokens[currentToken].type == TokenType::EndOfFile;
+}
+
+const LoxToken& Parser::advance() noexcept
+{
+    const LoxToken& token = tokens[currentToken];
+    if (token.type != TokenType::EndOfFile)
     {
-        ++iter;
+        ++currentToken;
+        skipComments();
     }
-    
-    return previous(iter);
+    previousToken = &token;
+    return token;
 }
 
-const LoxToken& Parser::previous(TokenIter iter) const noexcept
+const LoxToken& Parser::peek() const noexcept
 {
-    TokenIter prevIter = iter - 1;
-    return *prevIter;
+    return tokens[currentToken];
 }
 
-bool Parser::match(const std::vector<TokenType>& types, TokenIter iter) const noexcept
+void Parser::skipComments() noexcept
 {
-    for (const auto& tokenType : types)
+    while (tokens[currentToken].type == TokenType::CommentBegin || tokens[currentToken].type == TokenType::CommentString)
     {
-        if (tokenType == iter->type)
-        {
-            advance(iter);
-            return true;
-        }
+        ++currentToken;
     }
+}
+
+bool Parser::consume(TokenType type, LoxCompilerErrorCode failureCode) noexcept
+{
+    if (peek().type == type)
+    {
+        advance();
+        return true;
+    }
+
+    errorAt(peek(), failureCode);
     return false;
 }
 
-void Parser::consume(TokenType type, std::string failureString) const
+void Parser::errorAt(const LoxToken& token, LoxCompilerErrorCode errorCode) noexcept
+{
+    // one error per statement: anything after the first is usually fallout from it
+    if (panicMode)
+    {
+        return;
+    }
+    panicMode = true;
+
+    if (!hadError)
+    {
+        hadError = true;
+        firstErrorCode = errorCode;
+        firstErrorToken = token;
+    }
+
+    if (diagnostics != nullptr)
+    {
+        diagnostics->Report(errorCode, token.line, token.offset, token.strLiteral);
+    }
+}
+
+void Parser::synchronize() noexcept
 {
+    panicMode = false;
 
+    while (!isAtEnd())
+    {
+        if (previousToken != nullptr && previousToken->type == TokenType::Semicolon)
+        {
+            return;
+        }
+
+        switch (peek().type)
+        {
+        case TokenType::Class:
+        case TokenType::Fun:
+        case TokenType::Var:
+        case TokenType::For:
+        case TokenType::If:
+        case TokenType::While:
+        case TokenType::Print:
+        case TokenType::Return:
+            return;
+        default:
+            advance();
+            break;
+        }
+    }
 }
@@ -0,0 +1,230 @@
+#include "Peephole.hpp"
+#include <cstdio>
+#include <vector>
+
+namespace
+{
+    constexpr uint32_t k_noTarget = UINT32_MAX;
+
+    struct Instruction
+    {
+        OpCode op = OpCode::Return;
+        uint32_t operand = 0u;
+        uint32_t line = 0u;
+        // for jumps, the index of the instruction they land on
+        uint32_t target = k_noTarget;
+    };
+
+    bool IsForwardJump(const OpCode op) noexcept
+    {
+        return op == OpCode::Jump || op == OpCode::JumpIfFalse || op == OpCode::PopJumpIfFalse || op == OpCode::JumpIfNotLess;
+    }
+
+    bool IsJump(const OpCode op) noexcept
+    {
+        return IsForwardJump(op) || op == OpCode::Loop;
+    }
+
+    // pushes that can't fail and leave nothing else behind, so pushing one and popping it is a no-op
+    bool IsPurePush(const OpCode op) noexcept
+    {
+        switch (op)
+        {
+        case OpCode::Constant:
+        case OpCode::ConstantLong:
+        case OpCode::Nil:
+        case OpCode::True:
+        case OpCode::False:
+        case OpCode::GetLocal:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // one entry per instruction plus one for the end of the code, which is where a jump past the
+    // last instruction would land
+    std::vector<Instruction> Decode(const Chunk& chunk)
+    {
+        const std::span<const uint8_t> code = chunk.Code();
+        std::vector<Instruction> instructions;
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> indexAtOffset(code.size() + 1u, k_noTarget);
+
+        size_t offset = 0u;
+        while (offset < code.size())
+        {
+            Instruction instruction;
+            instruction.op = static_cast<OpCode>(code[offset]);
+            instruction.line = chunk.GetLine(offset);
+            for (size_t i = 0; i < OperandBytes(instruction.op); ++i)
+            {
+                instruction.operand |= static_cast<uint32_t>(code[offset + 1u + i]) << (8u * i);
+            }
+            indexAtOffset[offset] = static_cast<uint32_t>(instructions.size());
+            offsets.emplace_back(static_cast<uint32_t>(offset));
+            instructions.emplace_back(instruction);
+            offset += 1u + OperandBytes(instruction.op);
+        }
+        indexAtOffset[code.size()] = static_cast<uint32_t>(instructions.size());
+
+        for (size_t i = 0; i < instructions.size(); ++i)
+        {
+            Instruction& instruction = instructions[i];
+            if (IsJump(instruction.op))
+            {
+                const size_t end = offsets[i] + 1u + OperandBytes(instruction.op);
+                instruction.target = indexAtOffset[IsForwardJump(instruction.op) ? end + instruction.operand : end - instruction.operand];
+            }
+        }
+        return instructions;
+    }
+}
+
+PeepholeStats OptimizeChunk(Chunk& chunk)
+{
+    PeepholeStats stats;
+    stats.bytesBefore = chunk.Code().size();
+
+    const std::vector<Instruction> instructions = Decode(chunk);
+    const size_t count = instructions.size();
+    stats.instructionsBefore = count;
+
+    std::vector<uint8_t> isTarget(count + 1u, 0u);
+    for (const Instruction& instruction : instructions)
+    {
+        if (instruction.target != k_noTarget)
+        {
+            isTarget[instruction.target] = 1u;
+        }
+    }
+
+    // whether instructions [start, start + length) exist and nothing jumps into the middle of them
+    const auto fusable = [&](const size_t start, const size_t length)
+    {
+        if (start + length > count)
+        {
+            return false;
+        }
+        for (size_t i = start + 1u; i < start + length; ++i)
+        {
+            if (isTarget[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    const auto opAt = [&](const size_t idx) { return idx < count ? instructions[idx].op : OpCode::Count; };
+    // a JumpIfFalse followed by a Pop, whose target is a Pop too: the condition comes off whichever
+    // way it goes, so it can be popped up front and the jump can skip the Pop it lands on
+    const auto popsEitherWay = [&](const size_t idx)
+    {
+        return opAt(idx) == OpCode::JumpIfFalse && opAt(idx + 1u) == OpCode::Pop && opAt(instructions[idx].target) == OpCode::Pop;
+    };
+
+    std::vector<Instruction> output;
+    output.reserve(count);
+    // old instruction index to the index of the first new instruction at or after it, for relocating jumps
+    std::vector<uint32_t> newIndex(count + 1u, 0u);
+
+    size_t i = 0u;
+    while (i < count)
+    {
+        const Instruction& current = instructions[i];
+        Instruction fused = current;
+        size_t length = 1u;
+        bool dropped = false;
+
+        if (current.op == OpCode::GetLocal && fusable(i, 5u) && opAt(i + 1u) == OpCode::Constant && opAt(i + 2u) == OpCode::Add &&
+            opAt(i + 3u) == OpCode::SetLocal && opAt(i + 4u) == OpCode::Pop && instructions[i + 3u].operand == current.operand)
+        {
+            // slot in the low byte, constant in the high one
+            fused = Instruction{ OpCode::AddLocalConstant, current.operand | (instructions[i + 1u].operand << 8u), instructions[i + 2u].line };
+            length = 5u;
+        }
+        else if (current.op == OpCode::Less && fusable(i, 3u) && popsEitherWay(i + 1u))
+        {
+            fused = Instruction{ OpCode::JumpIfNotLess, 0u, current.line, instructions[i + 1u].target + 1u };
+            length = 3u;
+        }
+        else if (current.op == OpCode::JumpIfFalse && fusable(i, 2u) && popsEitherWay(i))
+        {
+            fused = Instruction{ OpCode::PopJumpIfFalse, 0u, current.line, current.target + 1u };
+            length = 2u;
+        }
+        else if ((current.op == OpCode::SetLocal || current.op == OpCode::SetGlobal) && fusable(i, 2u) && opAt(i + 1u) == OpCode::Pop)
+        {
+            fused.op = current.op == OpCode::SetLocal ? OpCode::SetLocalPop : OpCode::SetGlobalPop;
+            length = 2u;
+        }
+        else if (IsPurePush(current.op) && fusable(i, 2u) && opAt(i + 1u) == OpCode::Pop)
+        {
+            length = 2u;
+            dropped = true;
+        }
+
+        // the instruction after a skipped Pop is a jump target now, so it mustn't get fused into anything
+        if (fused.op == OpCode::JumpIfNotLess || fused.op == OpCode::PopJumpIfFalse)
+        {
+            isTarget[fused.target] = 1u;
+        }
+
+        for (size_t k = i; k < i + length; ++k)
+        {
+            newIndex[k] = static_cast<uint32_t>(output.size());
+        }
+        if (length == 1u)
+        {
+            output.emplace_back(current);
+        }
+        else if (dropped)
+        {
+            ++stats.removed;
+        }
+        else
+        {
+            output.emplace_back(fused);
+            ++stats.fused;
+        }
+        i += length;
+    }
+    newIndex[count] = static_cast<uint32_t>(output.size());
+
+    std::vector<size_t> newOffsets(output.size() + 1u, 0u);
+    for (size_t j = 0; j < output.size(); ++j)
+    {
+        newOffsets[j + 1u] = newOffsets[j] + 1u + OperandBytes(output[j].op);
+    }
+
+    // everything only gets shorter, so relocated jumps still fit their operands
+    chunk.ClearCode();
+    for (size_t j = 0; j < output.size(); ++j)
+    {
+        const Instruction& instruction = output[j];
+        uint32_t operand = instruction.operand;
+        if (IsJump(instruction.op))
+        {
+            const size_t target = newOffsets[newIndex[instruction.target]];
+            operand = static_cast<uint32_t>(IsForwardJump(instruction.op) ? target - newOffsets[j + 1u] : newOffsets[j + 1u] - target);
+        }
+
+        chunk.Write(instruction.op, instruction.line);
+        for (size_t k = 0; k < OperandBytes(instruction.op); ++k)
+        {
+            chunk.Write(static_cast<uint8_t>(operand >> (8u * k)), instruction.line);
+        }
+    }
+
+    stats.instructionsAfter = output.size();
+    stats.bytesAfter = chunk.Code().size();
+    return stats;
+}
+
+std::string FormatPeepholeStats(const PeepholeStats& stats)
+{
+    char buffer[160];
+    std::snprintf(buffer, sizeof(buffer), "%zu -> %zu instructions, %zu -> %zu bytes, %zu fused, %zu removed",
+        stats.instructionsBefore, stats.instructionsAfter, stats.bytesBefore, stats.bytesAfter, stats.fused, stats.removed);
+    return buffer;
+}
@@ -0,0 +1,389 @@
+#include "ScanKernels.hpp"
+#include <atomic>
+#include <bit>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define LOX_SCAN_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC lets us use AVX2 intrinsics without enabling them for the whole TU
+#define LOX_TARGET_AVX2
+#else
+#define LOX_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+    using FindIdentifierEndFn = size_t(*)(const char* begin, const char* end) noexcept;
+    using FindCharFn = size_t(*)(const char* begin, const char* end, char c) noexcept;
+    using FindNonSpaceFn = size_t(*)(const char* begin, const char* end) noexcept;
+    using FindLineTerminatorFn = size_t(*)(const char* begin, const char* end) noexcept;
+
+    struct ScanKernelTable
+    {
+        ScanKernelLevel level;
+        FindIdentifierEndFn findIdentifierEnd;
+        FindCharFn findChar;
+        FindNonSpaceFn findNonSpace;
+        FindLineTerminatorFn findLineTerminator;
+    };
+
+    constexpr bool IsIdentifierChar(const char c) noexcept
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (c == '_');
+    }
+
+    size_t FindIdentifierEndScalar(const char* begin, const char* end) noexcept
+    {
+        const char* iter = begin;
+        while (iter != end && IsIdentifierChar(*iter))
+        {
+            ++iter;
+        }
+        return static_cast<size_t>(iter - begin);
+    }
+
+    size_t FindCharScalar(const char* begin, const char* end, const char c) noexcept
+    {
+        const char* iter = begin;
+        while (iter != end && *iter != c)
+        {
+            ++iter;
+        }
+        return static_cast<size_t>(iter - begin);
+    }
+
+    size_t FindNonSpaceScalar(const char* begin, const char* end) noexcept
+    {
+        const char* iter = begin;
+        while (iter != end && *iter == ' ')
+        {
+            ++iter;
+        }
+        return static_cast<size_t>(iter - begin);
+    }
+
+    size_t FindLineTerminatorScalar(const char* begin, const char* end) noexcept
+    {
+        const char* iter = begin;
+        while (iter != end && *iter != '\n' && *iter != '\r')
+        {
+            ++iter;
+        }
+        return static_cast<size_t>(iter - begin);
+    }
+
+#ifdef LOX_SCAN_KERNELS_X86
+
+    // Bytes >= 0x80 are negative as signed chars, so they fall outside every range
+    // we test here and correctly count as non-identifier characters.
+    inline __m128i InRange128(const __m128i v, const char lo, const char hi) noexcept
+    {
+        return _mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(lo - 1))),
+            _mm_cmplt_epi8(v, _mm_set1_epi8(static_cast<char>(hi + 1))));
+    }
+
+    inline uint32_t IdentifierMask128(const __m128i v) noexcept
+    {
+        // OR-ing in 0x20 folds upper case letters onto lower case, and doesn't move
+        // any non-letter into the a-z range
+        const __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        const __m128i letters = InRange128(folded, 'a', 'z');
+        const __m128i digits = InRange128(v, '0', '9');
+        const __m128i underscore = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+        const __m128i identChars = _mm_or_si128(_mm_or_si128(letters, digits), underscore);
+        return static_cast<uint32_t>(_mm_movemask_epi8(identChars));
+    }
+
+    size_t FindIdentifierEndSSE2(const char* begin, const char* end) noexcept
+    {
+        const char* iter = begin;
+        while (end - iter >= 16)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iter));
+            const uint32_t nonIdent = ~IdentifierMask128(v) & 0xFFFFu;
+            if (nonIdent != 0u)
+            {
+                return static_cast<size_t>(iter - begin) + std::countr_zero(nonIdent);
+            }
+            iter += 16;
+        }
+        return static_cast<size_t>(iter - begin) + FindIdentifierEndScalar(iter, end);
+    }
+
+    size_t FindCharSSE2(const char* begin, const char* end, const char c) noexcept
+    {
+        const __m128i needle = _mm_set1_epi8(c);
+        const char* iter = begin;
+        while (end - iter >= 16)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iter));
+            const uint32_t matches = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+            if (matches != 0u)
+            {
+                return static_cast<size_t>(iter - begin) + std::countr_zero(matches);
+            }
+            iter += 16;
+        }
+        return static_cast<size_t>(iter - begin) + FindCharScalar(iter, end, c);
+    }
+
+    size_t FindNonSpaceSSE2(const char* begin, const char* end) noexcept
+    {
+        const __m128i spaces = _mm_set1_epi8(' ');
+        const char* iter = begin;
+        while (end - iter >= 16)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iter));
+            const uint32_t nonSpace = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, spaces))) & 0xFFFFu;
+            if (nonSpace != 0u)
+            {
+                return static_cast<size_t>(iter - begin) + std::countr_zero(nonSpace);
+            }
+            iter += 16;
+        }
+        return static_cast<size_t>(iter - begin) + FindNonSpaceScalar(iter, end);
+    }
+
+    size_t FindLineTerminatorSSE2(const char* begin, const char* end) noexcept
+    {
+        const __m128i newlines = _mm_set1_epi8('\n');
+        const __m128i returns = _mm_set1_epi8('\r');
+        const char* iter = begin;
+        while (end - iter >= 16)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iter));
+            const __m128i terminators = _mm_or_si128(_mm_cmpeq_epi8(v, newlines), _mm_cmpeq_epi8(v, returns));
+            const uint32_t matches = static_cast<uint32_t>(_mm_movemask_epi8(terminators));
+            if (matches != 0u)
+            {
+                return static_cast<size_t>(iter - begin) + std::countr_zero(matches);
+            }
+            iter += 16;
+        }
+        return static_cast<size_t>(iter - begin) + FindLineTerminatorScalar(iter, end);
+    }
+
+    LOX_TARGET_AVX2 inline __m256i InRange256(const __m256i v, const char lo, const char hi) noexcept
+    {
+        return _mm256_and_si256(
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8(static_cast<char>(lo - 1))),
+            _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(hi + 1)), v));
+    }
+
+    LOX_TARGET_AVX2 size_t FindIdentifierEndAVX2(const char* begin, const char* end) noexcept
+    {
+        const char* iter = begin;
+        while (end - iter >= 32)
+        {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(iter));
+            const __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+            const __m256i letters = InRange256(folded, 'a', 'z');
+            const __m256i digits = InRange256(v, '0', '9');
+            const __m256i underscore = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+            const __m256i identChars = _mm256_or_si256(_mm256_or_si256(letters, digits), underscore);
+            const uint32_t nonIdent = ~static_cast<uint32_t>(_mm256_movemask_epi8(identChars));
+            if (nonIdent != 0u)
+            {
+                return static_cast<size_t>(iter - begin) + std::countr_zero(nonIdent);
+            }
+            iter += 32;
+        }
+        // finish up with the narrower kernel, which handles its own scalar tail. It's
+        // legacy-SSE encoded, so clear the upper YMM state first to avoid transition stalls
+        _mm256_zeroupper();
+        return static_cast<size_t>(iter - begin) + FindIdentifierEndSSE2(iter, end);
+    }
+
+    LOX_TARGET_AVX2 size_t FindCharAVX2(const char* begin, const char* end, const char c) noexcept
+    {
+        const __m256i needle = _mm256_set1_epi8(c);
+        const char* iter = begin;
+        while (end - iter >= 32)
+        {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(iter));
+            const uint32_t matches = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+            if (matches != 0u)
+            {
+                return static_cast<size_t>(iter - begin) + std::countr_zero(matches);
+            }
+            iter += 32;
+        }
+        _mm256_zeroupper();
+        return static_cast<size_t>(iter - begin) + FindCharSSE2(iter, end, c);
+    }
+
+    LOX_TARGET_AVX2 size_t FindNonSpaceAVX2(const char* begin, const char* end) noexcept
+    {
+        const __m256i spaces = _mm256_set1_epi8(' ');
+        const char* iter = begin;
+        while (end - iter >= 32)
+        {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(iter));
+            const uint32_t nonSpace = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, spaces)));
+            if (nonSpace != 0u)
+            {
+                return static_cast<size_t>(iter - begin) + std::countr_zero(nonSpace);
+            }
+            iter += 32;
+        }
+        _mm256_zeroupper();
+        return static_cast<size_t>(iter - begin) + FindNonSpaceSSE2(iter, end);
+    }
+
+    LOX_TARGET_AVX2 size_t FindLineTerminatorAVX2(const char* begin, const char* end) noexcept
+    {
+        const __m256i newlines = _mm256_set1_epi8('\n');
+        const __m256i returns = _mm256_set1_epi8('\r');
+        const char* iter = begin;
+        while (end - iter >= 32)
+        {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(iter));
+            const __m256i terminators = _mm256_or_si256(_mm256_cmpeq_epi8(v, newlines), _mm256_cmpeq_epi8(v, returns));
+            const uint32_t matches = static_cast<uint32_t>(_mm256_movemask_epi8(terminators));
+            if (matches != 0u)
+            {
+                return static_cast<size_t>(iter - begin) + std::countr_zero(matches);
+            }
+            iter += 32;
+        }
+        _mm256_zeroupper();
+        return static_cast<size_t>(iter - begin) + FindLineTerminatorSSE2(iter, end);
+    }
+
+    bool CpuSupportsAVX2() noexcept
+    {
+#if defined(_MSC_VER)
+        int cpuInfo[4]{};
+        __cpuid(cpuInfo, 0);
+        if (cpuInfo[0] < 7)
+        {
+            return false;
+        }
+
+        // OS has to be saving the YMM registers for us too, not just the CPU having them
+        __cpuid(cpuInfo, 1);
+        const bool osxsave = (cpuInfo[2] & (1 << 27)) != 0;
+        const bool avx = (cpuInfo[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || ((_xgetbv(0) & 0x6u) != 0x6u))
+        {
+            return false;
+        }
+
+        __cpuidex(cpuInfo, 7, 0);
+        return (cpuInfo[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+
+#endif // LOX_SCAN_KERNELS_X86
+
+    constexpr ScanKernelTable k_scalarKernels{ ScanKernelLevel::Scalar, FindIdentifierEndScalar, FindCharScalar, FindNonSpaceScalar, FindLineTerminatorScalar };
+#ifdef LOX_SCAN_KERNELS_X86
+    constexpr ScanKernelTable k_sse2Kernels{ ScanKernelLevel::SSE2, FindIdentifierEndSSE2, FindCharSSE2, FindNonSpaceSSE2, FindLineTerminatorSSE2 };
+    constexpr ScanKernelTable k_avx2Kernels{ ScanKernelLevel::AVX2, FindIdentifierEndAVX2, FindCharAVX2, FindNonSpaceAVX2, FindLineTerminatorAVX2 };
+#endif
+
+    ScanKernelLevel DetectScanKernelLevel() noexcept
+    {
+#ifdef LOX_SCAN_KERNELS_X86
+        // SSE2 is part of the x86-64 baseline, so it's always there
+        return CpuSupportsAVX2() ? ScanKernelLevel::AVX2 : ScanKernelLevel::SSE2;
+#else
+        return ScanKernelLevel::Scalar;
+#endif
+    }
+
+    const ScanKernelTable& GetKernelTableForLevel(const ScanKernelLevel level) noexcept
+    {
+        switch (level)
+        {
+#ifdef LOX_SCAN_KERNELS_X86
+        case ScanKernelLevel::AVX2:
+            return k_avx2Kernels;
+        case ScanKernelLevel::SSE2:
+            return k_sse2Kernels;
+#endif
+        default:
+            return k_scalarKernels;
+        }
+    }
+
+    // Both set up on first use, so lexing from another static initializer still gets the right
+    // kernels. The active table is atomic since SetScanKernelLevel can run while worker threads
+    // are lexing. The tables themselves never change, so relaxed loads are enough
+    ScanKernelLevel SupportedLevel() noexcept
+    {
+        static const ScanKernelLevel s_supportedLevel = DetectScanKernelLevel();
+        return s_supportedLevel;
+    }
+
+    std::atomic<const ScanKernelTable*>& ActiveKernelsSlot() noexcept
+    {
+        static std::atomic<const ScanKernelTable*> s_activeKernels{ &GetKernelTableForLevel(SupportedLevel()) };
+        return s_activeKernels;
+    }
+
+    const ScanKernelTable& ActiveKernels() noexcept
+    {
+        return *ActiveKernelsSlot().load(std::memory_order_relaxed);
+    }
+}
+
+ScanKernelLevel GetSupportedScanKernelLevel() noexcept
+{
+    return SupportedLevel();
+}
+
+ScanKernelLevel GetActiveScanKernelLevel() noexcept
+{
+    return ActiveKernels().level;
+}
+
+void SetScanKernelLevel(ScanKernelLevel level) noexcept
+{
+    if (static_cast<uint32_t>(level) > static_cast<uint32_t>(SupportedLevel()))
+    {
+        level = SupportedLevel();
+    }
+    ActiveKernelsSlot().store(&GetKernelTableForLevel(level), std::memory_order_relaxed);
+}
+
+const char* ScanKernelLevelToString(const ScanKernelLevel level) noexcept
+{
+    switch (level)
+    {
+    case ScanKernelLevel::Scalar:
+        return "Scalar";
+    case ScanKernelLevel::SSE2:
+        return "SSE2";
+    case ScanKernelLevel::AVX2:
+        return "AVX2";
+    default:
+        return "Unknown";
+    }
+}
+
+size_t FindIdentifierEnd(std::string_view sv) noexcept
+{
+    return ActiveKernels().findIdentifierEnd(sv.data(), sv.data() + sv.size());
+}
+
+size_t FindChar(std::string_view sv, const char c) noexcept
+{
+    return ActiveKernels().findChar(sv.data(), sv.data() + sv.size(), c);
+}
+
+size_t FindNonSpace(std::string_view sv) noexcept
+{
+    return ActiveKernels().findNonSpace(sv.data(), sv.data() + sv.size());
+}
+
+size_t FindLineTerminator(std::string_view sv) noexcept
+{
+    return ActiveKernels().findLineTerminator(sv.data(), sv.data() + sv.size());
+}
@@ -0,0 +1,155 @@
+#include "SessionStore.hpp"
+#include <bit>
+#include <cstdint>
+#include <limits>
+
+namespace
+{
+    static_assert((LexerSessionStore::k_shardCount & (LexerSessionStore::k_shardCount - 1u)) == 0u,
+        "Shard count has to be a power of two");
+
+    // zero stays zero (unlimited), anything else gets at least one per shard
+    size_t ShareOfLimit(size_t limit) noexcept
+    {
+        if (limit == 0u)
+        {
+            return std::numeric_limits<size_t>::max();
+        }
+        return (limit + LexerSessionStore::k_shardCount - 1u) / LexerSessionStore::k_shardCount;
+    }
+}
+
+LexerSessionStore::LexerSessionStore(size_t maxSessions, size_t maxBytes) noexcept :
+    maxSessionsPerShard(ShareOfLimit(maxSessions)), maxBytesPerShard(ShareOfLimit(maxBytes)) {}
+
+std::shared_ptr<LoxScanSession> LexerSessionStore::Insert(size_t handle, std::shared_ptr<LoxScanSession> session, size_t sessionBytes)
+{
+    Shard& shard = shardForHandle(handle);
+    std::lock_guard<std::mutex> shardLock(shard.mutex);
+
+    auto entryIter = shard.entries.find(handle);
+    if (entryIter != shard.entries.end())
+    {
+        shard.lruOrder.splice(shard.lruOrder.begin(), shard.lruOrder, entryIter->second.lruPosition);
+        ++entryIter->second.holders;
+        return entryIter->second.session;
+    }
+
+    shard.lruOrder.emplace_front(handle);
+    shard.entries.emplace(handle, Entry{ session, sessionBytes, 1u, shard.lruOrder.begin() });
+    shard.bytesHeld += sessionBytes;
+    liveSessions.fetch_add(1u, std::memory_order_relaxed);
+    bytesHeld.fetch_add(sessionBytes, std::memory_order_relaxed);
+
+    evictOverLimit(shard, handle);
+    return session;
+}
+
+std::shared_ptr<LoxScanSession> LexerSessionStore::Find(size_t handle)
+{
+    Shard& shard = shardForHandle(handle);
+    std::lock_guard<std::mutex> shardLock(shard.mutex);
+
+    auto entryIter = shard.entries.find(handle);
+    if (entryIter == shard.entries.end())
+    {
+        return nullptr;
+    }
+
+    shard.lruOrder.splice(shard.lruOrder.begin(), shard.lruOrder, entryIter->second.lruPosition);
+    return entryIter->second.session;
+}
+
+std::shared_ptr<LoxScanSession> LexerSessionStore::Retain(size_t handle)
+{
+    Shard& shard = shardForHandle(handle);
+    std::lock_guard<std::mutex> shardLock(shard.mutex);
+
+    auto entryIter = shard.entries.find(handle);
+    if (entryIter == shard.entries.end())
+    {
+        return nullptr;
+    }
+
+    shard.lruOrder.splice(shard.lruOrder.begin(), shard.lruOrder, entryIter->second.lruPosition);
+    ++entryIter->second.holders;
+    return entryIter->second.session;
+}
+
+bool LexerSessionStore::Release(size_t handle)
+{
+    Shard& shard = shardForHandle(handle);
+    std::lock_guard<std::mutex> shardLock(shard.mutex);
+
+    auto entryIter = shard.entries.find(handle);
+    if (entryIter == shard.entries.end())
+    {
+        return false;
+    }
+
+    if (--entryIter->second.holders == 0u)
+    {
+        eraseEntry(shard, entryIter);
+    }
+    return true;
+}
+
+void LexerSessionStore::Clear()
+{
+    for (Shard& shard : shards)
+    {
+        std::lock_guard<std::mutex> shardLock(shard.mutex);
+        while (!shard.entries.empty())
+        {
+            eraseEntry(shard, shard.entries.begin());
+        }
+    }
+}
+
+void LexerSessionStore::SetLimits(size_t maxSessions, size_t maxBytes) noexcept
+{
+    maxSessionsPerShard.store(ShareOfLimit(maxSessions), std::memory_order_relaxed);
+    maxBytesPerShard.store(ShareOfLimit(maxBytes), std::memory_order_relaxed);
+}
+
+SessionStoreMetrics LexerSessionStore::GetMetrics() const noexcept
+{
+    SessionStoreMetrics metrics;
+    metrics.liveSessions = liveSessions.load(std::memory_order_relaxed);
+    metrics.bytesHeld = bytesHeld.load(std::memory_order_relaxed);
+    metrics.evictions = evictions.load(std::memory_order_relaxed);
+    return metrics;
+}
+
+LexerSessionStore::Shard& LexerSessionStore::shardForHandle(size_t handle) noexcept
+{
+    // handles are hashes already, but the shard maps bucket on their low bits too:
+    // mix and take the high bits so shard choice and bucket choice don't line up
+    constexpr uint64_t k_fibonacciMultiplier = 0x9E3779B97F4A7C15ull;
+    constexpr uint32_t k_shardBits = std::countr_zero(k_shardCount);
+    const uint64_t mixed = static_cast<uint64_t>(handle) * k_fibonacciMultiplier;
+    return shards[static_cast<size_t>(mixed >> (64u - k_shardBits))];
+}
+
+void LexerSessionStore::evictOverLimit(Shard& shard, size_t protectedHandle)
+{
+    const size_t maxSessions = maxSessionsPerShard.load(std::memory_order_relaxed);
+    const size_t maxBytes = maxBytesPerShard.load(std::memory_order_relaxed);
+
+    // never evict what was just inserted, even if it's bigger than the whole budget by itself
+    while ((shard.entries.size() > maxSessions || shard.bytesHeld > maxBytes) &&
+           shard.lruOrder.back() != protectedHandle)
+    {
+        eraseEntry(shard, shard.entries.find(shard.lruOrder.back()));
+        evictions.fetch_add(1u, std::memory_order_relaxed);
+    }
+}
+
+void LexerSessionStore::eraseEntry(Shard& shard, std::unordered_map<size_t, Entry>::iterator entryIter)
+{
+    shard.bytesHeld -= entryIter->second.bytes;
+    liveSessions.fetch_sub(1u, std::memory_order_relaxed);
+    bytesHeld.fetch_sub(entryIter->second.bytes, std::memory_order_relaxed);
+    shard.lruOrder.erase(entryIter->second.lruPosition);
+    shard.entries.erase(entryIter);
+}
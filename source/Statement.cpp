@@ -0,0 +1,61 @@
+#include "Statement.hpp"
+#include <stdexcept>
+
+StatementIndex Program::AddExpressionStatement(ExpressionIndex expression, SourceLocation loc)
+{
+    return addStatement(ExpressionStatement{ expression }, loc);
+}
+
+StatementIndex Program::AddPrint(ExpressionIndex expression, SourceLocation loc)
+{
+    return addStatement(PrintStatement{ expression }, loc);
+}
+
+StatementIndex Program::AddVar(SymbolId name, ExpressionIndex initializer, SourceLocation loc)
+{
+    return addStatement(VarStatement{ name, initializer }, loc);
+}
+
+StatementIndex Program::AddBlock(std::span<const StatementIndex> body, SourceLocation loc)
+{
+    const BlockStatement block{ static_cast<uint32_t>(blockItems.size()), static_cast<uint32_t>(body.size()) };
+    blockItems.insert(blockItems.end(), body.begin(), body.end());
+    return addStatement(block, loc);
+}
+
+StatementIndex Program::AddWhile(ExpressionIndex condition, StatementIndex body, SourceLocation loc)
+{
+    return addStatement(WhileStatement{ condition, body }, loc);
+}
+
+SourceLocation Program::Location(StatementIndex idx) const noexcept
+{
+    return SourceLocation{ statements[idx].line, statements[idx].column };
+}
+
+void Program::Reserve(size_t numExpressions, size_t numStatements)
+{
+    expressions.Reserve(numExpressions);
+    statements.reserve(numStatements);
+    // every statement shows up in at most one of these
+    blockItems.reserve(numStatements);
+    topLevel.reserve(numStatements);
+}
+
+size_t Program::MemoryUsage() const noexcept
+{
+    return expressions.MemoryUsage() + statements.capacity() * sizeof(StatementNode) +
+           (blockItems.capacity() + topLevel.capacity()) * sizeof(StatementIndex);
+}
+
+StatementIndex Program::addStatement(const StatementVariant& statement, SourceLocation loc)
+{
+    // the invalid index is reserved, so one less than the full range
+    if (statements.size() >= static_cast<size_t>(k_invalidStatementIndex))
+    {
+        throw std::length_error("Program is out of statement indices");
+    }
+
+    statements.emplace_back(StatementNode{ statement, static_cast<uint32_t>(loc.line), static_cast<uint32_t>(loc.column) });
+    return static_cast<StatementIndex>(statements.size() - 1u);
+}
@@ -0,0 +1,217 @@
+#include "SymbolTable.hpp"
+#include "Hash.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+namespace
+{
+    static_assert((SymbolTable::k_shardCount & (SymbolTable::k_shardCount - 1u)) == 0u,
+        "Shard count has to be a power of two");
+
+    constexpr uint32_t k_shardBits = std::countr_zero(SymbolTable::k_shardCount);
+    // ids are (nameIndex + 1) << k_shardBits | shard, and have to fit in 32 bits
+    constexpr size_t k_maxNamesPerShard = (size_t{ 1u } << (32u - k_shardBits)) - 1u;
+    constexpr uint64_t k_symbolHashSeed = 0x5CAB;
+    constexpr size_t k_initialSlotCount = 256u;
+    constexpr size_t k_minArenaBlockBytes = 4u * 1024u;
+    constexpr size_t k_maxArenaBlockBytes = 1024u * 1024u;
+
+    // Identifiers repeat a lot, so each thread remembers the last few it interned and skips the
+    // shard lock entirely when it sees them again. Names live in the arena and never move or
+    // change, so comparing against one without the lock is fine
+    struct RecentSymbol
+    {
+        uint64_t hash = 0u;
+        SymbolId id = k_invalidSymbolId;
+        std::string_view name{};
+    };
+
+    constexpr size_t k_recentSymbolCount = 1024u;
+    thread_local std::array<RecentSymbol, k_recentSymbolCount> s_recentSymbols{};
+
+    SymbolId MakeSymbolId(const uint32_t nameIndexPlusOne, const size_t shardIdx) noexcept
+    {
+        return (nameIndexPlusOne << k_shardBits) | static_cast<SymbolId>(shardIdx);
+    }
+}
+
+SymbolTable& SymbolTable::GetSymbolTableInstance()
+{
+    static SymbolTable s_symbolTable;
+    return s_symbolTable;
+}
+
+SymbolId SymbolTable::Intern(std::string_view text)
+{
+    const uint64_t hash = LoxHash(text, k_symbolHashSeed);
+    RecentSymbol& recent = s_recentSymbols[hash & (k_recentSymbolCount - 1u)];
+    if (recent.id != k_invalidSymbolId && recent.hash == hash && recent.name == text)
+    {
+        return recent.id;
+    }
+
+    // shard from the high bits, slot from the low ones
+    const size_t shardIdx = static_cast<size_t>(hash >> (64u - k_shardBits));
+    const uint32_t slotHash = static_cast<uint32_t>(hash);
+    Shard& shard = shards[shardIdx];
+
+    uint32_t nameIndexPlusOne = 0u;
+    {
+        std::shared_lock<std::shared_mutex> readLock(shard.mutex);
+        nameIndexPlusOne = findInShard(shard, text, slotHash);
+        if (nameIndexPlusOne != 0u)
+        {
+            recent.name = shard.names[nameIndexPlusOne - 1u];
+        }
+    }
+
+    if (nameIndexPlusOne == 0u)
+    {
+        std::unique_lock<std::shared_mutex> writeLock(shard.mutex);
+        // someone else may have added it between the two locks
+        nameIndexPlusOne = findInShard(shard, text, slotHash);
+        if (nameIndexPlusOne == 0u)
+        {
+            if (shard.names.size() >= k_maxNamesPerShard)
+            {
+                throw std::length_error("Symbol table is full");
+            }
+
+            if ((shard.names.size() + 1u) * 4u > shard.slots.size() * 3u)
+            {
+                growSlots(shard);
+            }
+
+            shard.names.emplace_back(copyToArena(shard, text));
+            nameIndexPlusOne = static_cast<uint32_t>(shard.names.size());
+
+            const size_t slotMask = shard.slots.size() - 1u;
+            size_t slotIdx = slotHash & slotMask;
+            while (shard.slots[slotIdx].nameIndexPlusOne != 0u)
+            {
+                slotIdx = (slotIdx + 1u) & slotMask;
+            }
+            shard.slots[slotIdx] = Slot{ slotHash, nameIndexPlusOne };
+            symbolCount.fetch_add(1u, std::memory_order_relaxed);
+        }
+        recent.name = shard.names[nameIndexPlusOne - 1u];
+    }
+
+    recent.hash = hash;
+    recent.id = MakeSymbolId(nameIndexPlusOne, shardIdx);
+    return recent.id;
+}
+
+std::string_view SymbolTable::GetName(SymbolId id) const noexcept
+{
+    const Shard& shard = shards[id & (k_shardCount - 1u)];
+    const size_t nameIndexPlusOne = id >> k_shardBits;
+
+    std::shared_lock<std::shared_mutex> readLock(shard.mutex);
+    if (nameIndexPlusOne == 0u || nameIndexPlusOne > shard.names.size())
+    {
+        return std::string_view{};
+    }
+    return shard.names[nameIndexPlusOne - 1u];
+}
+
+size_t SymbolTable::Size() const noexcept
+{
+    return symbolCount.load(std::memory_order_relaxed);
+}
+
+size_t SymbolTable::MemoryUsage() const noexcept
+{
+    size_t result = 0u;
+    for (const Shard& shard : shards)
+    {
+        std::shared_lock<std::shared_mutex> readLock(shard.mutex);
+        result += shard.arenaBytes + shard.slots.capacity() * sizeof(Slot) +
+                  shard.names.capacity() * sizeof(std::string_view) +
+                  shard.arenaBlocks.capacity() * sizeof(std::unique_ptr<char[]>);
+    }
+    return result;
+}
+
+uint32_t SymbolTable::findInShard(const Shard& shard, std::string_view text, uint32_t hash) noexcept
+{
+    if (shard.slots.empty())
+    {
+        return 0u;
+    }
+
+    // never completely full, so this always hits an empty slot eventually
+    const size_t slotMask = shard.slots.size() - 1u;
+    for (size_t slotIdx = hash & slotMask; shard.slots[slotIdx].nameIndexPlusOne != 0u; slotIdx = (slotIdx + 1u) & slotMask)
+    {
+        const Slot& slot = shard.slots[slotIdx];
+        if (slot.hash == hash && shard.names[slot.nameIndexPlusOne - 1u] == text)
+        {
+            return slot.nameIndexPlusOne;
+        }
+    }
+    return 0u;
+}
+
+std::string_view SymbolTable::copyToArena(Shard& shard, std::string_view text)
+{
+    if (text.empty())
+    {
+        return std::string_view{};
+    }
+
+    // anything big enough to waste a good chunk of a block gets a block to itself,
+    // and the block we're filling stays current
+    if (text.size() > k_maxArenaBlockBytes / 4u)
+    {
+        std::unique_ptr<char[]> block = std::make_unique_for_overwrite<char[]>(text.size());
+        std::memcpy(block.get(), text.data(), text.size());
+        const std::string_view result(block.get(), text.size());
+        shard.arenaBlocks.emplace_back(std::move(block));
+        // keep the current block at the back
+        if (shard.arenaBlocks.size() > 1u)
+        {
+            std::swap(shard.arenaBlocks[shard.arenaBlocks.size() - 1u], shard.arenaBlocks[shard.arenaBlocks.size() - 2u]);
+        }
+        shard.arenaBytes += text.size();
+        return result;
+    }
+
+    if (shard.arenaBlocks.empty() || shard.arenaBlockBytes - shard.arenaBlockUsed < text.size())
+    {
+        // blocks double as the shard fills up, so small scripts don't pay for big blocks
+        shard.arenaBlockBytes = std::clamp(shard.arenaBytes, k_minArenaBlockBytes, k_maxArenaBlockBytes);
+        shard.arenaBlocks.emplace_back(std::make_unique_for_overwrite<char[]>(shard.arenaBlockBytes));
+        shard.arenaBlockUsed = 0u;
+        shard.arenaBytes += shard.arenaBlockBytes;
+    }
+
+    char* destination = shard.arenaBlocks.back().get() + shard.arenaBlockUsed;
+    std::memcpy(destination, text.data(), text.size());
+    shard.arenaBlockUsed += text.size();
+    return std::string_view(destination, text.size());
+}
+
+void SymbolTable::growSlots(Shard& shard)
+{
+    std::vector<Slot> newSlots(std::max(shard.slots.size() * 2u, k_initialSlotCount));
+    const size_t slotMask = newSlots.size() - 1u;
+    for (const Slot& slot : shard.slots)
+    {
+        if (slot.nameIndexPlusOne == 0u)
+        {
+            continue;
+        }
+
+        size_t slotIdx = slot.hash & slotMask;
+        while (newSlots[slotIdx].nameIndexPlusOne != 0u)
+        {
+            slotIdx = (slotIdx + 1u) & slotMask;
+        }
+        newSlots[slotIdx] = slot;
+    }
+    shard.slots = std::move(newSlots);
+}
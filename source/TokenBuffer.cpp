@@ -0,0 +1,179 @@
+#include "TokenBuffer.hpp"
+#include "ScanKernels.hpp"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace
+{
+    static_assert(static_cast<uint32_t>(TokenType::TokenCount) <= std::numeric_limits<uint8_t>::max(),
+        "CompactTokenBuffer stores token types in a byte");
+
+    constexpr bool HasStringPayload(const TokenType type) noexcept
+    {
+        return type == TokenType::Identifier || type == TokenType::StringLiteral || type == TokenType::CommentString;
+    }
+
+    // Same line rules as the lexer: LF, CRLF and lone CR are all one line break
+    std::vector<uint32_t> BuildLineStarts(std::string_view source)
+    {
+        std::vector<uint32_t> lineStarts{ 0u };
+        size_t position = 0u;
+        while (position < source.size())
+        {
+            position += FindLineTerminator(source.substr(position));
+            if (position == source.size())
+            {
+                // last line has no terminator, but EOF still gets a line of its own after it
+                lineStarts.emplace_back(static_cast<uint32_t>(source.size()));
+                break;
+            }
+
+            const bool isCrlf = (source[position] == '\r') &&
+                                (position + 1u < source.size()) &&
+                                (source[position + 1u] == '\n');
+            position += isCrlf ? 2u : 1u;
+            lineStarts.emplace_back(static_cast<uint32_t>(position));
+        }
+        return lineStarts;
+    }
+}
+
+CompactTokenBuffer::CompactTokenBuffer(std::string_view _source, const LoxToken* tokens, size_t numTokens) :
+    source(_source)
+{
+    if (source.size() > std::numeric_limits<uint32_t>::max())
+    {
+        throw std::length_error("CompactTokenBuffer only supports sources up to 4GB");
+    }
+
+    lineStarts = BuildLineStarts(source);
+    types.resize(numTokens);
+    offsets.resize(numTokens);
+
+    for (size_t i = 0; i < numTokens; ++i)
+    {
+        const LoxToken& token = tokens[i];
+        types[i] = static_cast<uint8_t>(token.type);
+        const size_t lineIdx = std::min(token.line, lineStarts.size() - 1u);
+        offsets[i] = lineStarts[lineIdx] + static_cast<uint32_t>(token.offset);
+
+        if (HasStringPayload(token.type))
+        {
+            payloads.emplace_back(LiteralPayload{ static_cast<uint32_t>(i), static_cast<uint32_t>(token.strLiteral.size()), token.symbol });
+        }
+        else if (token.type == TokenType::NumberLiteral)
+        {
+            payloads.emplace_back(LiteralPayload{ static_cast<uint32_t>(i), static_cast<uint32_t>(numbers.size()), k_invalidSymbolId });
+            numbers.emplace_back(token.numericLiteral);
+        }
+    }
+
+    payloads.shrink_to_fit();
+    numbers.shrink_to_fit();
+}
+
+size_t CompactTokenBuffer::Size() const noexcept
+{
+    return types.size();
+}
+
+bool CompactTokenBuffer::Empty() const noexcept
+{
+    return types.empty();
+}
+
+TokenType CompactTokenBuffer::Type(size_t idx) const noexcept
+{
+    return static_cast<TokenType>(types[idx]);
+}
+
+uint32_t CompactTokenBuffer::ByteOffset(size_t idx) const noexcept
+{
+    return offsets[idx];
+}
+
+size_t CompactTokenBuffer::Line(size_t idx) const noexcept
+{
+    return lineForOffset(offsets[idx]);
+}
+
+size_t CompactTokenBuffer::Column(size_t idx) const noexcept
+{
+    return offsets[idx] - lineStarts[lineForOffset(offsets[idx])];
+}
+
+std::string_view CompactTokenBuffer::StringLiteral(size_t idx) const noexcept
+{
+    if (!HasStringPayload(Type(idx)))
+    {
+        return std::string_view{};
+    }
+
+    const LiteralPayload* payload = findPayload(idx);
+    return source.substr(offsets[idx], payload->lengthOrNumberIdx);
+}
+
+SymbolId CompactTokenBuffer::Symbol(size_t idx) const noexcept
+{
+    if (!HasStringPayload(Type(idx)))
+    {
+        return k_invalidSymbolId;
+    }
+
+    return findPayload(idx)->symbol;
+}
+
+double CompactTokenBuffer::NumericLiteral(size_t idx) const noexcept
+{
+    if (Type(idx) != TokenType::NumberLiteral)
+    {
+        return std::numeric_limits<double>::max();
+    }
+
+    return numbers[findPayload(idx)->lengthOrNumberIdx];
+}
+
+LoxToken CompactTokenBuffer::Expand(size_t idx) const noexcept
+{
+    const TokenType type = Type(idx);
+    if (HasStringPayload(type))
+    {
+        LoxToken token(type, Line(idx), Column(idx), StringLiteral(idx));
+        token.symbol = Symbol(idx);
+        return token;
+    }
+    else if (type == TokenType::NumberLiteral)
+    {
+        return LoxToken(type, Line(idx), Column(idx), NumericLiteral(idx));
+    }
+    return LoxToken(type, Line(idx), Column(idx));
+}
+
+const uint8_t* CompactTokenBuffer::Types() const noexcept
+{
+    return types.data();
+}
+
+size_t CompactTokenBuffer::MemoryUsage() const noexcept
+{
+    return types.capacity() * sizeof(uint8_t) +
+           offsets.capacity() * sizeof(uint32_t) +
+           lineStarts.capacity() * sizeof(uint32_t) +
+           payloads.capacity() * sizeof(LiteralPayload) +
+           numbers.capacity() * sizeof(double);
+}
+
+const CompactTokenBuffer::LiteralPayload* CompactTokenBuffer::findPayload(size_t idx) const noexcept
+{
+    auto iter = std::lower_bound(payloads.begin(), payloads.end(), idx,
+        [](const LiteralPayload& payload, size_t tokenIdx) { return payload.tokenIndex < tokenIdx; });
+    return &(*iter);
+}
+
+size_t CompactTokenBuffer::lineForOffset(uint32_t offset) const noexcept
+{
+    // last line starting at or before offset
+    auto iter = std::upper_bound(lineStarts.begin(), lineStarts.end(), offset);
+    return static_cast<size_t>(std::distance(lineStarts.begin(), iter)) - 1u;
+}
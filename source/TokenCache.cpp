@@ -0,0 +1,373 @@
+#include "TokenCache.hpp"
+#include "Hash.hpp"
+#include "LoxErrors.hpp"
+#include "SymbolTable.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr std::array<char, 8> k_tokenCacheMagic{ 'L', 'O', 'X', 'T', 'O', 'K', 'C', '\0' };
+    constexpr uint64_t k_checksumSeed = 0x70CC;
+
+    struct TokenCacheHeader
+    {
+        std::array<char, 8> magic;
+        uint32_t formatVersion;
+        uint32_t headerSize;
+        uint64_t pathHash;
+        uint64_t sourceSize;
+        int64_t sourceWriteTime;
+        // LoxHash of the source, so a load can find the session without hashing it again
+        uint64_t sourceHash;
+        uint64_t tokenCount;
+        uint64_t tokensOffset;
+        uint64_t symbolCount;
+        uint64_t symbolsOffset;
+        uint64_t lineCount;
+        uint64_t lineStartsOffset;
+        // LoxHash of every field above
+        uint64_t checksum;
+    };
+
+    // 32-bit fields: sources are capped at 4GB, same as CompactTokenBuffer
+    struct TokenCacheRecord
+    {
+        uint32_t type;
+        uint32_t line;
+        uint32_t column;
+        uint32_t literalOffset;
+        uint32_t literalLength;
+        // index into the symbol records, or k_noSymbolIndex
+        uint32_t symbolIndex;
+        uint64_t numericBits;
+    };
+
+    // a name's text, by byte offset into the source
+    struct TokenCacheSymbol
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    constexpr uint32_t k_noSymbolIndex = std::numeric_limits<uint32_t>::max();
+
+    static_assert(sizeof(TokenCacheHeader) == 104u, "Token cache header layout changed: bump k_tokenCacheFormatVersion");
+    static_assert(sizeof(TokenCacheRecord) == 32u, "Token cache record layout changed: bump k_tokenCacheFormatVersion");
+    static_assert(sizeof(TokenCacheSymbol) == 8u, "Token cache symbol layout changed: bump k_tokenCacheFormatVersion");
+
+    [[noreturn]] void throwWriteFailure(const std::filesystem::path& path)
+    {
+        throw std::system_error(make_error_code(LoxCompilerErrorCode::UnableToWriteTokenCache), path.string());
+    }
+
+    TokenCacheRecord MakeRecord(const LoxToken& token, std::string_view source, const std::filesystem::path& cacheFile)
+    {
+        TokenCacheRecord record{};
+        record.type = static_cast<uint32_t>(token.type);
+        record.line = static_cast<uint32_t>(token.line);
+        record.column = static_cast<uint32_t>(token.offset);
+        record.symbolIndex = k_noSymbolIndex;
+        record.numericBits = std::bit_cast<uint64_t>(token.numericLiteral);
+
+        if (!token.strLiteral.empty())
+        {
+            // std::less gives us a total order over unrelated pointers
+            const char* literalBegin = token.strLiteral.data();
+            const bool literalInSource = !std::less<const char*>{}(literalBegin, source.data()) &&
+                                         !std::less<const char*>{}(source.data() + source.size(), literalBegin + token.strLiteral.size());
+            if (!literalInSource)
+            {
+                throwWriteFailure(cacheFile);
+            }
+            record.literalOffset = static_cast<uint32_t>(literalBegin - source.data());
+            record.literalLength = static_cast<uint32_t>(token.strLiteral.size());
+        }
+
+        return record;
+    }
+
+    // appends the raw bytes of items to payload
+    template<typename T>
+    void AppendToPayload(std::string& payload, std::span<const T> items)
+    {
+        if (!items.empty())
+        {
+            payload.append(reinterpret_cast<const char*>(items.data()), items.size_bytes());
+        }
+    }
+
+    uint64_t HeaderChecksum(const TokenCacheHeader& header) noexcept
+    {
+        return LoxHash(&header, offsetof(TokenCacheHeader, checksum), k_checksumSeed);
+    }
+
+    unsigned long long CurrentProcessId() noexcept
+    {
+#ifdef _WIN32
+        return static_cast<unsigned long long>(_getpid());
+#else
+        return static_cast<unsigned long long>(getpid());
+#endif
+    }
+}
+
+bool GetTokenCacheKey(const std::filesystem::path& sourcePath, TokenCacheKey& key)
+{
+    std::error_code statError;
+    const std::filesystem::path absolutePath = std::filesystem::absolute(sourcePath, statError).lexically_normal();
+    const uintmax_t sourceSize = std::filesystem::file_size(sourcePath, statError);
+    if (statError)
+    {
+        return false;
+    }
+    const std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(sourcePath, statError);
+    if (statError)
+    {
+        return false;
+    }
+
+    const auto& pathText = absolutePath.native();
+    key.pathHash = LoxHash(pathText.data(), pathText.size() * sizeof(std::filesystem::path::value_type));
+    key.sourceSize = static_cast<uint64_t>(sourceSize);
+    key.sourceWriteTime = static_cast<int64_t>(writeTime.time_since_epoch().count());
+    return true;
+}
+
+std::filesystem::path GetTokenCacheFilePath(const std::filesystem::path& cacheDirectory, const TokenCacheKey& key)
+{
+    char fileName[32];
+    std::snprintf(fileName, sizeof(fileName), "%016llx.loxtok", static_cast<unsigned long long>(key.pathHash));
+    return cacheDirectory / fileName;
+}
+
+void WriteTokenCacheFile(
+    const std::filesystem::path& cacheFile,
+    const TokenCacheKey& key,
+    uint64_t sourceHash,
+    std::string_view source,
+    std::span<const LoxToken> tokens,
+    std::span<const size_t> lineStarts)
+{
+    if (source.size() > std::numeric_limits<uint32_t>::max() || source.size() != key.sourceSize)
+    {
+        throwWriteFailure(cacheFile);
+    }
+
+    // each distinct name is written once, and its tokens refer to it by index
+    std::vector<TokenCacheRecord> records;
+    std::vector<TokenCacheSymbol> symbols;
+    std::unordered_map<SymbolId, uint32_t> symbolIndices;
+    records.reserve(tokens.size());
+    for (const LoxToken& token : tokens)
+    {
+        TokenCacheRecord& record = records.emplace_back(MakeRecord(token, source, cacheFile));
+        if (token.symbol != k_invalidSymbolId)
+        {
+            const auto [indexIter, inserted] = symbolIndices.try_emplace(token.symbol, static_cast<uint32_t>(symbols.size()));
+            if (inserted)
+            {
+                symbols.emplace_back(TokenCacheSymbol{ record.literalOffset, record.literalLength });
+            }
+            record.symbolIndex = indexIter->second;
+        }
+    }
+
+    std::vector<uint32_t> lineOffsets;
+    lineOffsets.reserve(lineStarts.size());
+    for (const size_t lineStart : lineStarts)
+    {
+        if (lineStart > source.size())
+        {
+            throwWriteFailure(cacheFile);
+        }
+        lineOffsets.emplace_back(static_cast<uint32_t>(lineStart));
+    }
+
+    TokenCacheHeader header{};
+    header.magic = k_tokenCacheMagic;
+    header.formatVersion = k_tokenCacheFormatVersion;
+    header.headerSize = sizeof(TokenCacheHeader);
+    header.pathHash = key.pathHash;
+    header.sourceSize = key.sourceSize;
+    header.sourceWriteTime = key.sourceWriteTime;
+    header.sourceHash = sourceHash;
+    header.tokenCount = records.size();
+    header.tokensOffset = sizeof(TokenCacheHeader);
+    header.symbolCount = symbols.size();
+    header.symbolsOffset = header.tokensOffset + records.size() * sizeof(TokenCacheRecord);
+    header.lineCount = lineOffsets.size();
+    header.lineStartsOffset = header.symbolsOffset + symbols.size() * sizeof(TokenCacheSymbol);
+    header.checksum = HeaderChecksum(header);
+
+    std::string payload;
+    payload.reserve(header.lineStartsOffset + lineOffsets.size() * sizeof(uint32_t) - header.tokensOffset);
+    AppendToPayload(payload, std::span<const TokenCacheRecord>(records));
+    AppendToPayload(payload, std::span<const TokenCacheSymbol>(symbols));
+    AppendToPayload(payload, std::span<const uint32_t>(lineOffsets));
+
+    std::error_code dirError;
+    std::filesystem::create_directories(cacheFile.parent_path(), dirError);
+
+    // unique per process and thread, so concurrent writers of the same script don't trample each other
+    std::filesystem::path tempFile = cacheFile;
+    tempFile += ".tmp" + std::to_string(CurrentProcessId()) + "-" +
+                std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+        std::ofstream output(tempFile, std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        output.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+        if (!output)
+        {
+            output.close();
+            std::filesystem::remove(tempFile, dirError);
+            throwWriteFailure(cacheFile);
+        }
+    }
+
+    std::error_code renameError;
+    std::filesystem::rename(tempFile, cacheFile, renameError);
+    if (renameError)
+    {
+        std::filesystem::remove(tempFile, dirError);
+        throwWriteFailure(cacheFile);
+    }
+}
+
+bool LoadTokenCacheFile(
+    const std::filesystem::path& cacheFile, const TokenCacheKey& key, std::string_view source, MappedTokenCache& cache)
+{
+    std::error_code existsError;
+    if (!std::filesystem::is_regular_file(cacheFile, existsError))
+    {
+        return false;
+    }
+
+    MappedFile file;
+    try
+    {
+        file = MappedFile(cacheFile);
+    }
+    catch (const std::system_error&)
+    {
+        return false;
+    }
+
+    const std::string_view fileView = file.View();
+    if (fileView.size() < sizeof(TokenCacheHeader))
+    {
+        return false;
+    }
+
+    // everything past here trusts the header, and the records only get bounds checked as they're read
+    TokenCacheHeader header;
+    std::memcpy(&header, fileView.data(), sizeof(header));
+    const bool headerValid =
+        header.magic == k_tokenCacheMagic &&
+        header.formatVersion == k_tokenCacheFormatVersion &&
+        header.headerSize == sizeof(TokenCacheHeader) &&
+        header.checksum == HeaderChecksum(header) &&
+        header.pathHash == key.pathHash &&
+        header.sourceSize == key.sourceSize &&
+        header.sourceWriteTime == key.sourceWriteTime &&
+        header.sourceSize == source.size() &&
+        header.tokensOffset == sizeof(TokenCacheHeader) &&
+        header.tokenCount <= (fileView.size() - header.tokensOffset) / sizeof(TokenCacheRecord) &&
+        header.symbolsOffset == header.tokensOffset + header.tokenCount * sizeof(TokenCacheRecord) &&
+        header.symbolCount <= (fileView.size() - header.symbolsOffset) / sizeof(TokenCacheSymbol) &&
+        header.lineStartsOffset == header.symbolsOffset + header.symbolCount * sizeof(TokenCacheSymbol) &&
+        header.lineCount == (fileView.size() - header.lineStartsOffset) / sizeof(uint32_t) &&
+        (fileView.size() - header.lineStartsOffset) % sizeof(uint32_t) == 0u;
+    if (!headerValid)
+    {
+        return false;
+    }
+
+    // ids are only good for this process, so they get handed out again on the way in,
+    // once per distinct name rather than once per token
+    std::vector<SymbolId> symbolIds(header.symbolCount);
+    const char* symbolData = fileView.data() + header.symbolsOffset;
+    for (size_t i = 0; i < symbolIds.size(); ++i)
+    {
+        TokenCacheSymbol symbol;
+        std::memcpy(&symbol, symbolData + i * sizeof(TokenCacheSymbol), sizeof(symbol));
+        if (static_cast<uint64_t>(symbol.offset) + symbol.length > source.size())
+        {
+            return false;
+        }
+        symbolIds[i] = SymbolTable::GetSymbolTableInstance().Intern(source.substr(symbol.offset, symbol.length));
+    }
+
+    cache.records = fileView.data() + header.tokensOffset;
+    cache.tokenCount = header.tokenCount;
+    cache.lineStarts = fileView.data() + header.lineStartsOffset;
+    cache.lineCount = header.lineCount;
+    cache.sourceHash = header.sourceHash;
+    cache.symbolIds = std::move(symbolIds);
+    cache.source = source;
+    cache.file = std::move(file);
+    return true;
+}
+
+TokenType MappedTokenCache::Type(size_t idx) const noexcept
+{
+    uint32_t type;
+    std::memcpy(&type, records + idx * sizeof(TokenCacheRecord) + offsetof(TokenCacheRecord, type), sizeof(type));
+    return type <= static_cast<uint32_t>(TokenType::TokenCount) ? static_cast<TokenType>(type) : TokenType::Invalid;
+}
+
+LoxToken MappedTokenCache::Token(size_t idx) const noexcept
+{
+    TokenCacheRecord record;
+    std::memcpy(&record, records + idx * sizeof(TokenCacheRecord), sizeof(record));
+
+    // a record that doesn't fit this source comes out Invalid, and the parser reports it
+    const bool recordValid =
+        record.type <= static_cast<uint32_t>(TokenType::TokenCount) &&
+        static_cast<uint64_t>(record.literalOffset) + record.literalLength <= source.size() &&
+        (record.symbolIndex == k_noSymbolIndex || record.symbolIndex < symbolIds.size());
+    if (!recordValid)
+    {
+        return LoxToken(TokenType::Invalid, record.line, record.column);
+    }
+
+    LoxToken token(static_cast<TokenType>(record.type), record.line, record.column, std::bit_cast<double>(record.numericBits));
+    if (record.literalLength != 0u)
+    {
+        token.strLiteral = source.substr(record.literalOffset, record.literalLength);
+    }
+    if (record.symbolIndex != k_noSymbolIndex)
+    {
+        token.symbol = symbolIds[record.symbolIndex];
+    }
+    return token;
+}
+
+size_t MappedTokenCache::LineStart(size_t idx) const noexcept
+{
+    uint32_t lineStart;
+    std::memcpy(&lineStart, lineStarts + idx * sizeof(uint32_t), sizeof(lineStart));
+    return std::min<size_t>(lineStart, source.size());
+}
+
+size_t MappedTokenCache::MemoryUsage() const noexcept
+{
+    return file.Size() + symbolIds.capacity() * sizeof(SymbolId);
+}
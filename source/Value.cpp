@@ -0,0 +1,135 @@
+#include "Value.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+
+namespace
+{
+    constexpr size_t k_minHeapBlockBytes = 4u * 1024u;
+    constexpr size_t k_maxHeapBlockBytes = 1024u * 1024u;
+
+    constexpr size_t AlignedStringSize(const size_t textLength) noexcept
+    {
+        // keeps the next header aligned too
+        constexpr size_t k_alignment = alignof(LoxString);
+        return (sizeof(LoxString) + textLength + k_alignment - 1u) & ~(k_alignment - 1u);
+    }
+}
+
+const LoxString* StringHeap::Make(std::string_view text)
+{
+    return Concatenate(text, std::string_view{});
+}
+
+const LoxString* StringHeap::Concatenate(std::string_view lhs, std::string_view rhs)
+{
+    const size_t length = lhs.size() + rhs.size();
+    if (length > std::numeric_limits<uint32_t>::max())
+    {
+        throw std::length_error("Lox strings are limited to 4GB");
+    }
+
+    char* storage = allocate(length);
+    LoxString* result = new (storage) LoxString(static_cast<uint32_t>(length));
+    char* chars = storage + sizeof(LoxString);
+    // memcpy with a null source is UB even for zero bytes
+    if (!lhs.empty())
+    {
+        std::memcpy(chars, lhs.data(), lhs.size());
+    }
+    if (!rhs.empty())
+    {
+        std::memcpy(chars + lhs.size(), rhs.data(), rhs.size());
+    }
+    return result;
+}
+
+char* StringHeap::allocate(size_t textLength)
+{
+    const size_t size = AlignedStringSize(textLength);
+
+    // big strings get a block to themselves, and the block we're filling stays current
+    if (size > k_maxHeapBlockBytes / 4u)
+    {
+        blocks.emplace_back(std::make_unique_for_overwrite<char[]>(size));
+        char* result = blocks.back().get();
+        // keep the current block at the back. If there isn't one, blockUsed == blockBytes == 0
+        // and the next small string starts one anyway
+        if (blocks.size() > 1u)
+        {
+            std::swap(blocks[blocks.size() - 1u], blocks[blocks.size() - 2u]);
+        }
+        bytesReserved += size;
+        return result;
+    }
+
+    if (blocks.empty() || blockBytes - blockUsed < size)
+    {
+        // blocks double as the heap fills up, so small scripts don't pay for big blocks
+        blockBytes = std::clamp(bytesReserved, k_minHeapBlockBytes, k_maxHeapBlockBytes);
+        blocks.emplace_back(std::make_unique_for_overwrite<char[]>(blockBytes));
+        blockUsed = 0u;
+        bytesReserved += blockBytes;
+    }
+
+    char* result = blocks.back().get() + blockUsed;
+    blockUsed += size;
+    return result;
+}
+
+bool ValuesEqual(const Value& lhs, const Value& rhs) noexcept
+{
+#if LOX_NAN_BOXING
+    if (lhs.IsNumber() && rhs.IsNumber())
+    {
+        return lhs.AsNumber() == rhs.AsNumber();
+    }
+    // past numbers, nil, bools and interned strings are equal exactly when their bits are
+    if (lhs.Bits() == rhs.Bits())
+    {
+        return true;
+    }
+    return lhs.IsString() && rhs.IsString() && lhs.AsString()->View() == rhs.AsString()->View();
+#else
+    if (lhs.Type() != rhs.Type())
+    {
+        return false;
+    }
+
+    switch (lhs.Type())
+    {
+    case ValueType::Nil: return true;
+    case ValueType::Bool: return lhs.AsBool() == rhs.AsBool();
+    case ValueType::Number: return lhs.AsNumber() == rhs.AsNumber();
+    case ValueType::String: return lhs.AsString() == rhs.AsString() || lhs.AsString()->View() == rhs.AsString()->View();
+    default: return false;
+    }
+#endif
+}
+
+void AppendValue(std::string& out, const Value& value)
+{
+    switch (value.Type())
+    {
+    case ValueType::Nil:
+        out += "nil";
+        break;
+    case ValueType::Bool:
+        out += value.AsBool() ? "true" : "false";
+        break;
+    case ValueType::Number:
+    {
+        // same as the book's printf("%g")
+        char buffer[32];
+        const int length = std::snprintf(buffer, sizeof(buffer), "%g", value.AsNumber());
+        out.append(buffer, static_cast<size_t>(std::max(length, 0)));
+        break;
+    }
+    case ValueType::String:
+        out += value.AsString()->View();
+        break;
+    }
+}
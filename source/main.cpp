@@ -1,4 +1,9 @@
 #include "../tests/LexerTests.hpp"
+#include "../tests/LexerBenchmarks.hpp"
+#include "../tests/ParserTests.hpp"
+#include "../tests/ParserBenchmarks.hpp"
+#include "../tests/InterpreterTests.hpp"
+#include "../tests/InterpreterBenchmarks.hpp"
 #include <iostream>
 #include <string_view>
 
@@ -8,5 +13,18 @@ int main(int argc, char* argv[])
 {
     std::string_view results = RunBasicLexerTests();
     std::cerr << results;
+    std::cerr << RunBasicParserTests();
+    std::cerr << RunBasicInterpreterTests();
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string_view(argv[i]) == "--bench")
+        {
+            std::cout << RunLexerBenchmarks();
+            std::cout << RunParserBenchmarks();
+            std::cout << RunInterpreterBenchmarks();
+        }
+    }
+
     return 0;
 }
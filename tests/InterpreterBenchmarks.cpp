@@ -0,0 +1,166 @@
+#include "InterpreterBenchmarks.hpp"
+#include "Compiler.hpp"
+#include "Diagnostics.hpp"
+#include "Interpreter.hpp"
+#include "Lexer.hpp"
+#include "Parser.hpp"
+#include "Peephole.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace
+{
+    struct ScriptBenchmark
+    {
+        std::string_view name;
+        // how many times the hot loop body runs, for the per iteration figure
+        size_t iterations;
+        const char* source;
+    };
+
+    // Fib and the counters only use locals, like a function body would. The globals loop is the
+    // same counter at the top level, so the difference is what global slots cost
+    constexpr ScriptBenchmark k_scripts[]
+    {
+        {
+            "Fib/iterative, 40 terms x 25k", 25000u * 40u,
+            "{\n"
+            "    var round = 0 ;\n"
+            "    while ( round < 25000 ) {\n"
+            "        var a = 0 ; var b = 1 ; var n = 0 ;\n"
+            "        while ( n < 40 ) { var next = a + b ; a = b ; b = next ; n = n + 1 ; }\n"
+            "        round = round + 1 ;\n"
+            "    }\n"
+            "}\n"
+        },
+        {
+            "Loop/locals", 1000000u,
+            "{\n"
+            "    var i = 0 ; var sum = 0 ;\n"
+            "    while ( i < 1000000 ) { sum = sum + i * 2 - 1 ; i = i + 1 ; }\n"
+            "}\n"
+        },
+        {
+            "Loop/globals", 1000000u,
+            "var i = 0 ;\n"
+            "var sum = 0 ;\n"
+            "while ( i < 1000000 ) { sum = sum + i * 2 - 1 ; i = i + 1 ; }\n"
+        },
+        {
+            "Loop/logic and comparisons", 1000000u,
+            "{\n"
+            "    var i = 0 ; var flag = false ;\n"
+            "    while ( i < 1000000 ) { flag = i >= 10 and i != 500 or !( i == 3 ) ; i = i + 1 ; }\n"
+            "}\n"
+        },
+        {
+            "String concat, 8 pieces x 50k", 50000u * 8u,
+            "{\n"
+            "    var round = 0 ;\n"
+            "    while ( round < 50000 ) {\n"
+            "        var line = \"\" ; var j = 0 ;\n"
+            "        while ( j < 8 ) { line = line + \"ab\" ; j = j + 1 ; }\n"
+            "        round = round + 1 ;\n"
+            "    }\n"
+            "}\n"
+        },
+    };
+
+    Chunk CompileScript(const char* source)
+    {
+        auto& lexer = Lexer::GetLexerInstance();
+        const Lexer::OutputHandle handle = lexer.ParseScript(source);
+        DiagnosticBuffer diagnostics;
+        lexer.CollectDiagnostics(handle, diagnostics);
+        Parser parser(lexer.GetTokenView(handle));
+        const Program program = parser.ParseProgram(diagnostics);
+        Compiler compiler(program);
+        Chunk chunk = compiler.Compile(diagnostics);
+        lexer.ReleaseSession(handle);
+        if (!diagnostics.Empty())
+        {
+            throw std::runtime_error("Interpreter benchmark script failed to compile!");
+        }
+        return chunk;
+    }
+
+    std::string FormatIterationLine(std::string_view name, const size_t iterations, const double seconds)
+    {
+        char buffer[160];
+        std::snprintf(buffer, sizeof(buffer), "%-44.*s | %9zu iters | best %9.3f ms | %7.2f ns/iter\n",
+            static_cast<int>(name.size()), name.data(), iterations, seconds * 1000.0, seconds * 1e9 / static_cast<double>(iterations));
+        return std::string(buffer);
+    }
+
+    double BestRunSeconds(const Chunk& chunk)
+    {
+        constexpr size_t k_runs = 5u;
+        double best = std::numeric_limits<double>::max();
+        for (size_t run = 0; run < k_runs; ++run)
+        {
+            // a fresh VM each run, so concatenated strings from the last one are gone
+            std::ostringstream output;
+            VirtualMachine vm(output);
+            DiagnosticBuffer diagnostics;
+            const auto start = std::chrono::steady_clock::now();
+            const InterpretResult result = vm.Run(chunk, diagnostics);
+            const auto end = std::chrono::steady_clock::now();
+            if (result != InterpretResult::Ok)
+            {
+                throw std::runtime_error("Interpreter benchmark script failed to run!");
+            }
+            best = std::min(best, std::chrono::duration<double>(end - start).count());
+        }
+        return best;
+    }
+}
+
+std::string RunInterpreterBenchmarks()
+{
+    std::string results("VM benchmarks (");
+    results += VirtualMachine::k_threadedDispatch ? "threaded dispatch, computed goto" : "switch dispatch";
+    results += ")\n";
+
+    // each script straight from the compiler, then after the peephole pass
+    for (const ScriptBenchmark& script : k_scripts)
+    {
+        results += FormatIterationLine(script.name, script.iterations, BestRunSeconds(CompileScript(script.source)));
+
+        Chunk optimized = CompileScript(script.source);
+        const PeepholeStats stats = OptimizeChunk(optimized);
+        std::string name(script.name);
+        name += " +peephole";
+        results += FormatIterationLine(name, script.iterations, BestRunSeconds(optimized));
+        results += "    ";
+        results += FormatPeepholeStats(stats);
+        results += "\n";
+    }
+
+    // the same scripts as a corpus for the pair profile, which is what picked the superinstructions.
+    // After the pass is what's left to pick from next time
+    OpcodePairProfile profile;
+    OpcodePairProfile optimizedProfile;
+    for (const ScriptBenchmark& script : k_scripts)
+    {
+        std::ostringstream output;
+        VirtualMachine vm(output);
+        DiagnosticBuffer diagnostics;
+        vm.RunProfiled(CompileScript(script.source), diagnostics, profile);
+
+        Chunk optimized = CompileScript(script.source);
+        OptimizeChunk(optimized);
+        vm.RunProfiled(optimized, diagnostics, optimizedProfile);
+    }
+    results += "Hottest opcode pairs across the VM benchmark scripts\n";
+    results += profile.Report(12u);
+    results += "Hottest opcode pairs after the peephole pass\n";
+    results += optimizedProfile.Report(12u);
+
+    return results;
+}
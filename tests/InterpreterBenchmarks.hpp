@@ -0,0 +1,12 @@
+#pragma once
+#ifndef LOX_INTERPRETER_BENCHMARKS_HPP
+#define LOX_INTERPRETER_BENCHMARKS_HPP
+#include <string>
+
+// VM benchmarks: tight loops over arithmetic, locals, globals and string concatenation, timed
+// on precompiled chunks so only the dispatch loop is measured. Build once with the default
+// dispatch and once with LOX_COMPUTED_GOTO=0 to compare the two. Like the other benchmarks these
+// only run with --bench. Writes out results to a string that can be printed.
+std::string RunInterpreterBenchmarks();
+
+#endif //!LOX_INTERPRETER_BENCHMARKS_HPP
@@ -0,0 +1,262 @@
+#include "InterpreterTests.hpp"
+#include "Compiler.hpp"
+#include "Diagnostics.hpp"
+#include "Interpreter.hpp"
+#include "Lexer.hpp"
+#include "Parser.hpp"
+#include "Peephole.hpp"
+#include <initializer_list>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace Helpers
+{
+    void RunProgramTest(const char* testName, const char* source, const std::string& expectedOutput)
+    {
+        std::ostringstream output;
+        DiagnosticBuffer diagnostics;
+        VirtualMachine vm(output);
+        const InterpretResult result = vm.Interpret(source, diagnostics);
+        if (result != InterpretResult::Ok || output.str() != expectedOutput || !diagnostics.Empty())
+        {
+            std::cout << testName << " expected output:\n" << expectedOutput << "got:\n" << output.str() <<
+                "with " << diagnostics.Size() << " diagnostics\n";
+            throw std::runtime_error(std::string(testName) + " test failed!");
+        }
+
+        std::cout << testName << " test succeeded!\n";
+    }
+
+    // Anything printed before the error still has to come out. expectedLexeme is only checked if given
+    void RunErrorTest(const char* testName, const char* source, const InterpretResult expectedResult,
+        const LoxCompilerErrorCode expectedError, const size_t expectedLine, const std::string& expectedOutput,
+        const char* expectedLexeme = nullptr)
+    {
+        std::ostringstream output;
+        DiagnosticBuffer diagnostics;
+        VirtualMachine vm(output);
+        const InterpretResult result = vm.Interpret(source, diagnostics);
+        if (result != expectedResult || diagnostics.Size() != 1u || output.str() != expectedOutput ||
+            diagnostics.Diagnostics()[0].errorCode != expectedError || diagnostics.Diagnostics()[0].line != expectedLine ||
+            (expectedLexeme != nullptr && diagnostics.Diagnostics()[0].lexeme != expectedLexeme))
+        {
+            std::cout << testName << " expected code " << static_cast<int>(expectedError) << " on line " << expectedLine <<
+                ", got " << diagnostics.Size() << " diagnostics\n";
+            for (const LoxDiagnostic& diagnostic : diagnostics.Diagnostics())
+            {
+                std::cout << "    code " << static_cast<int>(diagnostic.errorCode) << " on line " << diagnostic.line <<
+                    " at '" << diagnostic.lexeme << "'\n";
+            }
+            throw std::runtime_error(std::string(testName) + " test failed!");
+        }
+
+        std::cout << testName << " test succeeded! Got: " << make_error_code(expectedError).message() << "\n";
+    }
+
+    // opaque to the optimizer, so the NaN gets made at runtime
+    double Zero()
+    {
+        static volatile double zero = 0.0;
+        return zero;
+    }
+
+    Chunk CompileSource(const char* source)
+    {
+        auto& lexer = Lexer::GetLexerInstance();
+        const Lexer::OutputHandle handle = lexer.ParseScript(source);
+        DiagnosticBuffer diagnostics;
+        Parser parser(lexer.GetTokenView(handle));
+        const Program program = parser.ParseProgram(diagnostics);
+        Compiler compiler(program);
+        Chunk chunk = compiler.Compile(diagnostics);
+        lexer.ReleaseSession(handle);
+        if (!diagnostics.Empty())
+        {
+            throw std::runtime_error("Compiling test source failed!");
+        }
+        return chunk;
+    }
+
+    // The optimized chunk has to print exactly what the compiler's did, and use the superinstructions
+    // it's expected to
+    void RunPeepholeTest(const char* testName, const char* source, std::initializer_list<const char*> expectedOpCodes)
+    {
+        const auto runChunk = [](const Chunk& chunk)
+        {
+            std::ostringstream output;
+            DiagnosticBuffer diagnostics;
+            VirtualMachine vm(output);
+            if (vm.Run(chunk, diagnostics) != InterpretResult::Ok)
+            {
+                throw std::runtime_error("Running peephole test chunk failed!");
+            }
+            return output.str();
+        };
+
+        const std::string expectedOutput = runChunk(CompileSource(source));
+        Chunk chunk = CompileSource(source);
+        const PeepholeStats stats = OptimizeChunk(chunk);
+        const std::string listing = DisassembleChunk(chunk, testName);
+        const std::string gotOutput = runChunk(chunk);
+        bool missingOpCode = false;
+        for (const char* opCode : expectedOpCodes)
+        {
+            missingOpCode |= listing.find(opCode) == std::string::npos;
+        }
+        if (gotOutput != expectedOutput || missingOpCode || stats.bytesAfter >= stats.bytesBefore)
+        {
+            std::cout << testName << " expected output:\n" << expectedOutput << "got:\n" << gotOutput << listing <<
+                FormatPeepholeStats(stats) << "\n";
+            throw std::runtime_error(std::string(testName) + " test failed!");
+        }
+
+        std::cout << testName << " test succeeded! " << FormatPeepholeStats(stats) << "\n";
+    }
+}
+
+std::string_view RunBasicInterpreterTests()
+{
+    Helpers::RunProgramTest("Arithmetic", "print 1 + 2 * 3 - 4 / 2 ;\nprint -( 1 + 2 ) * 2.5 ;\n", "5\n-7.5\n");
+    Helpers::RunProgramTest("String concatenation",
+        "var greeting = \"hello\" ;\nprint greeting + \" \" + \"world\" ;\nprint greeting == \"hel\" + \"lo\" ;\n",
+        "hello world\ntrue\n");
+    Helpers::RunProgramTest("Globals and locals",
+        "var a = 1 ;\n"
+        "{ var b = a + 1 ; { var c = b * 10 ; print c + a ; } print b ; }\n"
+        "var a = a + 5 ;\n"
+        "print a ;\n",
+        "21\n2\n6\n");
+    Helpers::RunProgramTest("Logical operators",
+        "var empty = nil ;\n"
+        "print empty or \"default\" ;\n"
+        "print empty and missing ;\n"
+        "print 1 == 1 and !( 2 != 2 ) ;\n"
+        "print 0 or 1 ;\n",
+        "default\nnil\ntrue\n0\n");
+    // keywords straight after keywords, which the lexer used to turn away
+    Helpers::RunProgramTest("Keyword literals",
+        "print true ;\n"
+        "print nil ;\n"
+        "print true and false ;\n"
+        "print 1 or 2 ;\n"
+        "print false or nil ;\n"
+        "var a = 1 ;\n"
+        "print a and false ;\n",
+        "true\nnil\nfalse\n1\nnil\nfalse\n");
+    Helpers::RunProgramTest("Assignment and while loops",
+        "var total = 0 ;\n"
+        "var i = 0 ;\n"
+        "while ( i < 5 ) { total = total + i ; i = i + 1 ; }\n"
+        "print total ;\n"
+        "{\n"
+        "    var a = 1 ; var b = 1 ; var n = 2 ;\n"
+        "    while ( n <= 10 ) { var next = a + b ; a = b ; b = next ; n = n + 1 ; }\n"
+        "    print b ;\n"
+        "    print a = b = \"shared\" ;\n"
+        "    print a + b ;\n"
+        "}\n"
+        "while ( i >= 5 and i > 100 ) print \"never\" ;\n",
+        "10\n89\nshared\nsharedshared\n");
+    Helpers::RunProgramTest("Double precision and NaN",
+        "print 16777217 - 16777216 ;\n"
+        "var nan = 0 / 0 ;\n"
+        "print nan == nan ;\n"
+        "print -nan != -nan ;\n"
+        "print !nan ;\n",
+        "1\nfalse\ntrue\nfalse\n");
+
+    // NaNs the FPU makes, of either sign, have to stay numbers and not alias a tag or a pointer
+    StringHeap heap;
+    const LoxString* text = heap.Make("boxed");
+    const Value nan = Value::Number(0.0 / Helpers::Zero());
+    const Value negativeNan = Value::Number(-nan.AsNumber());
+    const bool valuesValid =
+        nan.IsNumber() && negativeNan.IsNumber() && !nan.IsFalsey() && !ValuesEqual(nan, nan) &&
+        Value::Nil().IsFalsey() && Value::Bool(false).IsFalsey() && !Value::Bool(true).IsFalsey() &&
+        Value::Bool(false).IsBool() && !Value::Nil().IsBool() && Value::Bool(true).AsBool() &&
+        Value::String(text).IsString() && Value::String(text).AsString() == text &&
+        !Value::String(text).IsNumber() && !Value::String(text).IsFalsey() &&
+        ValuesEqual(Value::String(text), Value::String(heap.Make("boxed"))) &&
+        Value::Number(-0.0).IsNumber() && ValuesEqual(Value::Number(-0.0), Value::Number(0.0));
+    if (!valuesValid)
+    {
+        throw std::runtime_error("Value encoding test failed!");
+    }
+    std::cout << "Value encoding test succeeded! Values are " << sizeof(Value) << " bytes\n";
+
+    Helpers::RunErrorTest("Negating a string", "print 1 ;\nprint -\"a\" ;\n", InterpretResult::RuntimeError,
+        LoxCompilerErrorCode::OperandMustBeNumber, 1u, "1\n");
+    Helpers::RunErrorTest("Adding mixed operands", "var a = \"a\" ;\n\nprint a + 1 ;\n", InterpretResult::RuntimeError,
+        LoxCompilerErrorCode::OperandsMustBeNumbersOrStrings, 2u, "");
+    Helpers::RunErrorTest("Undefined variable", "print undefinedName ;\n", InterpretResult::RuntimeError,
+        LoxCompilerErrorCode::UndefinedVariable, 0u, "", "undefinedName");
+    // the lexer session is gone by the time Interpret returns, the diagnostic's lexeme can't be
+    Helpers::RunErrorTest("Parse error lexeme", "var unique_name_xyz = 1 ;\nprint 1 unique_name_xyz ;\n", InterpretResult::CompileError,
+        LoxCompilerErrorCode::ExpectedTokenNotFound, 1u, "", "unique_name_xyz");
+    Helpers::RunErrorTest("Assigning an undeclared global", "print 1 ;\nmissing = 2 ;\n", InterpretResult::RuntimeError,
+        LoxCompilerErrorCode::UndefinedVariable, 1u, "1\n");
+    Helpers::RunErrorTest("Comparing a string", "var s = \"a\" ;\nwhile ( s < 1 ) s = 1 ;\n", InterpretResult::RuntimeError,
+        LoxCompilerErrorCode::OperandsMustBeNumbers, 1u, "");
+    Helpers::RunErrorTest("Local in its own initializer", "{ var a = a ; }\n", InterpretResult::CompileError,
+        LoxCompilerErrorCode::LocalInOwnInitializer, 0u, "");
+    Helpers::RunErrorTest("Redeclared local", "{\nvar a = 1 ;\nvar a = 2 ;\n}\n", InterpretResult::CompileError,
+        LoxCompilerErrorCode::VariableAlreadyDeclared, 2u, "");
+
+    // repeated literals share a constant, and both locals come off in one instruction at the end of the block
+    const Chunk chunk = Helpers::CompileSource("{ var a = 3 ; var b = 3 ; print a + b ; }\n");
+    const std::string listing = DisassembleChunk(chunk, "block");
+    if (chunk.Constants().size() != 1u || listing.find("PopN") == std::string::npos || chunk.MaxStackDepth() != 4u)
+    {
+        std::cout << listing;
+        throw std::runtime_error("Chunk layout test failed!");
+    }
+    std::cout << "Chunk layout test succeeded!\n";
+    // Interpret folds constants first, which mustn't change what comes out
+    Helpers::RunProgramTest("Folded constants", "print -0 ;\nprint ( -0 ) + 0 ;\nprint \"con\" + \"cat\" ;\nprint 0 / 0 == 0 / 0 ;\n"
+        "print 1 / 0 * 1 ;\n", "-0\n0\nconcat\nfalse\ninf\n");
+    Helpers::RunErrorTest("Folding keeps type errors", "print 1 ;\nprint \"a\" * 1 ;\n", InterpretResult::RuntimeError,
+        LoxCompilerErrorCode::OperandsMustBeNumbers, 1u, "1\n");
+    Helpers::RunErrorTest("Folding keeps negation errors", "{\nvar s = \"a\" ;\nprint -s * 1 ;\n}\n", InterpretResult::RuntimeError,
+        LoxCompilerErrorCode::OperandMustBeNumber, 2u, "");
+
+    Helpers::RunPeepholeTest("Peephole on a counting loop",
+        "{\nvar i = 0 ; var sum = 0 ;\nwhile ( i < 10 ) { sum = sum + i ; i = i + 1 ; }\nprint sum ;\nprint i ;\n}\n",
+        { "JumpIfNotLess", "AddLocalConstant", "SetLocalPop" });
+    Helpers::RunPeepholeTest("Peephole on globals and logic",
+        "var n = 0 ;\nvar hits = 0 ;\nwhile ( n <= 6 ) {\nn >= 3 and n != 5 or n == 0 ;\nhits = hits + 1 ;\nn = n + 1 ;\n}\n"
+        "print hits ;\nprint n >= 3 and n != 5 ;\n",
+        { "PopJumpIfFalse", "SetGlobalPop" });
+    // the pushes that only get popped go, and the jump over them still lands where it should
+    Helpers::RunPeepholeTest("Peephole on dead pushes",
+        "{\nvar a = 2 ;\n1 ;\na ;\na and false ;\nwhile ( a < 4 ) { a ; a = a + 1 ; }\nprint a ;\n}\n",
+        { "JumpIfNotLess" });
+    Helpers::RunPeepholeTest("Peephole on string concat",
+        "{\nvar s = \"a\" ; var j = 0 ;\nwhile ( j < 3 ) { s = s + \"b\" ; j = j + 1 ; }\nprint s ;\n}\n",
+        { "AddLocalConstant" });
+    Helpers::RunErrorTest("Fused add of nil", "{\nvar a = nil ;\na = a + 1 ;\n}\n", InterpretResult::RuntimeError,
+        LoxCompilerErrorCode::OperandsMustBeNumbersOrStrings, 2u, "");
+    Helpers::RunErrorTest("Fused compare of a string", "{\nvar a = \"x\" ;\nprint 1 ;\nwhile ( a < 1 ) { a = 1 ; }\n}\n",
+        InterpretResult::RuntimeError, LoxCompilerErrorCode::OperandsMustBeNumbers, 3u, "1\n");
+
+    // every pair that runs gets counted once, Return included
+    {
+        std::ostringstream output;
+        DiagnosticBuffer diagnostics;
+        VirtualMachine vm(output);
+        OpcodePairProfile profile;
+        vm.RunProfiled(Helpers::CompileSource("print 1 ;\n"), diagnostics, profile);
+        if (profile.TotalPairs() != 2u || profile.Count(OpCode::Constant, OpCode::Print) != 1u ||
+            profile.Count(OpCode::Print, OpCode::Return) != 1u || output.str() != "1\n")
+        {
+            std::cout << profile.Report(4u);
+            throw std::runtime_error("Opcode pair profile test failed!");
+        }
+        std::cout << "Opcode pair profile test succeeded!\n";
+    }
+
+    std::cout << "Interpreter tests ran with " << (VirtualMachine::k_threadedDispatch ? "threaded" : "switch") << " dispatch\n";
+
+    return std::string_view{};
+}
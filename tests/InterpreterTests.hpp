@@ -0,0 +1,10 @@
+#pragma once
+#ifndef LOX_INTERPRETER_TESTS_HPP
+#define LOX_INTERPRETER_TESTS_HPP
+#include <string_view>
+
+// Compiles and runs small programs on the VM, checking what they print and which errors
+// they stop with. Writes out results to a string that can be printed.
+std::string_view RunBasicInterpreterTests();
+
+#endif //!LOX_INTERPRETER_TESTS_HPP
@@ -0,0 +1,394 @@
+#include "LexerBenchmarks.hpp"
+#include "Hash.hpp"
+#include "Lexer.hpp"
+#include "MurmurHash.hpp"
+#include "Token.hpp"
+#include "TokenBuffer.hpp"
+#include "ScanKernels.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+    // Lines cycled through to build the benchmark corpus. Kept free of lexer errors,
+    // so we measure the happy path the way our generated scripts exercise it
+    constexpr std::array<std::string_view, 8> k_corpusLines
+    {
+        "var someIdentifier_0 = 123.5 + otherIdentifier * 42 ;",
+        "print \"a string literal of fairly typical length for a data definition\";",
+        "// a comment describing what the next few lines are meant to be doing",
+        "someIdentifier_0 = someIdentifier_0 / 2 - (otherIdentifier * 3 );",
+        "if (someIdentifier_0 == otherIdentifier) { print someIdentifier_0; }",
+        "while (!finished) { counter = counter + 1 ; finished = counter != 10 ; }",
+        "var Test_Value_2 = \"Test!\";",
+        "fun computeThings(a, b) { return a * b + 0.5 ; }",
+    };
+
+    // Data-definition style source: mostly long string literals and comments,
+    // which is where the vectorized skipping kernels should earn their keep
+    constexpr std::array<std::string_view, 4> k_dataDefinitionLines
+    {
+        "// material definitions exported from the asset pipeline, do not edit these by hand please",
+        "var materialDescription_0 = \"brushed aluminium with a slight anisotropic highlight along the grain direction\";",
+        "var materialTextureSet_0 = \"textures/metals/aluminium/brushed_aluminium_albedo_roughness_metallic_normal.ktx2\";",
+        "print \"loaded material definitions for the current scene, continuing with the next set of entries\";",
+    };
+
+    template<size_t N>
+    std::string GenerateBenchmarkSource(const std::array<std::string_view, N>& lines, const size_t targetBytes)
+    {
+        std::string result;
+        result.reserve(targetBytes + 128u);
+        size_t lineIdx = 0u;
+        while (result.size() < targetBytes)
+        {
+            result += lines[lineIdx % lines.size()];
+            result += '\n';
+            ++lineIdx;
+        }
+        return result;
+    }
+
+    struct ThroughputResult
+    {
+        double bestSeconds = 0.0;
+        size_t numTokens = 0u;
+    };
+
+    // lexFn runs one full lex and returns the resulting handle
+    template<typename LexFn>
+    ThroughputResult MeasureLexing(const size_t iterations, LexFn&& lexFn)
+    {
+        auto& lexer = Lexer::GetLexerInstance();
+        ThroughputResult result;
+        result.bestSeconds = std::numeric_limits<double>::max();
+
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            Lexer::OutputHandle handle = lexFn();
+            const auto end = std::chrono::steady_clock::now();
+
+            const double seconds = std::chrono::duration<double>(end - start).count();
+            result.bestSeconds = std::min(result.bestSeconds, seconds);
+            result.numTokens = lexer.GetTokenView(handle).Size();
+            // same source every iteration: release so the next one actually lexes, instead of
+            // finding the old session, and so big sources don't pile up in memory
+            lexer.ReleaseSession(handle);
+        }
+
+        return result;
+    }
+
+    ThroughputResult MeasureParseScript(const std::string& source, const size_t iterations)
+    {
+        return MeasureLexing(iterations, [&source]() { return Lexer::GetLexerInstance().ParseScript(source); });
+    }
+
+    // The kind of pass a parser makes when it only cares about structure: tracks brace/paren
+    // nesting and counts statements, looking at nothing but token types
+    struct TypeOnlyPassResult
+    {
+        size_t maxNesting = 0u;
+        size_t statementCount = 0u;
+    };
+
+    template<typename TypeAt>
+    TypeOnlyPassResult RunTypeOnlyPass(const size_t numTokens, TypeAt&& typeAt)
+    {
+        TypeOnlyPassResult result;
+        size_t nesting = 0u;
+        for (size_t i = 0; i < numTokens; ++i)
+        {
+            switch (typeAt(i))
+            {
+            case TokenType::LeftParen:
+            case TokenType::LeftBrace:
+                result.maxNesting = std::max(result.maxNesting, ++nesting);
+                break;
+            case TokenType::RightParen:
+            case TokenType::RightBrace:
+                nesting -= nesting != 0u ? 1u : 0u;
+                break;
+            case TokenType::Semicolon:
+                ++result.statementCount;
+                break;
+            default:
+                break;
+            }
+        }
+        return result;
+    }
+
+    // Hashes keySize-byte keys laid out back to back (so most of them start unaligned) until
+    // about k_bytesPerPass bytes have gone through, and reports the best pass
+    template<typename HashFn>
+    std::string MeasureHash(std::string_view name, const std::string& keyPool, const size_t keySize, HashFn&& hashFn)
+    {
+        constexpr size_t k_bytesPerPass = 64u << 20u;
+        constexpr size_t k_passes = 5u;
+        const size_t keysInPool = (keyPool.size() - keySize) / (keySize + 1u) + 1u;
+        const size_t hashesPerPass = std::max<size_t>(k_bytesPerPass / keySize, 1u);
+
+        double bestSeconds = std::numeric_limits<double>::max();
+        // stops the hashing from being optimized away entirely
+        volatile uint64_t sink = 0u;
+        for (size_t pass = 0; pass < k_passes; ++pass)
+        {
+            uint64_t combined = 0u;
+            size_t keyIdx = 0u;
+            const auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < hashesPerPass; ++i)
+            {
+                combined += hashFn(keyPool.data() + keyIdx * (keySize + 1u), keySize);
+                keyIdx = (keyIdx + 1u == keysInPool) ? 0u : keyIdx + 1u;
+            }
+            const auto end = std::chrono::steady_clock::now();
+            sink = sink + combined;
+            bestSeconds = std::min(bestSeconds, std::chrono::duration<double>(end - start).count());
+        }
+
+        const double nanosecondsPerHash = bestSeconds * 1e9 / static_cast<double>(hashesPerPass);
+        const double gigabytesPerSecond = static_cast<double>(hashesPerPass * keySize) / bestSeconds / (1024.0 * 1024.0 * 1024.0);
+        char buffer[128];
+        std::snprintf(buffer, sizeof(buffer), "%-16.*s | %8zu B keys | %9.2f ns/hash | %7.2f GB/s\n",
+            static_cast<int>(name.size()), name.data(), keySize, nanosecondsPerHash, gigabytesPerSecond);
+        return std::string(buffer);
+    }
+
+    std::string FormatThroughputLine(std::string_view name, const size_t numBytes, const ThroughputResult& result)
+    {
+        constexpr double k_bytesPerMegabyte = 1024.0 * 1024.0;
+        const double megabytes = static_cast<double>(numBytes) / k_bytesPerMegabyte;
+        char buffer[256];
+        std::snprintf(buffer, sizeof(buffer), "%-32.*s | %8.2f MB | best %9.3f ms | %8.2f MB/s | %zu tokens\n",
+            static_cast<int>(name.size()), name.data(), megabytes, result.bestSeconds * 1000.0,
+            megabytes / result.bestSeconds, result.numTokens);
+        return std::string(buffer);
+    }
+
+}
+
+std::string RunLexerBenchmarks()
+{
+    // scan time should grow linearly with size, so MB/s should hold steady across these
+    constexpr std::array<size_t, 3> k_sourceSizes{ 1u << 20u, 10u << 20u, 100u << 20u };
+    constexpr std::array<size_t, 3> k_sourceSizeIterations{ 5u, 3u, 1u };
+    constexpr size_t k_iterations = 5u;
+
+    std::string results("Lexer benchmarks (bytes/sec through Lexer::ParseScript)\n");
+    std::array<double, k_sourceSizes.size()> secondsPerSize{};
+    for (size_t i = 0; i < k_sourceSizes.size(); ++i)
+    {
+        const std::string source = GenerateBenchmarkSource(k_corpusLines, k_sourceSizes[i]);
+        const ThroughputResult throughput = MeasureParseScript(source, k_sourceSizeIterations[i]);
+        secondsPerSize[i] = throughput.bestSeconds;
+        results += FormatThroughputLine("ParseScript", source.size(), throughput);
+    }
+
+    char scalingLine[128];
+    std::snprintf(scalingLine, sizeof(scalingLine), "Scaling 1 MB -> 100 MB: %.1fx the time for 100x the input\n",
+        secondsPerSize.back() / secondsPerSize.front());
+    results += scalingLine;
+
+    // Parallel lexing over the largest source. Speedup is relative to a single thread
+    const std::string parallelSource = GenerateBenchmarkSource(k_corpusLines, k_sourceSizes.back());
+    double singleThreadSeconds = 0.0;
+    for (const size_t threadCount : { 1u, 2u, 4u, 8u, 16u })
+    {
+        const ThroughputResult throughput = MeasureLexing(k_sourceSizeIterations.back(), [&parallelSource, threadCount]()
+        {
+            return Lexer::GetLexerInstance().ParseScriptParallel(parallelSource, threadCount);
+        });
+        singleThreadSeconds = threadCount == 1u ? throughput.bestSeconds : singleThreadSeconds;
+
+        char name[64];
+        std::snprintf(name, sizeof(name), "Parallel/%zu threads (%.2fx)", threadCount, singleThreadSeconds / throughput.bestSeconds);
+        results += FormatThroughputLine(name, parallelSource.size(), throughput);
+    }
+
+    // Same data-definition source through each kernel level the CPU supports
+    const ScanKernelLevel initialLevel = GetActiveScanKernelLevel();
+    const std::string dataDefinitionSource = GenerateBenchmarkSource(k_dataDefinitionLines, k_sourceSizes[1]);
+    for (uint32_t level = 0u; level <= static_cast<uint32_t>(GetSupportedScanKernelLevel()); ++level)
+    {
+        SetScanKernelLevel(static_cast<ScanKernelLevel>(level));
+        const ThroughputResult throughput = MeasureParseScript(dataDefinitionSource, k_iterations);
+        std::string name = "DataDefinitions/";
+        name += ScanKernelLevelToString(static_cast<ScanKernelLevel>(level));
+        results += FormatThroughputLine(name, dataDefinitionSource.size(), throughput);
+    }
+    SetScanKernelLevel(initialLevel);
+
+    // Loading from disk: reading the file into a string first, versus lexing straight over a mapping
+    const std::filesystem::path scriptPath = std::filesystem::temp_directory_path() / "lox_lexer_benchmark.lox";
+    {
+        std::ofstream scriptFile(scriptPath, std::ios::binary | std::ios::trunc);
+        scriptFile << dataDefinitionSource;
+    }
+
+    const ThroughputResult readThroughput = MeasureLexing(k_iterations, [&scriptPath]()
+    {
+        std::ifstream scriptFile(scriptPath, std::ios::binary);
+        std::string source(static_cast<size_t>(std::filesystem::file_size(scriptPath)), '\0');
+        scriptFile.read(source.data(), static_cast<std::streamsize>(source.size()));
+        return Lexer::GetLexerInstance().ParseScript(std::move(source));
+    });
+    results += FormatThroughputLine("ReadFile+ParseScript", dataDefinitionSource.size(), readThroughput);
+
+    const ThroughputResult mappedThroughput = MeasureLexing(k_iterations, [&scriptPath]()
+    {
+        return Lexer::GetLexerInstance().ParseFile(scriptPath);
+    });
+    results += FormatThroughputLine("ParseFile", dataDefinitionSource.size(), mappedThroughput);
+
+    // Cold start with a warm on-disk token cache: map the cache file instead of lexing
+    const std::filesystem::path cacheDirectory = std::filesystem::temp_directory_path() / "lox_lexer_benchmark_cache";
+    Lexer::GetLexerInstance().ReleaseSession(Lexer::GetLexerInstance().ParseFileCached(scriptPath, cacheDirectory));
+    const ThroughputResult cachedFileThroughput = MeasureLexing(k_iterations, [&scriptPath, &cacheDirectory]()
+    {
+        return Lexer::GetLexerInstance().ParseFileCached(scriptPath, cacheDirectory);
+    });
+    results += FormatThroughputLine("ParseFileCached/warm cache", dataDefinitionSource.size(), cachedFileThroughput);
+    // the above only maps the cache file. Anything that wants LoxTokens, like the parser, expands the records too
+    const ThroughputResult expandedFileThroughput = MeasureLexing(k_iterations, [&scriptPath, &cacheDirectory]()
+    {
+        const Lexer::OutputHandle handle = Lexer::GetLexerInstance().ParseFileCached(scriptPath, cacheDirectory);
+        Lexer::GetLexerInstance().GetTokenView(handle).Tokens();
+        return handle;
+    });
+    results += FormatThroughputLine("ParseFileCached/warm + expand", dataDefinitionSource.size(), expandedFileThroughput);
+    std::filesystem::remove_all(cacheDirectory);
+    std::filesystem::remove(scriptPath);
+
+    // Same source pushed through a StreamingLexer in 64 KB chunks, as if it were coming off a pipe
+    constexpr size_t k_streamChunkSize = 64u << 10u;
+    ThroughputResult streamThroughput;
+    streamThroughput.bestSeconds = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < k_iterations; ++i)
+    {
+        size_t numStreamedTokens = 0u;
+        const auto start = std::chrono::steady_clock::now();
+        StreamingLexer streamingLexer([&numStreamedTokens](const LoxToken*, size_t numTokens) { numStreamedTokens += numTokens; });
+        const std::string_view sourceView(dataDefinitionSource);
+        for (size_t offset = 0u; offset < sourceView.size(); offset += k_streamChunkSize)
+        {
+            streamingLexer.Feed(sourceView.substr(offset, k_streamChunkSize));
+        }
+        streamingLexer.Finish();
+        const auto end = std::chrono::steady_clock::now();
+
+        streamThroughput.bestSeconds = std::min(streamThroughput.bestSeconds, std::chrono::duration<double>(end - start).count());
+        streamThroughput.numTokens = numStreamedTokens;
+    }
+    results += FormatThroughputLine("StreamingLexer/64KB", dataDefinitionSource.size(), streamThroughput);
+
+    // Re-lexing a script the lexer already has: only the copy in, the hash and a compare
+    const std::string cachedSource = GenerateBenchmarkSource(k_corpusLines, k_sourceSizes[1]);
+    const Lexer::OutputHandle cachedHandle = Lexer::GetLexerInstance().ParseScript(cachedSource);
+    ThroughputResult cachedThroughput;
+    cachedThroughput.bestSeconds = std::numeric_limits<double>::max();
+    cachedThroughput.numTokens = Lexer::GetLexerInstance().GetTokenView(cachedHandle).Size();
+    for (size_t i = 0; i < k_iterations; ++i)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const Lexer::OutputHandle handle = Lexer::GetLexerInstance().ParseScript(cachedSource);
+        const auto end = std::chrono::steady_clock::now();
+        cachedThroughput.bestSeconds = std::min(cachedThroughput.bestSeconds, std::chrono::duration<double>(end - start).count());
+        // every hit takes its own hold on the session, which has to be given back
+        Lexer::GetLexerInstance().ReleaseSession(handle);
+    }
+    results += FormatThroughputLine("ParseScript/cached", cachedSource.size(), cachedThroughput);
+    // let go before editing, or our hold would keep the in place edits below from ever happening
+    Lexer::GetLexerInstance().ReleaseSession(cachedHandle);
+
+    // Typing lines into the middle of the same source, one ApplyEdit per line. Holding a view on the
+    // previous session means its block list gets copied, otherwise the blocks get spliced in place.
+    // Either way only the block being typed into gets scanned again
+    const LoxSourceEdit edit{ cachedSource.find('\n', cachedSource.size() / 2u) + 1u, 0u, "var typedIn = 42 ;\n" };
+    for (const bool holdPreviousView : { true, false })
+    {
+        auto& lexer = Lexer::GetLexerInstance();
+        Lexer::OutputHandle editHandle = lexer.ParseScript(cachedSource);
+        ThroughputResult editThroughput;
+        editThroughput.bestSeconds = std::numeric_limits<double>::max();
+        for (size_t i = 0; i < k_iterations; ++i)
+        {
+            const TokenView previousView = holdPreviousView ? lexer.GetTokenView(editHandle) : TokenView{};
+            const auto start = std::chrono::steady_clock::now();
+            editHandle = lexer.ApplyEdit(editHandle, edit);
+            const auto end = std::chrono::steady_clock::now();
+            editThroughput.bestSeconds = std::min(editThroughput.bestSeconds, std::chrono::duration<double>(end - start).count());
+        }
+        editThroughput.numTokens = lexer.GetTokenView(editHandle).Size();
+        results += FormatThroughputLine(holdPreviousView ? "ApplyEdit/copy" : "ApplyEdit/in place", cachedSource.size(), editThroughput);
+        lexer.ReleaseSession(editHandle);
+    }
+
+    std::string editedSource = cachedSource;
+    editedSource.insert(edit.offset, edit.replacement);
+    results += FormatThroughputLine("ParseScript/after edit", editedSource.size(), MeasureParseScript(editedSource, k_iterations));
+
+    // Type-only walk over the regular 10 MB corpus, full LoxTokens versus the compact buffer
+    auto& lexer = Lexer::GetLexerInstance();
+    const std::string walkSource = GenerateBenchmarkSource(k_corpusLines, k_sourceSizes[1]);
+    const Lexer::OutputHandle walkHandle = lexer.ParseScript(walkSource);
+    const TokenView walkTokens = lexer.GetTokenView(walkHandle);
+    const size_t numWalkTokens = walkTokens.Size();
+    const CompactTokenBuffer compactWalkTokens = lexer.GetCompactTokensForHandle(walkHandle);
+
+    auto measureWalk = [&walkSource, numWalkTokens](std::string_view name, const size_t storageBytes, auto&& typeAt)
+    {
+        ThroughputResult walkThroughput;
+        walkThroughput.bestSeconds = std::numeric_limits<double>::max();
+        walkThroughput.numTokens = numWalkTokens;
+        // stops the walk from being optimized away entirely
+        volatile size_t sink = 0u;
+        for (size_t i = 0; i < k_iterations; ++i)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            const TypeOnlyPassResult passResult = RunTypeOnlyPass(numWalkTokens, typeAt);
+            const auto end = std::chrono::steady_clock::now();
+            sink = sink + passResult.maxNesting + passResult.statementCount;
+            walkThroughput.bestSeconds = std::min(walkThroughput.bestSeconds, std::chrono::duration<double>(end - start).count());
+        }
+
+        char storageLine[96];
+        std::snprintf(storageLine, sizeof(storageLine), "    storage: %zu bytes (%.1f bytes/token)\n",
+            storageBytes, static_cast<double>(storageBytes) / static_cast<double>(numWalkTokens));
+        return FormatThroughputLine(name, walkSource.size(), walkThroughput) + storageLine;
+    };
+
+    results += measureWalk("TypeOnlyPass/LoxToken", walkTokens.Size() * sizeof(LoxToken),
+        [&walkTokens](size_t idx) { return walkTokens[idx].type; });
+    const uint8_t* compactTypes = compactWalkTokens.Types();
+    results += measureWalk("TypeOnlyPass/CompactTokenBuffer", compactWalkTokens.MemoryUsage(),
+        [compactTypes](size_t idx) { return static_cast<TokenType>(compactTypes[idx]); });
+    lexer.ReleaseSession(walkHandle);
+
+    // Hashing: identifier-sized keys up to whole-script-sized ones
+    results += "Hash benchmarks (LoxHash against the MurmurHash functions it replaced)\n";
+    std::string keyPool(8u << 20u, '\0');
+    std::mt19937_64 keyRandom(0x10C5);
+    std::generate(keyPool.begin(), keyPool.end(), [&keyRandom]() { return static_cast<char>(keyRandom()); });
+    constexpr std::array<size_t, 8> k_hashKeySizes{ 3u, 8u, 15u, 32u, 64u, 256u, 4096u, 1u << 20u };
+    for (const size_t keySize : k_hashKeySizes)
+    {
+        results += MeasureHash("MurmurHash2", keyPool, keySize,
+            [](const char* key, size_t len) { return MurmurHash2(key, len, 1u); });
+        results += MeasureHash("MurmurHash3", keyPool, keySize,
+            [](const char* key, size_t len) { return MurmurHash3(key, len, 1u).low; });
+        results += MeasureHash("LoxHash", keyPool, keySize,
+            [](const char* key, size_t len) { return LoxHash(key, len, 1u); });
+    }
+
+    return results;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#ifndef LOX_LEXER_BENCHMARKS_HPP
+#define LOX_LEXER_BENCHMARKS_HPP
+#include <string>
+
+// Scanner throughput benchmarks, run over generated Lox source. These chew through
+// megabytes of input so they're not part of the default test run: pass --bench to main.
+// Writes out results to a string that can be printed.
+std::string RunLexerBenchmarks();
+
+#endif //!LOX_LEXER_BENCHMARKS_HPP
@@ -1,16 +1,28 @@
 #include "LexerTests.hpp"
+#include "Diagnostics.hpp"
+#include "Hash.hpp"
 #include "LoxErrors.hpp"
 #include "Token.hpp"
 #include "Lexer.hpp"
+#include "ScanKernels.hpp"
+#include "SymbolTable.hpp"
+#include "TokenBuffer.hpp"
 #include "Utility.hpp"
 #include <format>
+#include <span>
 #include <sstream>
 #include <vector>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <fstream>
 #include <algorithm>
 #include <iostream>
 #include <unordered_map>
 #include <string>
+#include <thread>
 
 /*
 
@@ -51,7 +63,7 @@ std::array<LoxToken, 11> VarsAndLiteralsTestTokens
     LoxToken{ TokenType::Var, 1, 0 },
     LoxToken{ TokenType::Identifier, 1, 4, TestValue0_ },
     LoxToken{ TokenType::Equal, 1, 16 },
-    LoxToken{ TokenType::NumberLiteral, 1, 18, 1.234f },
+    LoxToken{ TokenType::NumberLiteral, 1, 18, 1.234 },
     LoxToken{ TokenType::Semicolon, 1, 23 },
     LoxToken{ TokenType::Var, 2, 0 },
     LoxToken{ TokenType::Identifier, 2, 4, Test_Value_2 },
@@ -61,11 +73,83 @@ std::array<LoxToken, 11> VarsAndLiteralsTestTokens
     LoxToken{ TokenType::EndOfFile, 3, 0 }
 };
 
+const char* KeywordsTestSource =
+R"(
+class Breakfast {}
+fun cook() { return cook; }
+)";
+
+static const std::string Breakfast("Breakfast");
+static const std::string cook("cook");
+std::array<LoxToken, 14> KeywordsTestTokens
+{
+    LoxToken{ TokenType::Class, 1, 0 },
+    LoxToken{ TokenType::Identifier, 1, 6, Breakfast },
+    LoxToken{ TokenType::LeftBrace, 1, 16 },
+    LoxToken{ TokenType::RightBrace, 1, 17 },
+    LoxToken{ TokenType::Fun, 2, 0 },
+    LoxToken{ TokenType::Identifier, 2, 4, cook },
+    LoxToken{ TokenType::LeftParen, 2, 8 },
+    LoxToken{ TokenType::RightParen, 2, 9 },
+    LoxToken{ TokenType::LeftBrace, 2, 11 },
+    LoxToken{ TokenType::Return, 2, 13 },
+    LoxToken{ TokenType::Identifier, 2, 20, cook },
+    LoxToken{ TokenType::Semicolon, 2, 24 },
+    LoxToken{ TokenType::RightBrace, 2, 26 },
+    LoxToken{ TokenType::EndOfFile, 3, 0 },
+};
+
+// mixes CRLF, lone CR and LF line endings: each should count as exactly one line
+const char* MixedLineEndingsTestSource = "\r\nvar a = 1 ;\r\n\rprint a;\n";
+
+static const std::string a("a");
+std::array<LoxToken, 9> MixedLineEndingsTestTokens
+{
+    LoxToken{ TokenType::Var, 1, 0 },
+    LoxToken{ TokenType::Identifier, 1, 4, a },
+    LoxToken{ TokenType::Equal, 1, 6 },
+    LoxToken{ TokenType::NumberLiteral, 1, 8, 1.0 },
+    LoxToken{ TokenType::Semicolon, 1, 10 },
+    LoxToken{ TokenType::Print, 3, 0 },
+    LoxToken{ TokenType::Identifier, 3, 6, a },
+    LoxToken{ TokenType::Semicolon, 3, 7 },
+    LoxToken{ TokenType::EndOfFile, 4, 0 },
+};
+
+const char* MappedFileTestSource =
+R"(
+var fromFile = "mapped";
+)";
+
+static const std::string fromFile("fromFile");
+static const std::string mapped("mapped");
+std::array<LoxToken, 6> MappedFileTestTokens
+{
+    LoxToken{ TokenType::Var, 1, 0 },
+    LoxToken{ TokenType::Identifier, 1, 4, fromFile },
+    LoxToken{ TokenType::Equal, 1, 13 },
+    LoxToken{ TokenType::StringLiteral, 1, 16, mapped },
+    LoxToken{ TokenType::Semicolon, 1, 23 },
+    LoxToken{ TokenType::EndOfFile, 2, 0 },
+};
+
+// short enough to fit in a std::string's inline buffer
+const char* ShortTestSource = "print \"hi\";\n";
+
+static const std::string hi("hi");
+std::array<LoxToken, 4> ShortTestTokens
+{
+    LoxToken{ TokenType::Print, 0, 0 },
+    LoxToken{ TokenType::StringLiteral, 0, 7, hi },
+    LoxToken{ TokenType::Semicolon, 0, 10 },
+    LoxToken{ TokenType::EndOfFile, 1, 0 },
+};
+
 const char* BrokenErrorHandlingTestSource =
 R"(
 var BrokenStrLiteral = "Test!;
 var BrokenNumericLiteral = 1.23,4;
-var while = 3;
+var BrokenAgain = "Test!;
 )";
 
 
@@ -81,7 +165,9 @@ namespace Helpers
         const bool basicMembersMatch = (lhs.type == rhs.type) && (lhs.line == rhs.line) && (lhs.offset == rhs.offset);
         const bool strLiteralMatch = lhs.strLiteral == rhs.strLiteral;
         const bool numLiteralMatch = lhs.numericLiteral == rhs.numericLiteral;
-        return basicMembersMatch && strLiteralMatch && numLiteralMatch;
+        // the known-good arrays don't carry symbols, ids depend on what got interned first
+        const bool symbolMatch = lhs.symbol == rhs.symbol || lhs.symbol == k_invalidSymbolId || rhs.symbol == k_invalidSymbolId;
+        return basicMembersMatch && strLiteralMatch && numLiteralMatch && symbolMatch;
     }
 
     std::string GetTokenString(const size_t idx, const LoxToken& token)
@@ -95,7 +181,7 @@ namespace Helpers
         {
             result += "String Value: " + std::string(token.strLiteral);
         }
-        else if (token.numericLiteral != std::numeric_limits<float>::max())
+        else if (token.numericLiteral != std::numeric_limits<double>::max())
         {
             result += "Numeric Value: " + std::to_string(token.numericLiteral);
         }
@@ -192,12 +278,751 @@ namespace Helpers
         case LoxCompilerErrorCode::TestFailTokenPositionMismatch:
             return std::string("Mismatch in parsed position of token from runtime vs known-good position of token");
         case LoxCompilerErrorCode::TestFailTokenContentMismatch:
-            return std::string("Mismatch in stored content of string or float token, between parsed runtime tokens and known-good stored value");
+            return std::string("Mismatch in stored content of string or numeric token, between parsed runtime tokens and known-good stored value");
         default:
             return std::string("Invalid test code??");
         }
     }
 
+    // Checks tokens against knownGoodTokens, printing the tokens on success.
+    // Throws on failure, same as the hand-written tests below
+    template<size_t N>
+    void CheckTokens(const char* testName, const char* source, std::span<const LoxToken> tokens, const std::array<LoxToken, N>& knownGoodTokens)
+    {
+        auto mismatchIter = std::mismatch(knownGoodTokens.begin(), knownGoodTokens.end(), tokens.begin(), tokens.end(), TokenComparator);
+        if (mismatchIter.first == knownGoodTokens.end() && mismatchIter.second == tokens.end())
+        {
+            std::cout << testName << " test succeeded!\n";
+            std::cout << "Input source code:\n";
+            std::cout << source << "\n";
+            std::cout << "Result tokens from source code:\n";
+            std::cout << GetLoxTokensString(tokens.size(), tokens.data()) << "\n";
+        }
+        else
+        {
+            const size_t testFailPos = std::distance(knownGoodTokens.begin(), mismatchIter.first);
+            // if one side ran out early, compare against a default token so we still get a count mismatch message
+            const LoxToken knownGood = mismatchIter.first != knownGoodTokens.end() ? *mismatchIter.first : LoxToken{};
+            const LoxToken runtime = mismatchIter.second != tokens.end() ? *mismatchIter.second : LoxToken{};
+            auto testFailure = HandleTestFailure(knownGood, knownGoodTokens.size(), runtime, tokens.size(), testFailPos);
+            std::cout << ErrorCodeMessage(testFailure.errorCode) << ',';
+            std::cout << testFailure.message << '\n';
+            throw std::runtime_error(std::string(testName) + " test failed!");
+        }
+    }
+
+    // Like CheckTokens, for when the known-good tokens come from another lexing path at runtime
+    void CheckTokensMatch(const char* testName, std::span<const LoxToken> knownGoodTokens, std::span<const LoxToken> tokens)
+    {
+        auto mismatchIter = std::mismatch(knownGoodTokens.begin(), knownGoodTokens.end(), tokens.begin(), tokens.end(), TokenComparator);
+        if (mismatchIter.first != knownGoodTokens.end() || mismatchIter.second != tokens.end())
+        {
+            const size_t testFailPos = std::distance(knownGoodTokens.begin(), mismatchIter.first);
+            const LoxToken knownGood = mismatchIter.first != knownGoodTokens.end() ? *mismatchIter.first : LoxToken{};
+            const LoxToken runtime = mismatchIter.second != tokens.end() ? *mismatchIter.second : LoxToken{};
+            auto testFailure = HandleTestFailure(knownGood, knownGoodTokens.size(), runtime, tokens.size(), testFailPos);
+            std::cout << ErrorCodeMessage(testFailure.errorCode) << ',';
+            std::cout << testFailure.message << '\n';
+            throw std::runtime_error(std::string(testName) + " test failed!");
+        }
+    }
+
+    template<size_t N>
+    void CheckTokenStream(const char* testName, const char* source, const Lexer::OutputHandle handle, const std::array<LoxToken, N>& knownGoodTokens)
+    {
+        const TokenView tokens = Lexer::GetLexerInstance().GetTokenView(handle);
+        CheckTokens(testName, source, tokens.Tokens(), knownGoodTokens);
+    }
+
+    template<size_t N>
+    void RunTokenStreamTest(const char* testName, const char* source, const std::array<LoxToken, N>& knownGoodTokens)
+    {
+        Lexer::OutputHandle handle = Lexer::GetLexerInstance().ParseScript(source);
+        CheckTokenStream(testName, source, handle, knownGoodTokens);
+    }
+
+    // Same as above, but goes through a temporary file and Lexer::ParseFile
+    template<size_t N>
+    void RunMappedFileTokenStreamTest(const char* testName, const char* source, const std::array<LoxToken, N>& knownGoodTokens)
+    {
+        const std::filesystem::path scriptPath = std::filesystem::temp_directory_path() / "lox_mapped_file_test.lox";
+        {
+            std::ofstream scriptFile(scriptPath, std::ios::binary | std::ios::trunc);
+            scriptFile << source;
+        }
+
+        Lexer::OutputHandle handle = Lexer::GetLexerInstance().ParseFile(scriptPath);
+        CheckTokenStream(testName, source, handle, knownGoodTokens);
+        std::filesystem::remove(scriptPath);
+    }
+
+    // Lexes source, packs the session into a CompactTokenBuffer and checks that expanding it
+    // back out gives the same tokens, line numbers included
+    template<size_t N>
+    void RunCompactTokenBufferTest(const char* testName, const char* source, const std::array<LoxToken, N>& knownGoodTokens)
+    {
+        auto& lexer = Lexer::GetLexerInstance();
+        Lexer::OutputHandle handle = lexer.ParseScript(source);
+        const CompactTokenBuffer compactTokens = lexer.GetCompactTokensForHandle(handle);
+
+        std::vector<LoxToken> tokens;
+        tokens.reserve(compactTokens.Size());
+        for (size_t i = 0; i < compactTokens.Size(); ++i)
+        {
+            tokens.emplace_back(compactTokens.Expand(i));
+        }
+
+        CheckTokens(testName, source, tokens, knownGoodTokens);
+    }
+
+    // Views have to keep working after the session is released, and the handle has to stop
+    // resolving. Use a short source: small strings live inline, so this also catches a
+    // session being moved out from under its own token views
+    template<size_t N>
+    void RunReleasedSessionViewTest(const char* testName, const char* source, const std::array<LoxToken, N>& knownGoodTokens)
+    {
+        auto& lexer = Lexer::GetLexerInstance();
+        Lexer::OutputHandle handle = lexer.ParseScript(source);
+        const TokenView tokens = lexer.GetTokenView(handle);
+        if (!lexer.ReleaseSession(handle) || lexer.GetTokenView(handle) || lexer.ReleaseSession(handle))
+        {
+            throw std::runtime_error(std::string(testName) + " test failed, session wasn't released!");
+        }
+
+        CheckTokens(testName, source, tokens.Tokens(), knownGoodTokens);
+    }
+
+    // Lexing the same source twice should hand back the first session instead of rescanning
+    void RunSessionCacheTest()
+    {
+        auto& lexer = Lexer::GetLexerInstance();
+        const std::string source = "var cachedScript = \"cache me\";\n";
+        const SessionStoreMetrics initialMetrics = Lexer::GetSessionStoreMetrics();
+
+        const Lexer::OutputHandle firstHandle = lexer.ParseScript(source);
+        const TokenView firstTokens = lexer.GetTokenView(firstHandle);
+        const Lexer::OutputHandle secondHandle = lexer.ParseScript(source);
+        const TokenView secondTokens = lexer.GetTokenView(secondHandle);
+
+        const SessionStoreMetrics metrics = Lexer::GetSessionStoreMetrics();
+        const bool sameSession = (firstHandle == secondHandle) && (firstTokens.Tokens().data() == secondTokens.Tokens().data());
+        const bool countersMatch = (metrics.cacheHits == initialMetrics.cacheHits + 1u) &&
+                                   (metrics.cacheMisses == initialMetrics.cacheMisses + 1u);
+        if (!sameSession || !countersMatch)
+        {
+            throw std::runtime_error("Session cache test failed!");
+        }
+
+        // each ParseScript took its own hold, so one release can't pull the session out from under the other
+        lexer.ReleaseSession(firstHandle);
+        const bool stillHeld = !lexer.GetTokenView(secondHandle).Empty();
+        const bool lastRelease = lexer.ReleaseSession(secondHandle);
+        if (!stillHeld || !lastRelease || lexer.ReleaseSession(secondHandle) || lexer.GetTokenView(secondHandle))
+        {
+            throw std::runtime_error("Session cache holder test failed!");
+        }
+
+        // and an edit through one holder leaves the other's session alone
+        const Lexer::OutputHandle editorHandle = lexer.ParseScript(source);
+        const Lexer::OutputHandle readerHandle = lexer.ParseScript(source);
+        const Lexer::OutputHandle editedHandle = lexer.ApplyEdit(editorHandle, LoxSourceEdit{ 0u, 0u, "var edited = 1 ;\n" });
+        const TokenView readerTokens = lexer.GetTokenView(readerHandle);
+        if (readerTokens.Empty() || readerTokens[1].strLiteral != "cachedScript" || lexer.GetTokenView(editedHandle)[1].strLiteral != "edited")
+        {
+            throw std::runtime_error("Session cache edit test failed!");
+        }
+        lexer.ReleaseSession(readerHandle);
+        lexer.ReleaseSession(editedHandle);
+
+        std::cout << "Session cache test succeeded!\n";
+    }
+
+    // Workers lexing the same script at once share one handle, each with its own hold: however the
+    // releases interleave, nobody's view of the tokens can go empty before they're done
+    void RunSharedSessionRaceTest()
+    {
+        constexpr size_t k_threads = 8u;
+        constexpr size_t k_rounds = 2000u;
+        const std::string source = "var sharedScript = 1 ;\nprint sharedScript ;\n";
+        std::atomic<size_t> failures{ 0u };
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < k_threads; ++t)
+        {
+            workers.emplace_back([&source, &failures]()
+            {
+                auto& lexer = Lexer::GetLexerInstance();
+                for (size_t round = 0; round < k_rounds; ++round)
+                {
+                    const Lexer::OutputHandle handle = lexer.ParseScript(source);
+                    if (lexer.GetTokenView(handle).Size() != 9u)
+                    {
+                        ++failures;
+                    }
+                    lexer.ReleaseSession(handle);
+                }
+            });
+        }
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+
+        if (failures != 0u)
+        {
+            throw std::runtime_error("Shared session race test failed!");
+        }
+        std::cout << "Shared session race test succeeded!\n";
+    }
+
+    // LoxHash has to give the same answer at compile time as at run time, or a table built in a
+    // constexpr initializer won't find anything. Covers every length through the short path
+    // and all three loops of the long one, from unaligned starts
+    void RunHashTest()
+    {
+        constexpr size_t k_maxKeyLength = 160u;
+        static constexpr auto k_keyBytes = []()
+        {
+            std::array<char, k_maxKeyLength + 1u> bytes{};
+            for (size_t i = 0; i < bytes.size(); ++i)
+            {
+                bytes[i] = static_cast<char>(i * 37u + 11u);
+            }
+            return bytes;
+        }();
+        static constexpr auto k_compileTimeHashes = []()
+        {
+            std::array<uint64_t, k_maxKeyLength + 1u> hashes{};
+            for (size_t len = 0; len < hashes.size(); ++len)
+            {
+                hashes[len] = LoxHash(k_keyBytes.data() + 1u, len, 0x1234u);
+            }
+            return hashes;
+        }();
+        static_assert(LoxHash("while") != LoxHash("whilf") && LoxHash("") != LoxHash("", 1u), "LoxHash should separate near-miss keys and seeds");
+
+        // runtime copy, so the compiler can't just evaluate these at compile time too
+        const std::vector<char> runtimeKeyBytes(k_keyBytes.begin(), k_keyBytes.end());
+        for (size_t len = 0; len < k_compileTimeHashes.size(); ++len)
+        {
+            if (LoxHash(runtimeKeyBytes.data() + 1u, len, 0x1234u) != k_compileTimeHashes[len])
+            {
+                throw std::runtime_error("Hash test failed at length " + std::to_string(len) + "!");
+            }
+        }
+
+        std::cout << "Hash test succeeded!\n";
+    }
+
+    // Identifiers with the same text have to share a symbol, everything else gets none, string
+    // literals included. Then several threads intern the same names in different orders and have to agree on the ids
+    void RunSymbolTableTest()
+    {
+        auto& lexer = Lexer::GetLexerInstance();
+        auto& symbols = SymbolTable::GetSymbolTableInstance();
+        const char* source = "var first = \"first\";\nvar second = first;\nprint \"first\";\n";
+        const TokenView tokens = lexer.GetTokenView(lexer.ParseScript(source));
+
+        bool symbolsValid = tokens.Size() == 14u;
+        for (const LoxToken& token : tokens)
+        {
+            const bool isIdentifier = token.type == TokenType::Identifier;
+            symbolsValid &= isIdentifier ? symbols.GetName(token.symbol) == token.strLiteral : token.symbol == k_invalidSymbolId;
+        }
+        // first, first
+        symbolsValid &= tokens[1].symbol == tokens[8].symbol;
+
+        // only names grow the table, however many different strings go by
+        const size_t symbolCountBefore = symbols.Size();
+        lexer.ReleaseSession(lexer.ParseScript("print \"never interned 1\" + \"never interned 2\";\n"));
+        symbolsValid &= symbols.Size() == symbolCountBefore;
+        symbolsValid &= tokens[6].symbol != tokens[1].symbol && tokens[6].symbol == symbols.Intern("second");
+
+        constexpr size_t k_threadCount = 4u;
+        constexpr size_t k_namesPerThread = 4096u;
+        std::array<std::vector<SymbolId>, k_threadCount> threadIds;
+        auto internNames = [&symbols, &threadIds](const size_t threadIdx)
+        {
+            std::vector<SymbolId>& ids = threadIds[threadIdx];
+            ids.resize(k_namesPerThread);
+            for (size_t i = 0; i < k_namesPerThread; ++i)
+            {
+                // odd threads go backwards, so threads race to add the same names
+                const size_t nameIdx = (threadIdx & 1u) ? (k_namesPerThread - 1u - i) : i;
+                ids[nameIdx] = symbols.Intern("symbolTableTestName" + std::to_string(nameIdx));
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t threadIdx = 1u; threadIdx < k_threadCount; ++threadIdx)
+        {
+            workers.emplace_back(internNames, threadIdx);
+        }
+        internNames(0u);
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+
+        for (size_t i = 0; i < k_namesPerThread; ++i)
+        {
+            const SymbolId id = threadIds[0][i];
+            symbolsValid &= id != k_invalidSymbolId && symbols.GetName(id) == "symbolTableTestName" + std::to_string(i);
+            for (size_t threadIdx = 1u; threadIdx < k_threadCount; ++threadIdx)
+            {
+                symbolsValid &= threadIds[threadIdx][i] == id;
+            }
+        }
+
+        if (!symbolsValid || !symbols.GetName(k_invalidSymbolId).empty())
+        {
+            throw std::runtime_error("Symbol table test failed!");
+        }
+
+        std::cout << "Symbol table test succeeded! " << symbols.Size() << " symbols, " << symbols.MemoryUsage() << " bytes\n";
+    }
+
+    // Lexes from several threads at once with a session budget of one per shard, so inserts,
+    // lookups and evictions all race each other. A session can get evicted by another thread
+    // before we look at it, but any view we do get has to hold the right tokens
+    void RunConcurrentSessionStoreTest()
+    {
+        constexpr size_t k_threadCount = 4u;
+        constexpr size_t k_scriptsPerThread = 256u;
+        Lexer::SetSessionStoreLimits(LexerSessionStore::k_shardCount, 0u);
+        const SessionStoreMetrics initialMetrics = Lexer::GetSessionStoreMetrics();
+
+        std::atomic<size_t> failures{ 0u };
+        auto lexScripts = [&failures](const size_t threadIdx)
+        {
+            auto& lexer = Lexer::GetLexerInstance();
+            for (size_t i = 0; i < k_scriptsPerThread; ++i)
+            {
+                const size_t scriptNumber = threadIdx * k_scriptsPerThread + i;
+                const std::string source = "var scriptNumber = " + std::to_string(scriptNumber) + " ;\n";
+                const TokenView tokens = lexer.GetTokenView(lexer.ParseScript(source));
+                if (tokens.Empty())
+                {
+                    continue;
+                }
+
+                const bool tokensMatch = tokens.Size() == 6u &&
+                    tokens[1].strLiteral == "scriptNumber" &&
+                    tokens[3].numericLiteral == static_cast<double>(scriptNumber);
+                failures += tokensMatch ? 0u : 1u;
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t threadIdx = 1u; threadIdx < k_threadCount; ++threadIdx)
+        {
+            workers.emplace_back(lexScripts, threadIdx);
+        }
+        lexScripts(0u);
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+
+        const SessionStoreMetrics metrics = Lexer::GetSessionStoreMetrics();
+        std::cout << "Concurrent session store test: " << metrics.liveSessions << " live sessions, " << metrics.bytesHeld <<
+            " bytes held, " << (metrics.evictions - initialMetrics.evictions) << " evictions, " << metrics.symbolCount <<
+            " symbols in " << metrics.symbolTableBytes << " bytes\n";
+        if (failures != 0u || metrics.liveSessions > LexerSessionStore::k_shardCount || metrics.evictions == initialMetrics.evictions)
+        {
+            throw std::runtime_error("Concurrent session store test failed!");
+        }
+
+        std::cout << "Concurrent session store test succeeded!\n";
+        Lexer::SetSessionStoreLimits(1024u, 1024u * 1024u * 1024u);
+    }
+
+    // ParseFileCached over and over: cold (lexes and writes the cache), warm (reads tokens out of the
+    // cache file), with the cache file's header corrupted and with the script rewritten since (both
+    // have to notice, and lex again). Tokens have to match every time
+    template<size_t N>
+    void RunTokenCacheFileTest(const char* testName, const char* source, const std::array<LoxToken, N>& knownGoodTokens)
+    {
+        const std::filesystem::path cacheDirectory = std::filesystem::temp_directory_path() / "lox_token_cache_test";
+        const std::filesystem::path scriptPath = std::filesystem::temp_directory_path() / "lox_token_cache_test.lox";
+        std::filesystem::remove_all(cacheDirectory);
+        {
+            std::ofstream scriptFile(scriptPath, std::ios::binary | std::ios::trunc);
+            scriptFile << source;
+        }
+
+        auto& lexer = Lexer::GetLexerInstance();
+        auto parseAndCheck = [&](const char* stage, const bool expectMapped)
+        {
+            const Lexer::OutputHandle handle = lexer.ParseFileCached(scriptPath, cacheDirectory);
+            const std::string stageName = std::string(testName) + " (" + stage + ")";
+            const TokenView tokens = lexer.GetTokenView(handle);
+            // read a record straight out of the mapping before anything expands them
+            if (tokens.Mapped() != expectMapped || tokens.Size() != knownGoodTokens.size() ||
+                !TokenComparator(tokens.Token(1u), knownGoodTokens[1u]))
+            {
+                throw std::runtime_error(stageName + " test failed, token cache wasn't used as expected!");
+            }
+            CheckTokens(stageName.c_str(), source, tokens.Tokens(), knownGoodTokens);
+            // drop it, so the next round can't just come out of the in-memory cache
+            lexer.ReleaseSession(handle);
+        };
+
+        // an earlier test may still hold this same source, which would keep the cold run from touching
+        // the disk. Every hold is released separately, so drop them all
+        const Lexer::OutputHandle earlierHandle = lexer.ParseFile(scriptPath);
+        while (lexer.ReleaseSession(earlierHandle))
+        {
+        }
+        parseAndCheck("cold", false);
+        std::vector<std::filesystem::path> cacheFiles;
+        for (const auto& entry : std::filesystem::directory_iterator(cacheDirectory))
+        {
+            cacheFiles.emplace_back(entry.path());
+        }
+        if (cacheFiles.size() != 1u)
+        {
+            throw std::runtime_error(std::string(testName) + " test failed, no cache file was written!");
+        }
+
+        parseAndCheck("warm", true);
+
+        // line starts come out of the cache file rather than a rescan, and editing goes by them
+        {
+            const std::string_view sourceView(source);
+            const size_t lastLineStart = sourceView.find_last_of('\n', sourceView.size() - 2u) + 1u;
+            const LoxSourceEdit edit{ lastLineStart, 0u, "print 1 ;\n" };
+            std::string editedSource(sourceView.substr(0u, lastLineStart));
+            editedSource += edit.replacement;
+            editedSource += sourceView.substr(lastLineStart);
+
+            std::vector<LoxToken> expectedTokens;
+            StreamingLexer streamingLexer([&expectedTokens](const LoxToken* tokens, size_t numTokens)
+            {
+                expectedTokens.insert(expectedTokens.end(), tokens, tokens + numTokens);
+            });
+            streamingLexer.Feed(editedSource);
+            streamingLexer.Finish();
+
+            const Lexer::OutputHandle editedHandle = lexer.ApplyEdit(lexer.ParseFileCached(scriptPath, cacheDirectory), edit);
+            const std::string stageName = std::string(testName) + " (warm, edited)";
+            CheckTokensMatch(stageName.c_str(), expectedTokens, lexer.GetTokenView(editedHandle).Tokens());
+            lexer.ReleaseSession(editedHandle);
+        }
+
+        {
+            std::fstream cacheFile(cacheFiles.front(), std::ios::binary | std::ios::in | std::ios::out);
+            cacheFile.seekp(40);
+            cacheFile.put('#');
+        }
+        parseAndCheck("corrupted", false);
+        parseAndCheck("rewritten cache", true);
+
+        // same size and same tokens, but a newer write time: nothing to tell it apart but the stat
+        {
+            std::ofstream scriptFile(scriptPath, std::ios::binary | std::ios::trunc);
+            scriptFile << source;
+        }
+        std::filesystem::last_write_time(scriptPath, std::filesystem::last_write_time(scriptPath) + std::chrono::hours(1));
+        parseAndCheck("script rewritten", false);
+        parseAndCheck("script rewritten, warm", true);
+
+        std::filesystem::remove_all(cacheDirectory);
+        std::filesystem::remove(scriptPath);
+    }
+
+    // Applies edit to source's session with Lexer::ApplyEdit, and checks the result against lexing the
+    // edited source from scratch with a StreamingLexer. Then undoes the edit, with nothing else holding
+    // the session so it happens in place and keeps its handle, and checks we get the original tokens back
+    template<size_t N>
+    void RunIncrementalEditTest(const char* testName, const char* source, const std::array<LoxToken, N>& knownGoodTokens, const LoxSourceEdit& edit)
+    {
+        auto& lexer = Lexer::GetLexerInstance();
+        const std::string_view sourceView(source);
+        std::string editedSource(sourceView.substr(0u, edit.offset));
+        editedSource += edit.replacement;
+        editedSource += sourceView.substr(edit.offset + edit.removedLength);
+
+        std::vector<LoxToken> expectedTokens;
+        StreamingLexer streamingLexer([&expectedTokens](const LoxToken* tokens, size_t numTokens)
+        {
+            expectedTokens.insert(expectedTokens.end(), tokens, tokens + numTokens);
+        });
+        streamingLexer.Feed(editedSource);
+        streamingLexer.Finish();
+
+        const Lexer::OutputHandle editedHandle = lexer.ApplyEdit(lexer.ParseScript(source), edit);
+        CheckTokensMatch(testName, expectedTokens, lexer.GetTokenView(editedHandle).Tokens());
+
+        const std::string removedText(sourceView.substr(edit.offset, edit.removedLength));
+        const LoxSourceEdit undoEdit{ edit.offset, edit.replacement.size(), removedText };
+        const Lexer::OutputHandle restoredHandle = lexer.ApplyEdit(editedHandle, undoEdit);
+        if (restoredHandle != editedHandle)
+        {
+            throw std::runtime_error(std::string(testName) + " test failed! The in place edit changed handles");
+        }
+        CheckTokens(testName, source, lexer.GetTokenView(restoredHandle).Tokens(), knownGoodTokens);
+        lexer.ReleaseSession(restoredHandle);
+    }
+
+    // Types a run of edits into a script big enough to be split into many blocks: across block
+    // boundaries, a lone CR turning into CRLF, strings left open and closed again. After each one
+    // the tokens read through the view have to match a fresh scan, and so do the diagnostics
+    void RunBlockEditTest()
+    {
+        auto& lexer = Lexer::GetLexerInstance();
+        // a line ending on a lone CR right where the first 16KB block ends
+        std::string source;
+        while (source.size() + 12u < (16u << 10u))
+        {
+            source += "var a = 1 ;\n";
+        }
+        source.append((16u << 10u) - 1u - source.size(), ' ');
+        source += '\r';
+        const size_t blockEnd = source.size();
+        source += "print 2 ;\n";
+        while (source.size() < (128u << 10u))
+        {
+            source += VarsAndLiteralsTestSource;
+            source += "print 1 ;\r";
+        }
+
+        auto freshScan = [](std::string_view text, size_t& errorCount)
+        {
+            std::vector<LoxToken> freshTokens;
+            StreamingLexer streamingLexer([&freshTokens](const LoxToken* tokens, size_t numTokens)
+            {
+                freshTokens.insert(freshTokens.end(), tokens, tokens + numTokens);
+            });
+            streamingLexer.Feed(text);
+            streamingLexer.Finish();
+            errorCount = streamingLexer.ErrorCount();
+            return freshTokens;
+        };
+
+        const std::array<LoxSourceEdit, 6> edits{
+            LoxSourceEdit{ blockEnd, 0u, "\n" },
+            LoxSourceEdit{ source.size() / 3u, 0u, "var opened = \"" },
+            LoxSourceEdit{ 0u, 40u, "" },
+            LoxSourceEdit{ source.size() / 4u, source.size() / 4u, "var joined = 1 ;\n" },
+            LoxSourceEdit{ source.size() / 3u, 0u, "\" ;\n" },
+            LoxSourceEdit{ 10u, 0u, std::string_view(VarsAndLiteralsTestSource) },
+        };
+
+        std::string editedSource = source;
+        Lexer::OutputHandle handle = lexer.ParseScript(source);
+        for (size_t i = 0; i < edits.size(); ++i)
+        {
+            const LoxSourceEdit& edit = edits[i];
+            editedSource.replace(edit.offset, edit.removedLength, edit.replacement);
+            const Lexer::OutputHandle editedHandle = lexer.ApplyEdit(handle, edit);
+            if (i != 0u && editedHandle != handle)
+            {
+                throw std::runtime_error("Block edit test failed! The in place edit changed handles");
+            }
+            handle = editedHandle;
+
+            size_t expectedErrorCount = 0u;
+            const std::vector<LoxToken> expectedTokens = freshScan(editedSource, expectedErrorCount);
+            const TokenView tokens = lexer.GetTokenView(handle);
+            std::vector<LoxToken> viewTokens;
+            for (size_t tokenIdx = 0; tokenIdx < tokens.Size(); ++tokenIdx)
+            {
+                viewTokens.emplace_back(tokens.Token(tokenIdx));
+            }
+            CheckTokensMatch("Block edit", expectedTokens, viewTokens);
+
+            DiagnosticBuffer diagnostics;
+            if (lexer.CollectDiagnostics(handle, diagnostics) != expectedErrorCount)
+            {
+                throw std::runtime_error("Block edit test failed! Diagnostics don't match a fresh scan");
+            }
+        }
+
+        // and laid out flat, with the views pointing into the session's own copy of the source
+        size_t expectedErrorCount = 0u;
+        CheckTokensMatch("Block edit, expanded", freshScan(editedSource, expectedErrorCount), lexer.GetTokenView(handle).Tokens());
+        lexer.ReleaseSession(handle);
+        std::cout << "Block edit test succeeded!\n";
+    }
+
+    // Lexes a few MB with ParseScriptParallel and checks it against the serial result, which we
+    // get from a StreamingLexer since ParseScript would just hand back the same session
+    void RunParallelMatchesSerialTest()
+    {
+        std::string source;
+        while (source.size() < (2u << 20u))
+        {
+            source += VarsAndLiteralsTestSource;
+            source += KeywordsTestSource;
+            // a string missing its end quote on a CRLF line, to poke at chunk boundary handling.
+            // This is an error, so we need to let a lot more of them through than usual
+            source += "var TestValue0_ = \"1.234;\r\nprint TestValue0_;\n";
+        }
+        Lexer::SetAllowableErrorCount(source.size());
+
+        std::vector<LoxToken> serialTokens;
+        StreamingLexer streamingLexer([&serialTokens](const LoxToken* tokens, size_t numTokens)
+        {
+            serialTokens.insert(serialTokens.end(), tokens, tokens + numTokens);
+        });
+        // one Feed() call, so every streamed view points into source and stays valid
+        streamingLexer.Feed(source);
+        streamingLexer.Finish();
+
+        auto& lexer = Lexer::GetLexerInstance();
+        Lexer::OutputHandle handle = lexer.ParseScriptParallel(source, 4u);
+        const TokenView parallelTokens = lexer.GetTokenView(handle);
+
+        CheckTokensMatch("Parallel lexing", serialTokens, parallelTokens.Tokens());
+        std::cout << "Parallel lexing test succeeded! " << parallelTokens.Size() << " tokens matched the serial path\n";
+        Lexer::SetAllowableErrorCount(16u);
+
+        // Now with the default limit, which the source goes well over: both paths have to stop on
+        // the same line. The session above ran under a bigger limit, so it mustn't come back
+        std::vector<LoxToken> limitedTokens;
+        StreamingLexer limitedLexer([&limitedTokens](const LoxToken* tokens, size_t numTokens)
+        {
+            limitedTokens.insert(limitedTokens.end(), tokens, tokens + numTokens);
+        });
+        limitedLexer.Feed(source);
+        limitedLexer.Finish();
+
+        const TokenView limitedParallelTokens = lexer.GetTokenView(lexer.ParseScriptParallel(source, 4u));
+        CheckTokensMatch("Parallel lexing past the error limit", limitedTokens, limitedParallelTokens.Tokens());
+        std::cout << "Parallel lexing past the error limit test succeeded! Both stopped after " <<
+            limitedParallelTokens.Size() << " tokens\n";
+    }
+
+    // Scans the same script under a tight error limit, then a looser one, then the tight one again.
+    // Each time the result has to match a fresh scan under the current limit, not whichever session
+    // the cache had for that source. Edits have to respect the new limit too
+    void RunErrorLimitRescanTest()
+    {
+        auto& lexer = Lexer::GetLexerInstance();
+        const std::string source = "a\n\"b\n\"c\n\"d\nvar x = 1 ;\n\"";
+        auto freshScan = [](std::string_view text)
+        {
+            std::vector<LoxToken> freshTokens;
+            StreamingLexer streamingLexer([&freshTokens](const LoxToken* tokens, size_t numTokens)
+            {
+                freshTokens.insert(freshTokens.end(), tokens, tokens + numTokens);
+            });
+            streamingLexer.Feed(text);
+            streamingLexer.Finish();
+            return freshTokens;
+        };
+
+        std::vector<Lexer::OutputHandle> handles;
+        for (const size_t errorLimit : { 1u, 16u, 1u })
+        {
+            Lexer::SetAllowableErrorCount(errorLimit);
+            handles.emplace_back(lexer.ParseScript(source));
+            CheckTokensMatch("Error limit rescan", freshScan(source), lexer.GetTokenView(handles.back()).Tokens());
+        }
+        if (handles[0] == handles[1] || handles[0] != handles[2] || lexer.GetTokenView(handles[1]).Size() <= lexer.GetTokenView(handles[0]).Size())
+        {
+            throw std::runtime_error("Error limit rescan test failed!");
+        }
+
+        // scanned under 16 with errors to spare, so lowering the limit makes the edited script stop early
+        const LoxSourceEdit edit{ 0u, 0u, "var y = 2 ;\n" };
+        Lexer::SetAllowableErrorCount(1u);
+        const Lexer::OutputHandle editedHandle = lexer.ApplyEdit(handles[1], edit);
+        CheckTokensMatch("Error limit rescan after edit", freshScan(std::string(edit.replacement) + source), lexer.GetTokenView(editedHandle).Tokens());
+
+        lexer.ReleaseSession(editedHandle);
+        lexer.ReleaseSession(handles[0]);
+        lexer.ReleaseSession(handles[2]);
+        Lexer::SetAllowableErrorCount(16u);
+        std::cout << "Error limit rescan test succeeded!\n";
+    }
+
+    // Flips the scan kernels back and forth while ParseScriptParallel workers are using them. Every
+    // level gives the same tokens, so each round still has to match the serial path
+    void RunKernelSwitchDuringLexingTest()
+    {
+        std::string source;
+        while (source.size() < (512u << 10u))
+        {
+            source += VarsAndLiteralsTestSource;
+        }
+
+        const ScanKernelLevel initialLevel = GetActiveScanKernelLevel();
+        std::atomic<bool> lexing{ true };
+        std::thread switcher([&lexing]()
+        {
+            uint32_t level = 0u;
+            while (lexing.load())
+            {
+                SetScanKernelLevel(static_cast<ScanKernelLevel>(level));
+                level = (level + 1u) % (static_cast<uint32_t>(GetSupportedScanKernelLevel()) + 1u);
+            }
+        });
+
+        auto& lexer = Lexer::GetLexerInstance();
+        bool tokensMatch = true;
+        for (size_t round = 0; round < 4u && tokensMatch; ++round)
+        {
+            // different text every round, so none of them come out of the session cache
+            const std::string roundSource = source + "// round " + std::to_string(round) + "\n";
+            std::vector<LoxToken> serialTokens;
+            StreamingLexer streamingLexer([&serialTokens](const LoxToken* tokens, size_t numTokens)
+            {
+                serialTokens.insert(serialTokens.end(), tokens, tokens + numTokens);
+            });
+            streamingLexer.Feed(roundSource);
+            streamingLexer.Finish();
+
+            const Lexer::OutputHandle handle = lexer.ParseScriptParallel(roundSource, 4u);
+            const std::span<const LoxToken> parallelTokens = lexer.GetTokenView(handle).Tokens();
+            tokensMatch = std::ranges::equal(serialTokens, parallelTokens, TokenComparator);
+            lexer.ReleaseSession(handle);
+        }
+
+        lexing.store(false);
+        switcher.join();
+        SetScanKernelLevel(initialLevel);
+        if (!tokensMatch)
+        {
+            throw std::runtime_error("Kernel switch during lexing test failed!");
+        }
+        std::cout << "Kernel switch during lexing test succeeded!\n";
+    }
+
+    // Same again, but pushes the source through a StreamingLexer chunkSize bytes at a time
+    template<size_t N>
+    void RunStreamingTokenStreamTest(const char* testName, const char* source, const size_t chunkSize, const std::array<LoxToken, N>& knownGoodTokens)
+    {
+        // streamed token views die with the callback, so keep our own copies of any literals
+        std::deque<std::string> literalStorage;
+        std::vector<LoxToken> tokens;
+        StreamingLexer streamingLexer([&literalStorage, &tokens](const LoxToken* streamedTokens, size_t numTokens)
+        {
+            for (size_t i = 0; i < numTokens; ++i)
+            {
+                LoxToken token = streamedTokens[i];
+                if (!token.strLiteral.empty())
+                {
+                    token.strLiteral = literalStorage.emplace_back(token.strLiteral);
+                }
+                tokens.emplace_back(token);
+            }
+        });
+
+        // copy each chunk into a scratch buffer we overwrite, to catch anything holding on to old input
+        const std::string_view sourceView(source);
+        std::string chunk;
+        for (size_t offset = 0u; offset < sourceView.size(); offset += chunkSize)
+        {
+            chunk.assign(sourceView.substr(offset, chunkSize));
+            streamingLexer.Feed(chunk);
+            std::fill(chunk.begin(), chunk.end(), '#');
+        }
+        streamingLexer.Finish();
+
+        CheckTokens(testName, source, tokens, knownGoodTokens);
+    }
+
 }
 
 std::string_view RunBasicLexerTests()
@@ -206,15 +1031,8 @@ std::string_view RunBasicLexerTests()
 
     Lexer::OutputHandle result = lexer.ParseScript(CommentPrintAndStringLiteralSource);
 
-    std::vector<LoxToken> tokens;
-    size_t numTokens = 0u;
-    lexer.GetTokensForHandle(result, numTokens, nullptr);
-    if (numTokens != 0u)
-    {
-        tokens.resize(numTokens);
-        lexer.GetTokensForHandle(result, numTokens, &tokens[0]);
-    }
-    else
+    TokenView tokens = lexer.GetTokenView(result);
+    if (tokens.Empty())
     {
         throw std::runtime_error("Failed to run test!");
     }
@@ -240,7 +1058,7 @@ std::string_view RunBasicLexerTests()
         std::cout << "Input source code: \n";
         std::cout << CommentPrintAndStringLiteralSource << "\n";
         std::cout << "Result tokens: \n";
-        std::string resultTokens = Helpers::GetLoxTokensString(tokens.size(), &tokens[0]);
+        std::string resultTokens = Helpers::GetLoxTokensString(tokens.Size(), &tokens[0]);
         std::cout << resultTokens << "\n";
     }
     else
@@ -254,13 +1072,8 @@ std::string_view RunBasicLexerTests()
     }
 
     result = lexer.ParseScript(VarsAndLiteralsTestSource);
-    lexer.GetTokensForHandle(result, numTokens, nullptr);
-    if (numTokens != 0u || numTokens != VarsAndLiteralsTestTokens.size())
-    {
-        tokens.resize(numTokens);
-        lexer.GetTokensForHandle(result, numTokens, &tokens[0]);
-    }
-    else
+    tokens = lexer.GetTokenView(result);
+    if (tokens.Empty())
     {
         throw std::runtime_error("Failed to parse second test script!");
     }
@@ -283,7 +1096,7 @@ std::string_view RunBasicLexerTests()
         std::cout << "Input source code:\n";
         std::cout << VarsAndLiteralsTestSource << "\n";
         std::cout << "Result tokens from source code:\n";
-        std::string resultTokens = Helpers::GetLoxTokensString(tokens.size(), &tokens[0]);
+        std::string resultTokens = Helpers::GetLoxTokensString(tokens.Size(), &tokens[0]);
         std::cout << resultTokens << "\n";
     }
     else
@@ -296,18 +1109,49 @@ std::string_view RunBasicLexerTests()
         throw std::runtime_error("Second test failed!");
     }
 
+    Helpers::RunTokenStreamTest("Keywords", KeywordsTestSource, KeywordsTestTokens);
+    Helpers::RunTokenStreamTest("Mixed line endings", MixedLineEndingsTestSource, MixedLineEndingsTestTokens);
+    Helpers::RunMappedFileTokenStreamTest("Memory mapped file", MappedFileTestSource, MappedFileTestTokens);
+    Helpers::RunTokenCacheFileTest("Token cache file", MappedFileTestSource, MappedFileTestTokens);
+    // chunk sizes chosen so literals, keywords and the CRLF pairs get split across chunks
+    Helpers::RunStreamingTokenStreamTest("Streaming (3 byte chunks)", VarsAndLiteralsTestSource, 3u, VarsAndLiteralsTestTokens);
+    Helpers::RunStreamingTokenStreamTest("Streaming mixed line endings (1 byte chunks)", MixedLineEndingsTestSource, 1u, MixedLineEndingsTestTokens);
+    Helpers::RunStreamingTokenStreamTest("Streaming keywords (5 byte chunks)", KeywordsTestSource, 5u, KeywordsTestTokens);
+    Helpers::RunReleasedSessionViewTest("Released session view", ShortTestSource, ShortTestTokens);
+    Helpers::RunParallelMatchesSerialTest();
+    Helpers::RunKernelSwitchDuringLexingTest();
+    Helpers::RunErrorLimitRescanTest();
+    // new line in the middle, then a deletion spanning a line break
+    Helpers::RunIncrementalEditTest("Incremental edit (insert line)", VarsAndLiteralsTestSource, VarsAndLiteralsTestTokens, LoxSourceEdit{ 26u, 0u, "var inserted = 2 ;\n" });
+    Helpers::RunIncrementalEditTest("Incremental edit (join lines)", VarsAndLiteralsTestSource, VarsAndLiteralsTestTokens, LoxSourceEdit{ 20u, 14u, "" });
+    // turns the lone CR into a CRLF, so two lines become one
+    Helpers::RunIncrementalEditTest("Incremental edit (CR to CRLF)", MixedLineEndingsTestSource, MixedLineEndingsTestTokens, LoxSourceEdit{ 16u, 0u, "\n" });
+    // ends a line on a keyword, right before the keyword opening the next line
+    Helpers::RunIncrementalEditTest("Incremental edit (keyword boundary)", KeywordsTestSource, KeywordsTestTokens, LoxSourceEdit{ 19u, 0u, " print" });
+    Helpers::RunBlockEditTest();
+    Helpers::RunSessionCacheTest();
+    Helpers::RunSharedSessionRaceTest();
+    Helpers::RunHashTest();
+    Helpers::RunSymbolTableTest();
+    Helpers::RunConcurrentSessionStoreTest();
+    Helpers::RunCompactTokenBufferTest("Compact tokens", VarsAndLiteralsTestSource, VarsAndLiteralsTestTokens);
+    Helpers::RunCompactTokenBufferTest("Compact tokens mixed line endings", MixedLineEndingsTestSource, MixedLineEndingsTestTokens);
+
     // Drop this, so we can do our error handling and printing tests
     Lexer::SetAllowableErrorCount(2u);
 
-    try
-    {
-        result = lexer.ParseScript(BrokenErrorHandlingTestSource);
-    }
-    catch (const std::runtime_error& error)
+    // going over the limit stops the scan instead of throwing, and says so at the end of the diagnostics
+    result = lexer.ParseScript(BrokenErrorHandlingTestSource);
+    DiagnosticBuffer diagnostics;
+    lexer.CollectDiagnostics(result, diagnostics);
+    const TokenView brokenTokens = lexer.GetTokenView(result);
+    if (diagnostics.Size() != 4u || diagnostics.Diagnostics().back().errorCode != LoxCompilerErrorCode::ErrorLimitReached ||
+        brokenTokens.Empty() || brokenTokens.Tokens().back().type != TokenType::EndOfFile)
     {
-        std::cerr << "Yay it broke\n";
-        std::cerr << error.what() << "\n";
+        throw std::runtime_error("Error limit test failed!");
     }
+    std::cerr << "Yay it broke\n";
+    std::cerr << make_error_code(LoxCompilerErrorCode::ErrorLimitReached).message() << "\n";
 
     return std::string_view{};
 }
\ No newline at end of file
@@ -0,0 +1,319 @@
+#include "ParserBenchmarks.hpp"
+#include "Diagnostics.hpp"
+#include "Expression.hpp"
+#include "Lexer.hpp"
+#include "Parser.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace
+{
+    double ApplyOperator(const TokenType op, const double lhs, const double rhs) noexcept
+    {
+        switch (op)
+        {
+        case TokenType::Plus: return lhs + rhs;
+        case TokenType::Minus: return lhs - rhs;
+        case TokenType::Star: return lhs * rhs;
+        case TokenType::Slash: return lhs / rhs;
+        default: return 0.0;
+        }
+    }
+
+    // The classic alternative: a node class per expression type, one heap allocation per node,
+    // children owned by pointer and dispatch through the vtable
+    struct VirtualExpression
+    {
+        virtual ~VirtualExpression() = default;
+        virtual double Evaluate() const noexcept = 0;
+    };
+
+    struct VirtualNumber final : VirtualExpression
+    {
+        explicit VirtualNumber(double value) : value(value) {}
+        double Evaluate() const noexcept override { return value; }
+
+        double value;
+    };
+
+    struct VirtualUnary final : VirtualExpression
+    {
+        VirtualUnary(TokenType op, std::unique_ptr<VirtualExpression> operand) : op(op), operand(std::move(operand)) {}
+        double Evaluate() const noexcept override { return -operand->Evaluate(); }
+
+        TokenType op;
+        std::unique_ptr<VirtualExpression> operand;
+    };
+
+    struct VirtualBinary final : VirtualExpression
+    {
+        VirtualBinary(std::unique_ptr<VirtualExpression> lhs, TokenType op, std::unique_ptr<VirtualExpression> rhs) :
+            lhs(std::move(lhs)), op(op), rhs(std::move(rhs)) {}
+        double Evaluate() const noexcept override { return ApplyOperator(op, lhs->Evaluate(), rhs->Evaluate()); }
+
+        std::unique_ptr<VirtualExpression> lhs;
+        TokenType op;
+        std::unique_ptr<VirtualExpression> rhs;
+    };
+
+    struct FlatBuilder
+    {
+        using Handle = ExpressionIndex;
+        ExpressionTree& tree;
+
+        Handle Number(double value) { return tree.AddNumericLiteral(value, SourceLocation{}); }
+        Handle Unary(TokenType op, Handle operand) { return tree.AddUnary(op, operand, SourceLocation{}); }
+        Handle Binary(Handle lhs, TokenType op, Handle rhs) { return tree.AddBinary(lhs, op, rhs, SourceLocation{}); }
+    };
+
+    struct VirtualBuilder
+    {
+        using Handle = std::unique_ptr<VirtualExpression>;
+
+        Handle Number(double value) { return std::make_unique<VirtualNumber>(value); }
+        Handle Unary(TokenType op, Handle operand) { return std::make_unique<VirtualUnary>(op, std::move(operand)); }
+        Handle Binary(Handle lhs, TokenType op, Handle rhs) { return std::make_unique<VirtualBinary>(std::move(lhs), op, std::move(rhs)); }
+    };
+
+    constexpr std::array<TokenType, 4> k_binaryOperators{ TokenType::Plus, TokenType::Minus, TokenType::Star, TokenType::Slash };
+
+    // Random arithmetic subtree. Same seed, same shape, whichever builder it goes into
+    template<typename Builder>
+    typename Builder::Handle GenerateSubtree(Builder& builder, std::mt19937& random, const size_t depth)
+    {
+        const uint32_t roll = random();
+        if (depth == 0u || (roll & 7u) == 0u)
+        {
+            return builder.Number(static_cast<double>(roll % 100u) + 1.0);
+        }
+        if ((roll & 7u) == 1u)
+        {
+            return builder.Unary(TokenType::Minus, GenerateSubtree(builder, random, depth - 1u));
+        }
+
+        auto lhs = GenerateSubtree(builder, random, depth - 1u);
+        auto rhs = GenerateSubtree(builder, random, depth - 1u);
+        return builder.Binary(std::move(lhs), k_binaryOperators[(roll >> 3u) & 3u], std::move(rhs));
+    }
+
+    // What a parser hands back for a long run of subtrees joined by +: a left-leaning spine
+    template<typename Builder>
+    typename Builder::Handle GenerateExpression(Builder& builder, const size_t numSubtrees)
+    {
+        std::mt19937 random(0xA57u);
+        auto result = GenerateSubtree(builder, random, 10u);
+        for (size_t i = 1; i < numSubtrees; ++i)
+        {
+            auto subtree = GenerateSubtree(builder, random, 10u);
+            result = builder.Binary(std::move(result), TokenType::Plus, std::move(subtree));
+        }
+        return result;
+    }
+
+    // The same evaluator as a visitor: std::visit picks the overload from the variant index,
+    // so there's nothing virtual and the whole thing can inline into one function
+    struct EvaluateVisitor
+    {
+        const ExpressionTree& tree;
+
+        double operator()(const NumericLiteralExpression& expr) const noexcept { return expr.Value(); }
+        double operator()(const UnaryExpression& expr) const noexcept { return -VisitExpression(tree, expr.operand, *this); }
+        double operator()(const BinaryExpression& expr) const noexcept
+        {
+            return ApplyOperator(expr.op, VisitExpression(tree, expr.lhs, *this), VisitExpression(tree, expr.rhs, *this));
+        }
+        double operator()(const GroupingExpression& expr) const noexcept { return VisitExpression(tree, expr.inner, *this); }
+        double operator()(const auto&) const noexcept { return 0.0; }
+    };
+
+    // Children always come first in a flat tree, so one forward pass with a value per node does it
+    double EvaluateInOrder(const ExpressionTree& tree, std::vector<double>& values)
+    {
+        const std::span<const ExpressionNode> nodes = tree.Nodes();
+        values.resize(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            values[i] = std::visit(Overloaded{
+                [](const NumericLiteralExpression& expr) { return expr.Value(); },
+                [&values](const UnaryExpression& expr) { return -values[expr.operand]; },
+                [&values](const BinaryExpression& expr) { return ApplyOperator(expr.op, values[expr.lhs], values[expr.rhs]); },
+                [&values](const GroupingExpression& expr) { return values[expr.inner]; },
+                [](const auto&) { return 0.0; } }, nodes[i].expression);
+        }
+        return values[tree.Root()];
+    }
+
+    // One long expression statement: a mix of every operator, literal and grouping the parser
+    // knows, with a comment line every so often
+    std::string GenerateExpressionSource(const size_t numTerms)
+    {
+        constexpr std::array<std::string_view, 6> k_terms
+        {
+            "( someIdentifier + 12.5 ) * otherIdentifier",
+            "-counter / 4 - 1",
+            "\"a string\" + name",
+            "!finished == true",
+            "value_2 or flag and otherFlag",
+            "( ( a - b ) * ( c + 0.5 ) ) / d",
+        };
+
+        std::string source;
+        for (size_t i = 0; i < numTerms; ++i)
+        {
+            source += k_terms[i % k_terms.size()];
+            source += (i + 1u) % 16u == 0u ? " +\n// keep going\n" : " + ";
+        }
+        source += "1 ;\n";
+        return source;
+    }
+
+    // Declarations, prints and blocks. Broken ones are missing an operand, which the parser
+    // finds partway through the statement
+    std::string GenerateStatementSource(const size_t numStatements, const bool breakSome)
+    {
+        constexpr std::array<std::string_view, 4> k_statements
+        {
+            "var someIdentifier = ( otherIdentifier + 12.5 ) * 2 ;\n",
+            "print someIdentifier / 4 - \"text\" ;\n",
+            "{ var inner = someIdentifier ; print inner == nil ; }\n",
+            "someIdentifier != otherIdentifier or finished ;\n",
+        };
+
+        std::string source;
+        for (size_t i = 0; i < numStatements; ++i)
+        {
+            source += breakSome && i % 4u == 3u ? "print someIdentifier * ;\n" : k_statements[i % k_statements.size()];
+        }
+        return source;
+    }
+
+    std::string FormatTokenLine(std::string_view name, const size_t numTokens, const double seconds)
+    {
+        char buffer[160];
+        std::snprintf(buffer, sizeof(buffer), "%-32.*s | %9zu tokens | best %9.3f ms | %7.2f M tokens/s\n",
+            static_cast<int>(name.size()), name.data(), numTokens, seconds * 1000.0, static_cast<double>(numTokens) / seconds / 1e6);
+        return std::string(buffer);
+    }
+
+    template<typename Fn>
+    double BestSeconds(const size_t iterations, Fn&& fn)
+    {
+        double best = std::numeric_limits<double>::max();
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            fn();
+            const auto end = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double>(end - start).count());
+        }
+        return best;
+    }
+
+    std::string FormatNodeLine(std::string_view name, const size_t numNodes, const double seconds)
+    {
+        char buffer[160];
+        std::snprintf(buffer, sizeof(buffer), "%-32.*s | %9zu nodes | best %9.3f ms | %7.2f ns/node\n",
+            static_cast<int>(name.size()), name.data(), numNodes, seconds * 1000.0, seconds * 1e9 / static_cast<double>(numNodes));
+        return std::string(buffer);
+    }
+}
+
+std::string RunParserBenchmarks()
+{
+    constexpr size_t k_numSubtrees = 4096u;
+    constexpr size_t k_iterations = 5u;
+    std::string results("AST benchmarks (flat ExpressionTree of variants against virtual nodes, one heap allocation each)\n");
+
+    // count first, so the flat build can reserve like the parser does
+    ExpressionTree flatTree;
+    FlatBuilder flatBuilder{ flatTree };
+    flatTree.SetRoot(GenerateExpression(flatBuilder, k_numSubtrees));
+    const size_t numNodes = flatTree.Size();
+
+    const double flatBuildSeconds = BestSeconds(k_iterations, [&flatTree, numNodes]()
+    {
+        flatTree.Clear();
+        flatTree.Reserve(numNodes);
+        FlatBuilder builder{ flatTree };
+        flatTree.SetRoot(GenerateExpression(builder, k_numSubtrees));
+    });
+    // includes freeing the tree, which is part of what a pointer tree costs
+    const double virtualBuildSeconds = BestSeconds(k_iterations, []()
+    {
+        VirtualBuilder builder;
+        std::unique_ptr<VirtualExpression> virtualTree = GenerateExpression(builder, k_numSubtrees);
+    });
+    results += FormatNodeLine("Build/flat variant", numNodes, flatBuildSeconds);
+    results += FormatNodeLine("Build/virtual", numNodes, virtualBuildSeconds);
+
+    VirtualBuilder virtualBuilder;
+    const std::unique_ptr<VirtualExpression> virtualTree = GenerateExpression(virtualBuilder, k_numSubtrees);
+    // stops the walks from being optimized away entirely
+    volatile double sink = 0.0;
+    std::vector<double> values;
+    const double visitSeconds = BestSeconds(k_iterations, [&]()
+    {
+        sink = sink + VisitExpression(flatTree, flatTree.Root(), EvaluateVisitor{ flatTree });
+    });
+    const double virtualSeconds = BestSeconds(k_iterations, [&]() { sink = sink + virtualTree->Evaluate(); });
+    const double inOrderWalkSeconds = BestSeconds(k_iterations, [&]() { sink = sink + EvaluateInOrder(flatTree, values); });
+    results += FormatNodeLine("Evaluate/std::visit recursive", numNodes, visitSeconds);
+    results += FormatNodeLine("Evaluate/virtual recursive", numNodes, virtualSeconds);
+    results += FormatNodeLine("Evaluate/flat in node order", numNodes, inOrderWalkSeconds);
+
+    // Parse throughput over tokens the lexer already has. The parser borrows them, so all a
+    // parse allocates is the tree. Copying the tokens out first is what it used to cost
+    auto& lexer = Lexer::GetLexerInstance();
+    const TokenView tokenView = lexer.GetTokenView(lexer.ParseScript(GenerateExpressionSource(64u * 1024u)));
+    size_t parsedNodes = 0u;
+    const double parseSeconds = BestSeconds(k_iterations, [&tokenView, &parsedNodes]()
+    {
+        Parser parser(tokenView.Tokens());
+        parsedNodes = parser.ParseExpression().Size();
+    });
+    const double copyAndParseSeconds = BestSeconds(k_iterations, [&tokenView]()
+    {
+        const std::vector<LoxToken> tokens(tokenView.begin(), tokenView.end());
+        Parser parser(tokens);
+        parser.ParseExpression();
+    });
+    results += FormatTokenLine("Parse/borrowed tokens", tokenView.Size(), parseSeconds);
+    results += FormatTokenLine("Parse/copied tokens", tokenView.Size(), copyAndParseSeconds);
+    results += FormatNodeLine("Parse/borrowed tokens", parsedNodes, parseSeconds);
+
+    // Statements where every fourth one is broken. Each error is a diagnostic and a skip to the
+    // next statement, so this shouldn't be far off the clean script
+    const TokenView cleanStatements = lexer.GetTokenView(lexer.ParseScript(GenerateStatementSource(32u * 1024u, false)));
+    const TokenView brokenStatements = lexer.GetTokenView(lexer.ParseScript(GenerateStatementSource(32u * 1024u, true)));
+    DiagnosticBuffer diagnostics(16u * 1024u);
+    const double cleanSeconds = BestSeconds(k_iterations, [&cleanStatements, &diagnostics]()
+    {
+        diagnostics.Clear();
+        Parser parser(cleanStatements.Tokens());
+        parser.ParseProgram(diagnostics);
+    });
+    const double brokenSeconds = BestSeconds(k_iterations, [&brokenStatements, &diagnostics]()
+    {
+        diagnostics.Clear();
+        Parser parser(brokenStatements.Tokens());
+        parser.ParseProgram(diagnostics);
+    });
+    results += FormatTokenLine("Parse/statements", cleanStatements.Size(), cleanSeconds);
+    results += FormatTokenLine("Parse/statements, 1 in 4 broken", brokenStatements.Size(), brokenSeconds);
+    char errorLine[96];
+    std::snprintf(errorLine, sizeof(errorLine), "%-32s | %9zu errors, %zu dropped\n", "Parse/diagnostics reported",
+        diagnostics.Size(), diagnostics.DroppedCount());
+    results += errorLine;
+
+    return results;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#ifndef LOX_PARSER_BENCHMARKS_HPP
+#define LOX_PARSER_BENCHMARKS_HPP
+#include <string>
+
+// AST benchmarks: building and walking large generated expression trees. Like the lexer
+// benchmarks these only run with --bench. Writes out results to a string that can be printed.
+std::string RunParserBenchmarks();
+
+#endif //!LOX_PARSER_BENCHMARKS_HPP
@@ -0,0 +1,203 @@
+#include "ParserTests.hpp"
+#include "ConstantFolding.hpp"
+#include "Diagnostics.hpp"
+#include "Expression.hpp"
+#include "Lexer.hpp"
+#include "Parser.hpp"
+#include "Statement.hpp"
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Helpers
+{
+    ExpressionTree ParseSource(const char* source)
+    {
+        auto& lexer = Lexer::GetLexerInstance();
+        Parser parser(lexer.GetTokenView(lexer.ParseScript(source)));
+        return parser.ParseExpression();
+    }
+
+    // Nodes can only point backwards, and every node has to be reachable from the root exactly once
+    bool TreeLayoutValid(const ExpressionTree& tree)
+    {
+        std::vector<size_t> parentCounts(tree.Size(), 0u);
+        for (ExpressionIndex idx = 0u; idx < tree.Size(); ++idx)
+        {
+            const auto childValid = [&parentCounts, idx](const ExpressionIndex child)
+            {
+                if (child >= idx)
+                {
+                    return false;
+                }
+                ++parentCounts[child];
+                return true;
+            };
+
+            const bool childrenValid = VisitExpression(tree, idx, Overloaded{
+                [&](const UnaryExpression& expr) { return childValid(expr.operand); },
+                [&](const BinaryExpression& expr) { return childValid(expr.lhs) && childValid(expr.rhs); },
+                [&](const GroupingExpression& expr) { return childValid(expr.inner); },
+                [&](const AssignExpression& expr) { return childValid(expr.target) && childValid(expr.value); },
+                [](const auto&) { return true; } });
+            if (!childrenValid)
+            {
+                return false;
+            }
+        }
+
+        for (ExpressionIndex idx = 0u; idx < tree.Size(); ++idx)
+        {
+            if (parentCounts[idx] != (idx == tree.Root() ? 0u : 1u))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void RunExpressionTest(const char* testName, const char* source, const std::string& expected, const size_t expectedNodes)
+    {
+        const ExpressionTree tree = ParseSource(source);
+        const std::string printed = PrintExpression(tree, tree.Root());
+        if (printed != expected || tree.Size() != expectedNodes || !TreeLayoutValid(tree))
+        {
+            std::cout << testName << " expected " << expected << " with " << expectedNodes << " nodes, got " <<
+                printed << " with " << tree.Size() << " nodes\n";
+            throw std::runtime_error(std::string(testName) + " test failed!");
+        }
+
+        std::cout << testName << " test succeeded! Parsed as " << printed << "\n";
+    }
+
+    void RunFoldTest(const char* testName, const char* source, const std::string& expected, const size_t expectedEliminated)
+    {
+        ExpressionTree tree = ParseSource(source);
+        const FoldStats stats = FoldConstants(tree);
+        const std::string printed = PrintExpression(tree, tree.Root());
+        if (printed != expected || stats.Eliminated() != expectedEliminated)
+        {
+            std::cout << testName << " expected " << expected << " with " << expectedEliminated << " nodes eliminated, got " <<
+                printed << " with " << FormatFoldStats(stats) << "\n";
+            throw std::runtime_error(std::string(testName) + " test failed!");
+        }
+
+        std::cout << testName << " test succeeded! Folded to " << printed << ", " << FormatFoldStats(stats) << "\n";
+    }
+
+    void RunParseErrorTest(const char* testName, const char* source, const LoxCompilerErrorCode expectedError)
+    {
+        try
+        {
+            ParseSource(source);
+        }
+        catch (const ParseError& error)
+        {
+            // the message comes from the error category, which should have real text for every parser code
+            const std::string message = make_error_code(expectedError).message();
+            if (error.errorCode == expectedError && message == error.what() && !message.starts_with("Unknown error"))
+            {
+                std::cout << testName << " test succeeded! Got: " << error.what() << "\n";
+                return;
+            }
+        }
+
+        throw std::runtime_error(std::string(testName) + " test failed!");
+    }
+
+    struct ExpectedDiagnostic
+    {
+        LoxCompilerErrorCode errorCode;
+        size_t line;
+    };
+
+    // Every broken statement gets exactly one diagnostic, and everything else still parses
+    void RunRecoveryTest(const char* testName, const char* source, const std::vector<ExpectedDiagnostic>& expectedDiagnostics,
+        const size_t expectedTopLevel)
+    {
+        auto& lexer = Lexer::GetLexerInstance();
+        const Lexer::OutputHandle handle = lexer.ParseScript(source);
+        DiagnosticBuffer diagnostics;
+        lexer.CollectDiagnostics(handle, diagnostics);
+        Parser parser(lexer.GetTokenView(handle));
+        const Program program = parser.ParseProgram(diagnostics);
+
+        bool matched = diagnostics.Size() == expectedDiagnostics.size() && program.TopLevel().size() == expectedTopLevel;
+        for (size_t i = 0; matched && i < expectedDiagnostics.size(); ++i)
+        {
+            const LoxDiagnostic& diagnostic = diagnostics.Diagnostics()[i];
+            matched = diagnostic.errorCode == expectedDiagnostics[i].errorCode && diagnostic.line == expectedDiagnostics[i].line;
+        }
+
+        if (!matched)
+        {
+            std::cout << testName << " expected " << expectedDiagnostics.size() << " diagnostics and " << expectedTopLevel <<
+                " statements, got " << diagnostics.Size() << " and " << program.TopLevel().size() << "\n";
+            for (const LoxDiagnostic& diagnostic : diagnostics.Diagnostics())
+            {
+                std::cout << "    code " << static_cast<int>(diagnostic.errorCode) << " on line " << diagnostic.line << "\n";
+            }
+            throw std::runtime_error(std::string(testName) + " test failed!");
+        }
+
+        std::cout << testName << " test succeeded! " << diagnostics.Size() << " diagnostics, " <<
+            program.TopLevel().size() << " statements kept\n";
+    }
+}
+
+std::string_view RunBasicParserTests()
+{
+    Helpers::RunExpressionTest("Precedence", "1 + 2 * 3 - 4 / 2 ;\n", "(- (+ 1 (* 2 3)) (/ 4 2))", 9u);
+    Helpers::RunExpressionTest("Unary and grouping", "-( 1 + 2 ) == !false ;\n", "(== (- (group (+ 1 2))) (! false))", 8u);
+    Helpers::RunExpressionTest("Left associativity", "1 - 2 - 3 / 4 / 5 ;\n", "(- (- 1 2) (/ (/ 3 4) 5))", 9u);
+    Helpers::RunExpressionTest("Logical operators", "a or b and c == -d ;\n", "(or a (and b (== c (- d))))", 8u);
+    Helpers::RunExpressionTest("Comments between tokens", "// leading comment\n1 + // trailing comment\n2 ;\n", "(+ 1 2)", 3u);
+    Helpers::RunExpressionTest("Comparison", "a < b == c >= -1 ;\n", "(== (< a b) (>= c (- 1)))", 8u);
+    Helpers::RunExpressionTest("Assignment", "a = b = c or d ;\n", "(= a (= b (or c d)))", 7u);
+    Helpers::RunExpressionTest("Strings and identifiers", "\"some text\" + name != nil ;\n", "(!= (+ some text name) nil)", 5u);
+
+    // location of the root, which is the == operator
+    const ExpressionTree tree = Helpers::ParseSource("\n  true == false ;\n");
+    const SourceLocation rootLocation = tree.Location(tree.Root());
+    if (rootLocation.line != 1u || rootLocation.column != 7u)
+    {
+        throw std::runtime_error("Expression location test failed!");
+    }
+    std::cout << "Expression location test succeeded!\n";
+
+    Helpers::RunFoldTest("Folding arithmetic", "1 + 2 * 3 - 4 / 2 ;\n", "5", 8u);
+    Helpers::RunFoldTest("Folding unary and grouping", "-( 1 + 2 ) == !false ;\n", "false", 7u);
+    Helpers::RunFoldTest("Folding strings", "\"ab\" + \"cd\" == \"abcd\" ;\n", "true", 4u);
+    Helpers::RunFoldTest("Folding IEEE edge cases", "0 / 0 == 0 / 0 or -0 ;\n", "-0", 9u);
+    Helpers::RunFoldTest("Folding around variables", "( a - b ) * 1 + c / 1 ;\n", "(+ (- a b) (/ c 1))", 3u);
+    Helpers::RunFoldTest("Adding negative zero", "-a + -0 ;\n", "(- a)", 3u);
+    Helpers::RunFoldTest("Double negation", "!!( a < b ) == !!c ;\n", "(== (< a b) (! (! c)))", 3u);
+    Helpers::RunFoldTest("Short-circuit on a literal", "nil and a or ( b = 2 ) ;\n", "(= b 2)", 5u);
+    // these would fail at runtime, or come out different if simplified, so they stay
+    Helpers::RunFoldTest("Not folding errors", "\"a\" * 1 + -nil - ( 1 < \"b\" ) ;\n", "(- (+ (* a 1) (- nil)) (< 1 b))", 1u);
+    Helpers::RunFoldTest("Not folding x + 0", "-a + 0 ;\n", "(+ (- a) 0)", 0u);
+
+    Helpers::RunParseErrorTest("Unclosed parentheses", "( 1 + 2 ;\n", LoxCompilerErrorCode::UnclosedParentheses);
+    Helpers::RunParseErrorTest("Missing operand", "1 + ;\n", LoxCompilerErrorCode::MissingPrimaryToken);
+    Helpers::RunParseErrorTest("Invalid assignment target", "a + b = c ;\n", LoxCompilerErrorCode::InvalidAssignmentTarget);
+
+    Helpers::RunRecoveryTest("Statements",
+        "var a = 1 ;\nvar b ;\nprint a + b ;\n{ var c = a ; { print c ; } }\nc == a ;\nwhile ( a < 3 ) a = a + 1 ;\n", {}, 6u);
+    Helpers::RunRecoveryTest("Panic mode recovery",
+        "print 1 + ;\n"
+        "var a = ( 2 * 3 ;\n"
+        "print a ;\n"
+        "{ var b = 1 ; print b + ; print b ; }\n"
+        "var = 4 ;\n"
+        "print \"done\" ;\n",
+        {
+            { LoxCompilerErrorCode::MissingPrimaryToken, 0u },
+            { LoxCompilerErrorCode::UnclosedParentheses, 1u },
+            { LoxCompilerErrorCode::MissingPrimaryToken, 3u },
+            { LoxCompilerErrorCode::ExpectedTokenNotFound, 4u },
+        }, 3u);
+    Helpers::RunRecoveryTest("Unclosed block", "{ print 1 ;\nprint 2 ;\n", { { LoxCompilerErrorCode::UnclosedBrackets, 2u } }, 0u);
+
+    return std::string_view{};
+}
@@ -0,0 +1,10 @@
+#pragma once
+#ifndef LOX_PARSER_TESTS_HPP
+#define LOX_PARSER_TESTS_HPP
+#include <string_view>
+
+// Parses small expressions from lexed source and checks the resulting trees, by their printed
+// form and by their layout. Writes out results to a string that can be printed.
+std::string_view RunBasicParserTests();
+
+#endif //!LOX_PARSER_TESTS_HPP